@@ -3,10 +3,14 @@
 #include "OutputStream.h"
 #include "main.h"
 #include "Consoles.h"
+#include "MessageQueue.h"
+#include "Module.h"
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
+#include "stream_buffer.h"
 
 /* FreeRTOS+TCP includes. */
 #include "FreeRTOS_IP.h"
@@ -18,6 +22,25 @@
 
 #include <string>
 #include <map>
+#include <algorithm>
+
+/*
+    Binary frames on the command websocket are a streaming channel for gcode.
+    Each message is a batch: a 4 byte big endian sequence number followed by one or more \n terminated lines.
+    Frames are limited to 132 bytes so a bigger batch is sent as a fragmented message, the continuation frames
+    are part of the same batch.
+    The lines are fed to the command thread without a per line ok, once every line in a batch has been queued
+    the batch is acknowledged with a 6 byte binary frame:
+        4 byte big endian sequence number of the batch, 2 byte big endian window
+    The window is the number of bytes free in the stream buffer, each frame of a batch uses its length plus 3 bytes of it,
+    the host may have as many batches in flight as fit in the last window it was sent.
+    A batch with no lines just gets an ack, so can be used to get the initial window.
+    Replies other than ok (errors, alarms etc) are sent as text frames, text frames are handled as before.
+*/
+#define STREAM_BUFFER_SIZE 4096
+// flags for each fragment in the stream buffer
+#define STREAM_START 0x01
+#define STREAM_FIN 0x02
 
 class WebSocketState
 {
@@ -44,7 +67,19 @@ public:
     uint16_t plen;
     uint16_t o;
     uint16_t m;
+    uint8_t opcode{0};
+    bool start{true}; // first frame of a message
+    bool fin{true};   // last frame of a message
     bool discard{false};
+
+    // binary streaming channel
+    OutputStream *sos{nullptr};
+    StreamBufferHandle_t stream{nullptr};
+    SemaphoreHandle_t write_mutex{nullptr}; // the command thread and the stream feeder both write to the socket
+    bool stream_in_batch{false};
+    volatile bool stream_running{false};
+    volatile bool stream_abort{false};
+    bool release_on_exit{false}; // the connection closed while the feeder was still running
 };
 
 /* Read data from a websocket and decode it.
@@ -63,7 +98,8 @@ static BaseType_t websocket_decode(WebSocketState& state, char *buf, size_t len)
         uint8_t *hdr = (uint8_t*)state.data.data();
 
         // parse initial 6 bytes of header
-        if((hdr[0] & 0x80) == 0) {
+        state.fin = (hdr[0] & 0x80) != 0;
+        if(!state.fin && !state.is_command) {
             // must have fin bit
             // TODO need to handle this correctly, as it would notify the end of a large file upload
             printf("websocket_read: WARNING FIN bit not set\n");
@@ -112,9 +148,11 @@ static BaseType_t websocket_decode(WebSocketState& state, char *buf, size_t len)
     // now unmask the data
     uint8_t opcode = hdr[0] & 0x0F;
     switch (opcode) {
-        case 0x00: // continuation
+        case 0x00: // continuation of the current message
         case 0x01: // text
         case 0x02: // bin
+            state.start = opcode != 0x00;
+            if(state.start) state.opcode = opcode;
             /* unmask */
             for (int i = 0; i < state.plen; i++) {
                 buf[i] = payload[i] ^ hdr[state.m + i % 4];
@@ -191,6 +229,16 @@ static int websocket_write(Socket_t conn, const char *data, size_t len, uint8_t
     return len;
 }
 
+// used when more than one thread can write to the socket
+static int websocket_send(WebSocketState& state, const char *data, size_t len, uint8_t mode)
+{
+    xSemaphoreTake(state.write_mutex, portMAX_DELAY);
+    // once the stream is aborted the connection is closing
+    int n = state.stream_abort ? -1 : websocket_write(state.conn, data, len, mode);
+    xSemaphoreGive(state.write_mutex);
+    return n;
+}
+
 static const char endbuf[] = {0x88, 0x02, 0x03, 0xe8};
 
 static BaseType_t handle_upload(HTTPClient_t *pclient, WebSocketState& state)
@@ -289,6 +337,179 @@ static BaseType_t handle_upload(HTTPClient_t *pclient, WebSocketState& state)
     return rc;
 }
 
+// read exactly len bytes from the stream buffer, returns false if the stream is being shut down
+static bool stream_read(WebSocketState& state, uint8_t *buf, size_t len)
+{
+    while(len > 0) {
+        if(state.stream_abort) return false;
+        size_t n = xStreamBufferReceive(state.stream, buf, len, pdMS_TO_TICKS(100));
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// returns true if the line was queued
+static bool stream_line(WebSocketState& state, const char *line)
+{
+    // lines are dropped while halted, the host is told about the halt by the alarm
+    if(Module::is_halted() || state.stream_abort) return false;
+
+    // clear the done flag here to avoid race conditions, the same as the other consoles
+    state.sos->clear_flags();
+    // the feeder has nothing else to do so it just waits until the command thread has room
+    send_message_queue(line, state.sos, true);
+    return true;
+}
+
+static void release_state(WebSocketState *ws);
+
+// takes the fragments queued by handle_stream and feeds the lines to the command thread, then acks each batch
+static void stream_feeder(void *arg)
+{
+    WebSocketState& state = *static_cast<WebSocketState*>(arg);
+    char line[MAX_LINE_LENGTH];
+    size_t cnt = 0;
+    bool discard = false;
+    bool queued = false;
+    uint8_t seq[4]{0};
+
+    while(!state.stream_abort) {
+        // each fragment is preceded by its length and flags, the first fragment of a batch starts with the sequence number
+        uint8_t hdr[3];
+        if(!stream_read(state, hdr, sizeof(hdr))) break;
+        size_t len = (hdr[0] << 8) | hdr[1];
+        bool fin = (hdr[2] & STREAM_FIN) != 0;
+        if((hdr[2] & STREAM_START) != 0) {
+            if(!stream_read(state, seq, sizeof(seq))) break;
+            len -= sizeof(seq);
+        }
+
+        while(len > 0) {
+            char buf[64];
+            size_t n = std::min(len, sizeof(buf));
+            if(!stream_read(state, (uint8_t *)buf, n)) break;
+            len -= n;
+
+            for (size_t i = 0; i < n; ++i) {
+                char c = buf[i];
+                // the end of a batch also ends the line
+                if(c == '\n' || (fin && len == 0 && i == n - 1)) {
+                    if(c != '\n' && c != '\r' && !discard && cnt < sizeof(line) - 1) line[cnt++] = c;
+                    line[cnt] = '\0';
+                    if(cnt > 0 && !discard && stream_line(state, line)) queued = true;
+                    cnt = 0;
+                    discard = false;
+
+                } else if(c == '\r' || discard) {
+                    continue;
+
+                } else if(cnt >= sizeof(line) - 1) {
+                    discard = true;
+                    cnt = 0;
+                    state.sos->puts("error:Discarding long line\n");
+
+                } else {
+                    line[cnt++] = c;
+                }
+            }
+        }
+        if(state.stream_abort) break;
+        if(!fin) continue;
+
+        // the whole batch is queued so ack it with the current window
+        size_t window = std::min(xStreamBufferSpacesAvailable(state.stream), (size_t)0xFFFF);
+        uint8_t ack[6] = {seq[0], seq[1], seq[2], seq[3], (uint8_t)(window >> 8), (uint8_t)(window & 0xFF)};
+        if(websocket_send(state, (const char *)ack, sizeof(ack), 0x02) < 0) break;
+    }
+
+    // the command thread may still be running the last line we queued, so the stream can not be released until it is done
+    if(queued) {
+        while(!state.sos->is_done()) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+
+    // if the connection has already been closed we have to release it
+    taskENTER_CRITICAL();
+    state.stream_running = false;
+    bool release = state.release_on_exit;
+    taskEXIT_CRITICAL();
+
+    if(release) release_state(&state);
+    vTaskDelete(NULL);
+}
+
+// queue a binary fragment for the stream feeder, returns false if the host overran the window or broke the protocol
+static bool handle_stream(WebSocketState& state, size_t len, bool start, bool fin)
+{
+    if(start) {
+        if(state.stream_in_batch) {
+            printf("handle_stream: new batch before the last one finished\n");
+            return false;
+        }
+        if(len < 4) {
+            printf("handle_stream: batch too short: %u\n", len);
+            return false;
+        }
+
+    } else if(!state.stream_in_batch) {
+        printf("handle_stream: continuation without a batch\n");
+        return false;
+    }
+
+    if(state.stream == nullptr) {
+        // first batch so setup the stream
+        state.stream = xStreamBufferCreate(STREAM_BUFFER_SIZE, 1);
+        if(state.stream == nullptr) {
+            printf("handle_stream: failed to allocate stream buffer\n");
+            return false;
+        }
+        // returns ok for every line, that is what the acks replace
+        state.sos = new OutputStream([&state](const char *ibuf, size_t ilen) {
+            if(ilen == 3 && strncmp(ibuf, "ok\n", 3) == 0) return (int)ilen;
+            return websocket_send(state, ibuf, ilen, 0x01);
+        });
+        state.stream_running = true;
+        // the same priority as the player as it is doing the same job
+        if(xTaskCreate(stream_feeder, "WSStream", 2000 / 4, &state, (tskIDLE_PRIORITY + 1UL), (TaskHandle_t *) NULL) != pdPASS) {
+            printf("handle_stream: failed to create feeder task\n");
+            state.stream_running = false;
+            return false;
+        }
+    }
+
+    if(xStreamBufferSpacesAvailable(state.stream) < len + 3) {
+        printf("handle_stream: host overran the window\n");
+        websocket_send(state, "error:stream window overrun\n", 28, 0x01);
+        return false;
+    }
+
+    uint8_t hdr[3] = {(uint8_t)(len >> 8), (uint8_t)(len & 0xFF), (uint8_t)((start ? STREAM_START : 0) | (fin ? STREAM_FIN : 0))};
+    xStreamBufferSend(state.stream, hdr, sizeof(hdr), 0);
+    xStreamBufferSend(state.stream, state.buffer, len, 0);
+    state.stream_in_batch = !fin;
+    return true;
+}
+
+// returns true if the state can be released now, otherwise the feeder releases it when it exits
+static bool stop_stream(WebSocketState& state)
+{
+    state.sos->set_closed();
+
+    // wait for any write in progress, nothing more is written to the socket once this is set
+    xSemaphoreTake(state.write_mutex, portMAX_DELAY);
+    state.stream_abort = true;
+    xSemaphoreGive(state.write_mutex);
+
+    taskENTER_CRITICAL();
+    bool running = state.stream_running;
+    state.release_on_exit = running;
+    taskEXIT_CRITICAL();
+
+    return !running;
+}
+
 static BaseType_t handle_command(HTTPClient_t *pclient, WebSocketState & state)
 {
     BaseType_t rc;
@@ -316,6 +537,7 @@ static BaseType_t handle_command(HTTPClient_t *pclient, WebSocketState & state)
         // we got an error
         // make sure command thread does not try to write to the soon to be closed (and deleted) conn
         state.os->set_closed();
+        if(state.sos != nullptr) state.sos->set_closed();
         if(rc == -1) {
             // send exit string if we got one
             send_all(state.conn, endbuf, sizeof(endbuf));
@@ -325,6 +547,17 @@ static BaseType_t handle_command(HTTPClient_t *pclient, WebSocketState & state)
     }
 
     // we now have a decoded websocket payload that is rc bytes long
+    if(state.opcode == 0x02) {
+        // a continuation frame is part of the current batch
+        if(!handle_stream(state, rc, state.start, state.fin)) {
+            state.os->set_closed();
+            if(state.sos != nullptr) state.sos->set_closed();
+            send_all(state.conn, endbuf, sizeof(endbuf));
+            return -2;
+        }
+        return rc;
+    }
+
     process_command_buffer(rc, state.buffer, state.os, state.line, state.cnt, state.discard);
     return rc;
 }
@@ -342,7 +575,8 @@ extern "C" BaseType_t create_websocket_handler(HTTPClient_t *pclient, int is_com
     if(is_command == 1) {
         // create the OutputStream that commands can write to
         // FIXME this may need to stay around until command thread is done with it
-        ws->os = new OutputStream([ws](const char *ibuf, size_t ilen) { return websocket_write(ws->conn, ibuf, ilen, 0x01); });
+        ws->write_mutex = xSemaphoreCreateMutex();
+        ws->os = new OutputStream([ws](const char *ibuf, size_t ilen) { return websocket_send(*ws, ibuf, ilen, 0x01); });
         ws->buffer = (char*)malloc(132);
         ws->bufsize = 132;
 
@@ -360,27 +594,53 @@ extern "C" BaseType_t create_websocket_handler(HTTPClient_t *pclient, int is_com
     return 0;
 }
 
+// frees the state once nothing else is using it
+static void release_state(WebSocketState *ws)
+{
+    if(ws->is_command) {
+        if(ws->stream != nullptr) {
+            // the feeder has exited and the command thread is done with the stream
+            vStreamBufferDelete(ws->stream);
+            ws->stream = nullptr;
+            delete ws->sos;
+            ws->sos = nullptr;
+        }
+        if(ws->os != nullptr) {
+            if(!ws->os->is_done()) {
+                printf("delete_websocket_handler: WARNING outputstream is not done yet: %p\n", ws);
+                // TODO we need to delay this
+            }
+            delete ws->os;
+            ws->os = nullptr;
+        }
+    }
+    if(ws->buffer != nullptr) {
+        free(ws->buffer);
+        ws->buffer = nullptr;
+    }
+    if(ws->write_mutex != nullptr) {
+        vSemaphoreDelete(ws->write_mutex);
+        ws->write_mutex = nullptr;
+    }
+    printf("delete_websocket_handler: %p\n", ws);
+    delete ws;
+}
+
 extern "C" BaseType_t delete_websocket_handler(HTTPClient_t *pclient)
 {
     if(pclient->websocketstate != nullptr) {
         WebSocketState* ws = (WebSocketState*)pclient->websocketstate;
-        if(ws->is_command) {
-            if(ws->os != nullptr) {
-                if(!ws->os->is_done()) {
-                    printf("delete_websocket_handler: WARNING outputstream is not done yet: %p\n", ws);
-                    // TODO we need to delay this
-                }
-                delete ws->os;
-                ws->os = nullptr;
-            }
+        pclient->websocketstate = nullptr;
+        if(ws->is_command && ws->os != nullptr) {
+            set_status_subscriber(ws->os, false);
         }
-        if(ws->buffer != nullptr) {
-            free(ws->buffer);
-            ws->buffer = nullptr;
+        if(ws->is_command && ws->stream != nullptr && !stop_stream(*ws)) {
+            // the feeder is still running, it releases the state when it exits
+            ws->os->set_closed();
+            printf("delete_websocket_handler: delaying release until the stream is done: %p\n", ws);
+            return 0;
         }
-        printf("delete_websocket_handler: %p\n", ws);
-        delete ws;
-        pclient->websocketstate = nullptr;
+        release_state(ws);
     }
     return 0;
 }
@@ -9,17 +9,20 @@
 #include <algorithm>
 #include <string.h>
 #include <set>
+#include <cmath>
 
 #include "FreeRTOS.h"
 #include "task.h"
 
 #include "stm32h7xx_hal.h"
 #include "Hal_pin.h"
+#include "isr-stats.h"
 #include "StringUtils.h"
 
 Adc *Adc::instances[Adc::num_channels];
 std::set<uint16_t> Adc::allocated_channels;
 bool Adc::running;
+void *Adc::filter_handle= nullptr;
 
 // make sure it is aligned on 32byte boundary for cache coherency, need to allocate potentially max size
 // num_samples (8/32) samples per num_channels (8) channels
@@ -214,6 +217,16 @@ bool Adc::deinit()
 
 bool Adc::start()
 {
+    if(filter_handle == nullptr) {
+        // the filtering is done in this task rather than the DMA ISR, the readings are only used 20 times a second by
+        // the temperature controls in the timer task so it runs at the same low priority, a new buffer arrives every few ms
+        // so a reading is never more than a few ms stale even when the command thread is busy
+        if(xTaskCreate(filter_task, "ADCFilter", 1000 / 4, NULL, (tskIDLE_PRIORITY + 1UL), (TaskHandle_t *)&filter_handle) != pdPASS) {
+            printf("ERROR: ADC1 failed to create filter task\n");
+            return false;
+        }
+    }
+
     running = true;
     if (HAL_ADC_Start_DMA(&AdcHandle, (uint32_t *)aADCxConvertedData, adc_data_size) != HAL_OK) {
         printf("ERROR: ADC1 Start DMA failed\n");
@@ -230,9 +243,6 @@ bool Adc::stop()
     return true;
 }
 
-//#define IIF_FILTER
-//#define MEDIAN
-#ifdef MEDIAN
 static void split(uint16_t data[], unsigned int n, uint16_t x, unsigned int& i, unsigned int& j)
 {
     do {
@@ -261,35 +271,14 @@ static unsigned int quick_median(uint16_t data[], unsigned int n)
     }
     return k;
 }
-#elif defined(IIF_FILTER)
-#define DSP_EMA_I32_ALPHA(x) ( (uint16_t)(x * 65535) )
-static int32_t dsp_ema_i32(uint16_t in, int32_t average, uint16_t alpha)
-{
-    if(alpha == 65535) return in;
-    int64_t tmp0;
-    tmp0 = (int64_t)in * (alpha + 1) + average * (65536 - alpha);
-    return (int32_t)((tmp0 + 32768) / 65536);
-}
-static uint32_t average(uint16_t *buf, int n)
-{
-    static int32_t average = 0;
-    uint16_t adc_value;
-    for (int i = 0; i < n; ++i) {
-        adc_value = buf[i];
-        average = dsp_ema_i32(adc_value, average, DSP_EMA_I32_ALPHA(0.1));
-    }
-    return average;
-}
-#else
-static uint32_t average(uint16_t *buf, int n)
+
+void Adc::set_filter(FILTER_T type, float alpha, uint16_t outl)
 {
-    float acc = 0.0F;
-    for (int i = 0; i < n; ++i) {
-        acc += buf[i];
-    }
-    return roundf(acc / n);
+    filter_type = type;
+    ema_alpha = alpha;
+    outlier = outl;
+    ema = -1;
 }
-#endif
 
 //#define ADC_TIMEIT
 #ifdef ADC_TIMEIT
@@ -302,50 +291,111 @@ uint32_t adc_get_time()
 #endif
 
 // This will take 154 us per sample with current settings
-// for 8 samples on a channel this is 1.2ms per channel
 // for 32 samples on a channel this is 4.8ms per channel
-// with 2 channels this gets called about every 1.2ms/4.8ms (or 2.4ms/9.6ms for complete read)
+// with 2 channels this gets called about every 4.8ms (or 9.6ms for complete read)
 // If half is true then only the first half has been captured
+// Only the copy is done here, the filtering is done in the filter task on the last num_samples samples
+// so a new filtered value is available every half buffer
 void Adc::sample_isr(bool half)
 {
     if(!running) return;
 
-    // I think this means we have 8/32 samples from each channel interleaved
+    // I think this means we have 32 samples from each channel interleaved
     int n = allocated_channels.size();
     int o = 0;
     int ns2 = num_samples / 2;
-    uint16_t dataADC[ns2];
     int off = half ? 0 : ns2;
     for(uint16_t c : allocated_channels) {
         Adc *adc = getInstance(c);
         if(adc == nullptr || !adc->valid) continue; // not setup
         // pick it out of the array, only half the array is ready
         for(int i = 0; i < ns2; ++i) {
-            dataADC[i] = aADCxConvertedData[((i + off) * n) + o];
+            adc->sample_buffer[i + off] = aADCxConvertedData[((i + off) * n) + o];
         }
-        memcpy(adc->sample_buffer + off, dataADC, sizeof(dataADC));
         ++o;
     }
 
-    if(!half) {
 #ifdef ADC_TIMEIT
-        // 2461us between calls
-        elt = benchmark_timer_elapsed(st);
-        st = benchmark_timer_start();
+    // 2461us between calls
+    elt = benchmark_timer_elapsed(st);
+    st = benchmark_timer_start();
 #endif
-        // calculate average/median for each buffer, avoids having to lock the buffer
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR((TaskHandle_t)filter_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+void Adc::filter_task(void *)
+{
+    for(;;) {
+        // wait for the ISR to tell us there are new samples
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if(!running) continue;
+
         for(uint16_t c : allocated_channels) {
             Adc *adc = getInstance(c);
             if(adc == nullptr || !adc->valid) continue; // not setup
-#ifdef MEDIAN
-            adc->last_sample = adc->sample_buffer[quick_median(adc->sample_buffer, num_samples)];
-#else
-            adc->last_sample = average(adc->sample_buffer, num_samples);
-#endif
+            adc->filter();
         }
     }
 }
 
+void Adc::filter()
+{
+    // take a copy so the ISR can keep filling the buffer
+    uint16_t buf[num_samples];
+    taskENTER_CRITICAL();
+    memcpy(buf, sample_buffer, sizeof(buf));
+    taskEXIT_CRITICAL();
+
+    // noise statistics on the raw samples
+    uint16_t mn = UINT16_MAX, mx = 0;
+    float sum = 0, sum2 = 0;
+    for (int i = 0; i < num_samples; ++i) {
+        uint16_t v = buf[i];
+        if(v < mn) mn = v;
+        if(v > mx) mx = v;
+        sum += v;
+        sum2 += (float)v * v;
+    }
+    float mean = sum / num_samples;
+    float var = (sum2 / num_samples) - (mean * mean);
+    noise_pp = mx - mn;
+    noise_sd = var > 0 ? sqrtf(var) : 0;
+
+    if(filter_type == AVERAGE && outlier == 0) {
+        last_sample = roundf(mean);
+        return;
+    }
+
+    uint16_t median = buf[quick_median(buf, num_samples)];
+    if(filter_type == MEDIAN) {
+        last_sample = median;
+        return;
+    }
+
+    // average ignoring any outliers, the median is always included
+    float acc = 0;
+    int cnt = 0;
+    for (int i = 0; i < num_samples; ++i) {
+        if(outlier == 0 || abs((int)buf[i] - median) <= outlier) {
+            acc += buf[i];
+            ++cnt;
+        }
+    }
+    float avg = acc / cnt;
+
+    if(filter_type == EMA) {
+        if(ema < 0) ema = avg;
+        else ema += ema_alpha * (avg - ema);
+        last_sample = roundf(ema);
+
+    } else {
+        last_sample = roundf(avg);
+    }
+}
+
 // gets called 20 times a second (every 50ms) from an ISR or timer
 uint32_t Adc::read()
 {
@@ -489,7 +539,9 @@ extern "C" void HAL_ADC_MspDeInit(ADC_HandleTypeDef *hadc)
 */
 extern "C" void DMA1_Stream1_IRQHandler(void)
 {
+    ISR_STATS_START();
     HAL_DMA_IRQHandler(AdcHandle.DMA_Handle);
+    ISR_STATS_END(ISR_STATS_ADC);
 }
 
 extern "C" void HAL_ADC3_ConvCpltCallback(ADC_HandleTypeDef *hadc);
@@ -29,9 +29,16 @@ public:
     bool is_valid() const { return valid; }
     std::string to_string() const;
 
+    enum FILTER_T {AVERAGE, MEDIAN, EMA};
+    // alpha is the EMA smoothing factor (0-1), samples further than outlier counts from the median are ignored (0 disables)
+    void set_filter(FILTER_T type, float alpha= 0.1F, uint16_t outlier= 0);
+    // peak to peak and standard deviation of the last num_samples raw samples in ADC counts
+    void get_noise(uint16_t& pp, float& sd) const { pp= noise_pp; sd= noise_sd; }
+
     static int get_max_value() { return 65535;} // 16bit samples
 
     static void sample_isr(bool);
+    static void filter_task(void *);
     static std::set<uint16_t> allocated_channels;
     static const int num_channels= 7;
     static const int num_samples= 32; // was 8 but we get better filtering with 32
@@ -39,13 +46,24 @@ public:
 private:
     static Adc* instances[num_channels];
     static bool running;
+    static void *filter_handle;
+
+    void filter();
 
     std::string name;
     bool valid{false};
     uint16_t channel;
     uint32_t not_ready_error{0};
-    // buffer storing the last num_samples readings for each channel instance
+    // buffer storing the last num_samples readings for each channel instance, each half is filled alternately by the ISR
     uint16_t sample_buffer[num_samples]{0};
-    uint32_t last_sample{0};
+    volatile uint32_t last_sample{0};
+
+    // filter settings and state
+    FILTER_T filter_type{AVERAGE};
+    float ema_alpha{0.1F};
+    float ema{-1};
+    uint16_t outlier{0};
+    uint16_t noise_pp{0};
+    float noise_sd{0};
 };
 
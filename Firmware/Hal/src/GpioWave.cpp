@@ -0,0 +1,177 @@
+#include "GpioWave.h"
+
+#include "stm32h7xx_hal.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+
+// rate each slot is output, the same rate the software sigma delta used to run at
+#define SLOT_FREQUENCY 2000
+
+bool GpioWave::running = false;
+char GpioWave::ports[GpioWave::max_ports] {0};
+
+// BSRR value for each slot of each port, cache line aligned so it can be cleaned for the DMA
+ALIGN_32BYTES(static uint32_t waveforms[GpioWave::max_ports][GpioWave::num_slots]);
+
+static TIM_HandleTypeDef WaveTimHandle;
+static DMA_HandleTypeDef WaveDmaHandles[GpioWave::max_ports];
+
+// each port is triggered by a different compare channel of TIM5, they all match at the start of each period
+static DMA_Stream_TypeDef * const streams[GpioWave::max_ports] = {DMA2_Stream0, DMA2_Stream1, DMA2_Stream2, DMA2_Stream3};
+static const uint32_t requests[GpioWave::max_ports] = {DMA_REQUEST_TIM5_CH1, DMA_REQUEST_TIM5_CH2, DMA_REQUEST_TIM5_CH3, DMA_REQUEST_TIM5_CH4};
+static const uint32_t channels[GpioWave::max_ports] = {TIM_CHANNEL_1, TIM_CHANNEL_2, TIM_CHANNEL_3, TIM_CHANNEL_4};
+static const uint32_t dma_sources[GpioWave::max_ports] = {TIM_DMA_CC1, TIM_DMA_CC2, TIM_DMA_CC3, TIM_DMA_CC4};
+
+static GPIO_TypeDef *get_gpio(char port)
+{
+    switch(port) {
+        case 'A': return GPIOA;
+        case 'B': return GPIOB;
+        case 'C': return GPIOC;
+        case 'D': return GPIOD;
+        case 'E': return GPIOE;
+        case 'F': return GPIOF;
+        case 'G': return GPIOG;
+        case 'H': return GPIOH;
+        case 'I': return GPIOI;
+        case 'J': return GPIOJ;
+        case 'K': return GPIOK;
+    }
+    return nullptr;
+}
+
+// static
+int GpioWave::find(char port)
+{
+    for (int i = 0; i < max_ports; ++i) {
+        if(ports[i] == port) return i;
+    }
+    return -1;
+}
+
+// static
+bool GpioWave::setup()
+{
+    __HAL_RCC_TIM5_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    /* Compute the prescaler value to have TIM5 counter clock equal to 1MHz */
+    uint32_t timerFreq = 1000000;
+    WaveTimHandle.Instance = TIM5;
+    WaveTimHandle.Init.Prescaler = (uint32_t)(SystemCoreClock / (2 * timerFreq)) - 1;
+    WaveTimHandle.Init.Period = (timerFreq / SLOT_FREQUENCY) - 1;
+    WaveTimHandle.Init.ClockDivision = 0;
+    WaveTimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
+    WaveTimHandle.Init.RepetitionCounter = 0;
+    if (HAL_TIM_OC_Init(&WaveTimHandle) != HAL_OK) {
+        printf("ERROR: GpioWave failed to init timer\n");
+        return false;
+    }
+
+    // the compare channels only generate the DMA requests, they are not connected to any pins
+    TIM_OC_InitTypeDef sConfig{0};
+    sConfig.OCMode     = TIM_OCMODE_TIMING;
+    sConfig.OCPolarity = TIM_OCPOLARITY_HIGH;
+    sConfig.OCFastMode = TIM_OCFAST_DISABLE;
+    sConfig.Pulse      = 0;
+    for (int i = 0; i < max_ports; ++i) {
+        if (HAL_TIM_OC_ConfigChannel(&WaveTimHandle, &sConfig, channels[i]) != HAL_OK) {
+            printf("ERROR: GpioWave failed to config channel %d\n", i + 1);
+            return false;
+        }
+    }
+
+    if (HAL_TIM_Base_Start(&WaveTimHandle) != HAL_OK) {
+        printf("ERROR: GpioWave failed to start timer\n");
+        return false;
+    }
+
+    printf("DEBUG: GpioWave started at %d Hz\n", SLOT_FREQUENCY);
+    running = true;
+    return true;
+}
+
+// static
+bool GpioWave::allocate(char port)
+{
+    if(find(port) >= 0) return true;
+
+    GPIO_TypeDef *gpio = get_gpio(port);
+    int i = find(0);
+    if(gpio == nullptr || i < 0) return false;
+
+    if(!running && !setup()) return false;
+
+    // the port is not touched until a pin is set
+    for (uint32_t n = 0; n < num_slots; ++n) {
+        waveforms[i][n] = 0;
+    }
+    SCB_CleanDCache_by_Addr(waveforms[i], sizeof(waveforms[i]));
+
+    DMA_HandleTypeDef& hdma = WaveDmaHandles[i];
+    hdma.Instance                 = streams[i];
+    hdma.Init.Request             = requests[i];
+    hdma.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    hdma.Init.PeriphInc           = DMA_PINC_DISABLE;
+    hdma.Init.MemInc              = DMA_MINC_ENABLE;
+    hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma.Init.MemDataAlignment    = DMA_MDATAALIGN_WORD;
+    hdma.Init.Mode                = DMA_CIRCULAR;
+    hdma.Init.Priority            = DMA_PRIORITY_LOW;
+    hdma.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma) != HAL_OK) {
+        printf("ERROR: GpioWave failed to init DMA for port %c\n", port);
+        return false;
+    }
+
+    if (HAL_DMA_Start(&hdma, (uint32_t)waveforms[i], (uint32_t)&gpio->BSRR, num_slots) != HAL_OK) {
+        printf("ERROR: GpioWave failed to start DMA for port %c\n", port);
+        return false;
+    }
+
+    __HAL_TIM_ENABLE_DMA(&WaveTimHandle, dma_sources[i]);
+    ports[i] = port;
+
+    return true;
+}
+
+// static
+void GpioWave::set(char port, uint16_t pin, uint32_t duty, bool inverting)
+{
+    int i = find(port);
+    if(i < 0) return;
+
+    if(duty > num_slots) duty = num_slots;
+
+    uint32_t on = 1 << pin;
+    uint32_t off = 1 << (pin + 16);
+    if(inverting) {
+        uint32_t t = on;
+        on = off;
+        off = t;
+    }
+    uint32_t mask = ~(on | off);
+
+    uint32_t *w = waveforms[i];
+
+    // other pins on the same port may be set from a different context
+    UBaseType_t s = taskENTER_CRITICAL_FROM_ISR();
+
+    // spread the on slots evenly over the waveform, the same pattern as sigma delta modulation
+    uint32_t acc = 0;
+    for (uint32_t n = 0; n < num_slots; ++n) {
+        acc += duty;
+        if(acc >= num_slots) {
+            acc -= num_slots;
+            w[n] = (w[n] & mask) | on;
+        } else {
+            w[n] = (w[n] & mask) | off;
+        }
+    }
+    SCB_CleanDCache_by_Addr(w, sizeof(waveforms[i]));
+
+    taskEXIT_CRITICAL_FROM_ISR(s);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Modulates GPIO outputs from a waveform held in memory without any interrupts.
+// TIM5 triggers a DMA transfer of the next slot of each port's waveform to that port's BSRR register,
+// so the CPU only touches the waveform when a duty cycle changes.
+// There is one DMA stream and one waveform per GPIO port, the pins on a port share the waveform.
+class GpioWave
+{
+public:
+    static const uint32_t num_slots = 256;
+    static const int max_ports = 4;
+
+    // get a waveform for the port 'A' - 'K', returns false if all are in use
+    static bool allocate(char port);
+    // set the duty cycle of the pin (0 - 15) where num_slots is always on, the on slots are spread evenly
+    // NOTE can be called from an ISR
+    static void set(char port, uint16_t pin, uint32_t duty, bool inverting);
+
+private:
+    static bool setup();
+    static int find(char port);
+
+    static bool running;
+    static char ports[max_ports];
+};
@@ -23,6 +23,7 @@ public:
 
 	static bool post_config_setup();
 	static bool setup(int timr, uint32_t frequency);
+	static bool is_setup(int timr) { return instances[timr]._htim != nullptr; }
 	static Pwm *get_allocation(int i, int j) { return allocated[i][j]; }
 	using instance_t = struct { void *_htim; uint32_t period; uint32_t frequency; };
 
@@ -1,10 +1,12 @@
-// Handle a H/W Timer Quadrature Encoder (Mainly for Lathe spindle sync)
+// Handle the H/W Timer Quadrature Encoders (Lathe spindle sync and closed loop steppers)
 
 #include "stm32h7xx.h"
 
 #include <stdio.h>
 
 #include "Hal_pin.h"
+#include "QuadEncoder.h"
+#include "Pwm.h"
 
 // Definition for QE_TIM resources
 #define QE_TIM                TIM8
@@ -21,6 +23,21 @@
 #define QE_CH2_GPIO_AF        GPIO_AF3_TIM8
 #define QE_CH2_CLK_ENABLE     __HAL_RCC_GPIOJ_CLK_ENABLE
 
+// Definition for QE1_TIM resources, these are the PWM1 channel 1 and 2 pins
+#define QE1_TIM               TIM1
+#define QE1_TIM_CLK_ENABLE    __HAL_RCC_TIM1_CLK_ENABLE
+#define QE1_TIM_CLK_DISABLE   __HAL_RCC_TIM1_CLK_DISABLE
+
+#define QE1_CH1_GPIO_PIN      GPIO_PIN_9
+#define QE1_CH1_GPIO_PORT     GPIOE
+#define QE1_CH1_GPIO_AF       GPIO_AF1_TIM1
+#define QE1_CH1_CLK_ENABLE    __HAL_RCC_GPIOE_CLK_ENABLE
+
+#define QE1_CH2_GPIO_PIN      GPIO_PIN_11
+#define QE1_CH2_GPIO_PORT     GPIOE
+#define QE1_CH2_GPIO_AF       GPIO_AF1_TIM1
+#define QE1_CH2_CLK_ENABLE    __HAL_RCC_GPIOE_CLK_ENABLE
+
 /**
 * @brief TIM_Encoder MSP Initialization
 * This function configures the hardware resources used in this example
@@ -50,6 +67,24 @@ void HAL_TIM_Encoder_MspInit(TIM_HandleTypeDef* htim_encoder)
 
         allocate_hal_pin(QE_CH1_GPIO_PORT, QE_CH1_GPIO_PIN);
         allocate_hal_pin(QE_CH2_GPIO_PORT, QE_CH2_GPIO_PIN);
+
+    } else if(htim_encoder->Instance == QE1_TIM) {
+        QE1_TIM_CLK_ENABLE();
+        QE1_CH1_CLK_ENABLE();
+        QE1_CH2_CLK_ENABLE();
+
+        /** QE1_TIM GPIO Configuration
+            PE9 and PE11 for TIM1
+        */
+        GPIO_InitStruct.Pin = QE1_CH1_GPIO_PIN | QE1_CH2_GPIO_PIN;
+        GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+        GPIO_InitStruct.Alternate = QE1_CH1_GPIO_AF;
+        GPIO_InitStruct.Pull = GPIO_PULLUP;
+        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+        HAL_GPIO_Init(QE1_CH1_GPIO_PORT, &GPIO_InitStruct);
+
+        allocate_hal_pin(QE1_CH1_GPIO_PORT, QE1_CH1_GPIO_PIN);
+        allocate_hal_pin(QE1_CH2_GPIO_PORT, QE1_CH2_GPIO_PIN);
     }
 
 }
@@ -67,23 +102,29 @@ void HAL_TIM_Encoder_MspDeInit(TIM_HandleTypeDef* htim_encoder)
         /* Peripheral clock disable */
         QE_TIM_CLK_DISABLE();
         HAL_GPIO_DeInit(QE_CH1_GPIO_PORT, QE_CH1_GPIO_PIN | QE_CH2_GPIO_PIN);
+
+    } else if(htim_encoder->Instance == QE1_TIM) {
+        QE1_TIM_CLK_DISABLE();
+        HAL_GPIO_DeInit(QE1_CH1_GPIO_PORT, QE1_CH1_GPIO_PIN | QE1_CH2_GPIO_PIN);
     }
 
 }
 
-static TIM_HandleTypeDef htimqe;
+static TIM_HandleTypeDef htimqe[NUM_QUADRATURE_ENCODERS];
+static TIM_TypeDef * const qe_tims[NUM_QUADRATURE_ENCODERS] = {QE_TIM, QE1_TIM};
 
-static bool MX_QE_TIM_Init(void)
+static bool MX_QE_TIM_Init(TIM_HandleTypeDef& htim, TIM_TypeDef *tim)
 {
     TIM_Encoder_InitTypeDef sConfig = {0};
     TIM_MasterConfigTypeDef sMasterConfig = {0};
 
-    htimqe.Instance = QE_TIM;
-    htimqe.Init.Prescaler = 0;
-    htimqe.Init.CounterMode = TIM_COUNTERMODE_UP;
-    htimqe.Init.Period = 65535;
-    htimqe.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-    htimqe.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+    htim.Instance = tim;
+    htim.Init.Prescaler = 0;
+    htim.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim.Init.Period = 65535;
+    htim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim.Init.RepetitionCounter = 0;
+    htim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
     sConfig.EncoderMode = TIM_ENCODERMODE_TI1; // *2 mode // *4 mode TIM_ENCODERMODE_TI12;
     sConfig.IC1Polarity = TIM_ICPOLARITY_RISING;
     sConfig.IC1Selection = TIM_ICSELECTION_DIRECTTI;
@@ -94,27 +135,43 @@ static bool MX_QE_TIM_Init(void)
     sConfig.IC2Prescaler = TIM_ICPSC_DIV1;
     sConfig.IC2Filter = 10;
 
-    if (HAL_TIM_Encoder_Init(&htimqe, &sConfig) != HAL_OK) {
+    if (HAL_TIM_Encoder_Init(&htim, &sConfig) != HAL_OK) {
         return false;
     }
 
     sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
     sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-    if (HAL_TIMEx_MasterConfigSynchronization(&htimqe, &sMasterConfig) != HAL_OK) {
+    if (HAL_TIMEx_MasterConfigSynchronization(&htim, &sMasterConfig) != HAL_OK) {
         return false;
     }
 
     return true;
 }
 
-bool setup_quadrature_encoder()
+bool setup_quadrature_encoder(int qe)
 {
-    if(!MX_QE_TIM_Init()) {
+    if(qe < 0 || qe >= NUM_QUADRATURE_ENCODERS) {
+        printf("ERROR: QuadEncoder - there is no encoder %d\n", qe);
+        return false;
+    }
+
+    if(htimqe[qe].Instance != nullptr) {
+        printf("ERROR: QuadEncoder - encoder %d is already in use\n", qe);
+        return false;
+    }
+
+    // the timer is shared with a PWM
+    if(Pwm::is_setup(qe == 0 ? 1 : 0)) {
+        printf("ERROR: QuadEncoder - encoder %d can not be used as PWM%d is in use\n", qe, qe == 0 ? 2 : 1);
+        return false;
+    }
+
+    if(!MX_QE_TIM_Init(htimqe[qe], qe_tims[qe])) {
         printf("ERROR: QuadEncoder - unable to setup quadrature timer\n");
         return false;
     }
 
-    if(HAL_TIM_Encoder_Start(&htimqe, TIM_CHANNEL_ALL) != HAL_OK) {
+    if(HAL_TIM_Encoder_Start(&htimqe[qe], TIM_CHANNEL_ALL) != HAL_OK) {
         printf("ERROR: QuadEncoder - unable to start quadrature timer\n");
         return false;
     }
@@ -132,8 +189,8 @@ uint32_t get_quadrature_encoder_div()
     return 2;
 }
 
-uint32_t read_quadrature_encoder()
+uint32_t read_quadrature_encoder(int qe)
 {
     // it is a 16bit counter
-    return QE_TIM->CNT&0x0000FFFF;
+    return qe_tims[qe]->CNT&0x0000FFFF;
 }
@@ -1,6 +1,10 @@
 #pragma once
 
-bool setup_quadrature_encoder();
-uint32_t read_quadrature_encoder();
+// there are two H/W timer quadrature encoders
+// 0 is TIM8 on PJ8 and PJ10 (shared with PWM2), 1 is TIM1 on PE9 and PE11 (shared with PWM1)
+#define NUM_QUADRATURE_ENCODERS 2
+
+bool setup_quadrature_encoder(int qe= 0);
+uint32_t read_quadrature_encoder(int qe= 0);
 uint32_t get_quadrature_encoder_max_count();
 uint32_t get_quadrature_encoder_div();
@@ -1,5 +1,6 @@
 #include "Spi.h"
 #include "Hal_pin.h"
+#include "Pin.h"
 
 #include "stm32h7xx_hal.h"
 #ifdef USE_FULL_LL_DRIVER
@@ -25,6 +26,14 @@
 #define SPI1x_RELEASE_RESET()             __HAL_RCC_SPI1_RELEASE_RESET()
 #define SPI1x_IRQn                        SPI1_IRQn
 #define SPI1x_IRQHandler                  SPI1_IRQHandler
+#define SPI1x_TX_DMA_STREAM               DMA2_Stream4
+#define SPI1x_RX_DMA_STREAM               DMA2_Stream5
+#define SPI1x_TX_DMA_REQUEST              DMA_REQUEST_SPI1_TX
+#define SPI1x_RX_DMA_REQUEST              DMA_REQUEST_SPI1_RX
+#define SPI1x_DMA_TX_IRQn                 DMA2_Stream4_IRQn
+#define SPI1x_DMA_RX_IRQn                 DMA2_Stream5_IRQn
+#define SPI1x_DMA_TX_IRQHandler           DMA2_Stream4_IRQHandler
+#define SPI1x_DMA_RX_IRQHandler           DMA2_Stream5_IRQHandler
 
 /* Definition SPI1 Pins */
 #define SPI1x_SCK_PIN                     GPIO_PIN_5
@@ -47,6 +56,8 @@
 #define SPI2x_MOSI_GPIO_CLK_ENABLE()      __HAL_RCC_GPIOB_CLK_ENABLE()
 #define SPI2x_IRQn                        SPI2_IRQn
 #define SPI2x_IRQHandler                  SPI2_IRQHandler
+#define SPI2x_TX_DMA_REQUEST              DMA_REQUEST_SPI2_TX
+#define SPI2x_RX_DMA_REQUEST              DMA_REQUEST_SPI2_RX
 
 #define SPI2x_FORCE_RESET()               __HAL_RCC_SPI2_FORCE_RESET()
 #define SPI2x_RELEASE_RESET()             __HAL_RCC_SPI2_RELEASE_RESET()
@@ -74,6 +85,8 @@
 #define SPI2x_MOSI_GPIO_CLK_ENABLE()      __HAL_RCC_GPIOE_CLK_ENABLE()
 #define SPI2x_IRQn                        SPI4_IRQn
 #define SPI2x_IRQHandler                  SPI4_IRQHandler
+#define SPI2x_TX_DMA_REQUEST              DMA_REQUEST_SPI4_TX
+#define SPI2x_RX_DMA_REQUEST              DMA_REQUEST_SPI4_RX
 
 #define SPI2x_FORCE_RESET()               __HAL_RCC_SPI4_FORCE_RESET()
 #define SPI2x_RELEASE_RESET()             __HAL_RCC_SPI4_RELEASE_RESET()
@@ -90,6 +103,21 @@
 #define SPI2x_MOSI_AF                     GPIO_AF5_SPI4
 #endif
 
+// DMA2 streams 0-3 are used by GpioWave
+#define SPI2x_TX_DMA_STREAM               DMA2_Stream6
+#define SPI2x_RX_DMA_STREAM               DMA2_Stream7
+#define SPI2x_DMA_TX_IRQn                 DMA2_Stream6_IRQn
+#define SPI2x_DMA_RX_IRQn                 DMA2_Stream7_IRQn
+#define SPI2x_DMA_TX_IRQHandler           DMA2_Stream6_IRQHandler
+#define SPI2x_DMA_RX_IRQHandler           DMA2_Stream7_IRQHandler
+
+static DMA_HandleTypeDef hdma_tx[2];
+static DMA_HandleTypeDef hdma_rx[2];
+
+// the DMA can not get to DTCM so these need to be in SRAM_1, and cache aligned
+static uint8_t dma_tx_buf[2][32] __attribute__((section (".sram_1_bss"), aligned(32)));
+static uint8_t dma_rx_buf[2][32] __attribute__((section (".sram_1_bss"), aligned(32)));
+
 SPI *SPI::spi_channel[2];
 // static
 SPI *SPI::getInstance(int channel)
@@ -242,6 +270,11 @@ bool SPI::init(int bits, int mode, int frequency)
     _hspi = malloc(sizeof(SPI_HandleTypeDef));
     memcpy(_hspi, &SpiHandle, sizeof(SPI_HandleTypeDef));
 
+    // the DMA has to be linked to the handle we keep
+    if(!init_dma()) {
+        printf("WARNING: SPI channel %d, DMA not available, queued transfers disabled\n", _channel);
+    }
+
    _valid = true;
 
     return true;
@@ -256,17 +289,144 @@ SPI::~SPI()
     }
 }
 
+bool SPI::init_dma()
+{
+    SPI_HandleTypeDef *hspi = (SPI_HandleTypeDef*)_hspi;
+    if(_bits > 8) return false;
+
+    DMA1_CLK_ENABLE();
+
+    DMA_HandleTypeDef& tx = hdma_tx[_channel];
+    tx.Instance                 = _channel == 0 ? SPI1x_TX_DMA_STREAM : SPI2x_TX_DMA_STREAM;
+    tx.Init.Request             = _channel == 0 ? SPI1x_TX_DMA_REQUEST : SPI2x_TX_DMA_REQUEST;
+    tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+    tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    tx.Init.MemInc              = DMA_MINC_ENABLE;
+    tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    tx.Init.Mode                = DMA_NORMAL;
+    tx.Init.Priority            = DMA_PRIORITY_LOW;
+    tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    if(HAL_DMA_Init(&tx) != HAL_OK) return false;
+    __HAL_LINKDMA(hspi, hdmatx, tx);
+
+    DMA_HandleTypeDef& rx = hdma_rx[_channel];
+    rx.Instance                 = _channel == 0 ? SPI1x_RX_DMA_STREAM : SPI2x_RX_DMA_STREAM;
+    rx.Init.Request             = _channel == 0 ? SPI1x_RX_DMA_REQUEST : SPI2x_RX_DMA_REQUEST;
+    rx.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+    rx.Init.PeriphInc           = DMA_PINC_DISABLE;
+    rx.Init.MemInc              = DMA_MINC_ENABLE;
+    rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    rx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+    rx.Init.Mode                = DMA_NORMAL;
+    rx.Init.Priority            = DMA_PRIORITY_LOW;
+    rx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+    if(HAL_DMA_Init(&rx) != HAL_OK) return false;
+    __HAL_LINKDMA(hspi, hdmarx, rx);
+
+    // the HAL finishes the transfer in the SPI interrupt
+    IRQn_Type irqs[] = {
+        _channel == 0 ? SPI1x_DMA_TX_IRQn : SPI2x_DMA_TX_IRQn,
+        _channel == 0 ? SPI1x_DMA_RX_IRQn : SPI2x_DMA_RX_IRQn,
+        _channel == 0 ? SPI1x_IRQn : SPI2x_IRQn
+    };
+    for(auto i : irqs) {
+        NVIC_SetPriority(i, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY+1);
+        NVIC_EnableIRQ(i);
+    }
+
+    return true;
+}
+
+// blocking transfers wait for any queued transfers to finish and hold off new ones until end_transaction
 bool SPI::begin_transaction(uint32_t tmoms)
 {
     uint32_t t= pdMS_TO_TICKS(tmoms);
-    return xSemaphoreTake(mutex, t) == pdTRUE;
+    if(xSemaphoreTake(mutex, t) != pdTRUE) return false;
+
+    held= true;
+    while(busy) {
+        vTaskDelay(1);
+    }
+    return true;
 }
 
 void SPI::end_transaction()
 {
+    taskENTER_CRITICAL();
+    held= false;
+    if(!busy) start_next();
+    taskEXIT_CRITICAL();
     xSemaphoreGive(mutex);
 }
 
+bool SPI::queue_transfer(Pin *cs, const uint8_t *tx, uint32_t n, done_fnc_t fnc, void *arg)
+{
+    if(n > max_queued_bytes || hdma_rx[_channel].Parent == nullptr) return false;
+
+    taskENTER_CRITICAL();
+    uint8_t next= (q_head + 1) % queue_size;
+    if(next == q_tail) {
+        // full
+        taskEXIT_CRITICAL();
+        return false;
+    }
+
+    transfer_t& t= queue[q_head];
+    t.cs= cs;
+    t.fnc= fnc;
+    t.arg= arg;
+    t.n= n;
+    memcpy(t.tx, tx, n);
+    q_head= next;
+
+    if(!busy && !held) start_next();
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+// start the next queued transfer if there is one, called from the ISR or in a critical section
+void SPI::start_next()
+{
+    while(q_tail != q_head) {
+        transfer_t& t= queue[q_tail];
+        memcpy(dma_tx_buf[_channel], t.tx, t.n);
+        // make sure cache is flushed to RAM so the DMA can read the correct data
+        SCB_CleanDCache_by_Addr((uint32_t*)dma_tx_buf[_channel], sizeof(dma_tx_buf[0]));
+
+        busy= true;
+        t.cs->set(false);
+        if(HAL_SPI_TransmitReceive_DMA((SPI_HandleTypeDef*)_hspi, dma_tx_buf[_channel], dma_rx_buf[_channel], t.n) == HAL_OK) {
+            return;
+        }
+
+        // failed so skip it
+        t.cs->set(true);
+        if(t.fnc != nullptr) t.fnc(t.arg, nullptr);
+        q_tail= (q_tail + 1) % queue_size;
+    }
+
+    busy= false;
+}
+
+// ISR
+void SPI::transfer_complete(bool ok)
+{
+    if(!busy) return;
+
+    transfer_t& t= queue[q_tail];
+    t.cs->set(true);
+    if(t.fnc != nullptr) {
+        SCB_InvalidateDCache_by_Addr((uint32_t*)dma_rx_buf[_channel], sizeof(dma_rx_buf[0]));
+        t.fnc(t.arg, ok ? dma_rx_buf[_channel] : nullptr);
+    }
+    q_tail= (q_tail + 1) % queue_size;
+
+    // queued transfers are always run even if a blocking transaction is waiting, it waits for them to finish
+    start_next();
+}
+
 // writes and reads number of _bits sized words
 bool SPI::write_read(void *wvalue, void *rvalue, uint32_t n)
 {
@@ -446,7 +606,12 @@ extern "C" void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi)
   */
 extern "C" void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
 {
-    // wTransferState = TRANSFER_COMPLETE;
+    // only queued transfers use DMA
+    if(hspi->Instance == SPI1x) {
+        SPI::spi_channel[0]->transfer_complete(true);
+    } else if(hspi->Instance == SPI2x) {
+        SPI::spi_channel[1]->transfer_complete(true);
+    }
 }
 
 /**
@@ -458,7 +623,11 @@ extern "C" void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
   */
 extern "C" void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
 {
-    // wTransferState = TRANSFER_ERROR;
+    if(hspi->Instance == SPI1x) {
+        SPI::spi_channel[0]->transfer_complete(false);
+    } else if(hspi->Instance == SPI2x) {
+        SPI::spi_channel[1]->transfer_complete(false);
+    }
 }
 
 /**
@@ -475,3 +644,23 @@ extern "C" void SPI2x_IRQHandler(void)
 {
     HAL_SPI_IRQHandler((SPI_HandleTypeDef*)SPI::spi_channel[1]->get_hspi());
 }
+
+extern "C" void SPI1x_DMA_TX_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_tx[0]);
+}
+
+extern "C" void SPI1x_DMA_RX_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_rx[0]);
+}
+
+extern "C" void SPI2x_DMA_TX_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_tx[1]);
+}
+
+extern "C" void SPI2x_DMA_RX_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_rx[1]);
+}
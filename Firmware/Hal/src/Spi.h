@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
 
+class Pin;
+
 class SPI
 {
 
@@ -27,6 +29,17 @@ public:
 	bool write_read(void *wvalue, void *rvalue, uint32_t n);
     bool write_byte(uint8_t b);
 
+    // called from the DMA ISR when a queued transfer is done, rx has the bytes read or is nullptr if it failed
+    using done_fnc_t = void (*)(void *arg, const uint8_t *rx);
+    static const uint32_t max_queued_bytes = 8;
+    // queue a transfer of up to max_queued_bytes to be done by DMA in the background, cs is low for the transfer.
+    // transfers run in the order queued, the next one is started from the ISR so a batch runs without any task involvement.
+    // returns false if the queue is full
+    bool queue_transfer(Pin *cs, const uint8_t *tx, uint32_t n, done_fnc_t fnc, void *arg);
+    bool is_idle() const { return !busy; }
+    // ISR
+    void transfer_complete(bool ok);
+
 	bool valid() const { return _valid; }
 	void *get_hspi() const { return _hspi; }
     uint8_t get_mode() const { return _mode; }
@@ -40,6 +53,22 @@ public:
 private:
 	SPI(int channel);
 	virtual ~SPI();
+    bool init_dma();
+    void start_next();
+
+    struct transfer_t {
+        Pin *cs;
+        done_fnc_t fnc;
+        void *arg;
+        uint8_t tx[max_queued_bytes];
+        uint8_t n;
+    };
+    static const int queue_size = 16;
+    transfer_t queue[queue_size];
+    volatile uint8_t q_head{0};
+    volatile uint8_t q_tail{0};
+    volatile bool busy{false}; // a queued transfer is running
+    volatile bool held{false}; // a blocking transaction has the bus
 	void *_hspi;
     void *mutex;
 	bool _valid;
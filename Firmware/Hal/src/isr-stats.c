@@ -0,0 +1,20 @@
+#include "isr-stats.h"
+
+#define _fast_data_ __attribute__ ((section(".dtcm_text")))
+
+_fast_data_ isr_stats_t isr_stats[ISR_STATS_NUM] = {
+    {"step", 0, 0, 0},
+    {"unstep", 0, 0, 0},
+    {"fasttick", 0, 0, 0},
+    {"adc", 0, 0, 0},
+};
+
+void isr_stats_reset()
+{
+    for (int i = 0; i < ISR_STATS_NUM; ++i) {
+        // the ISRs may update these while we reset them, which only affects the first sample
+        isr_stats[i].count = 0;
+        isr_stats[i].cycles = 0;
+        isr_stats[i].max = 0;
+    }
+}
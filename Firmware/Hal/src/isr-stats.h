@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32h7xx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// time spent in the main ISRs measured with the DWT cycle counter, reported by the top command
+typedef struct {
+    const char *name;
+    volatile uint32_t count;  // number of times the ISR ran
+    volatile uint32_t cycles; // total cycles spent in the ISR
+    volatile uint32_t max;    // longest time in the ISR in cycles
+} isr_stats_t;
+
+enum { ISR_STATS_STEP, ISR_STATS_UNSTEP, ISR_STATS_FASTTICK, ISR_STATS_ADC, ISR_STATS_NUM };
+extern isr_stats_t isr_stats[ISR_STATS_NUM];
+
+// reset the counts at the start of a sample window
+void isr_stats_reset();
+
+// put ISR_STATS_START() at the start of an ISR and ISR_STATS_END(n) at the end
+#define ISR_STATS_START() uint32_t _isr_stats_start = DWT->CYCCNT
+#define ISR_STATS_END(n) isr_stats_update(n, DWT->CYCCNT - _isr_stats_start)
+
+// the step and unstep ISRs are the hottest path so they are only timed when built with isrstats=1
+#ifdef STEP_ISR_STATS
+#define STEP_ISR_STATS_START() ISR_STATS_START()
+#define STEP_ISR_STATS_END(n) ISR_STATS_END(n)
+#else
+#define STEP_ISR_STATS_START()
+#define STEP_ISR_STATS_END(n)
+#endif
+
+static inline void isr_stats_update(int n, uint32_t cycles)
+{
+    isr_stats_t *s = &isr_stats[n];
+    s->count++;
+    s->cycles += cycles;
+    if(cycles > s->max) s->max = cycles;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,7 @@
 #include "FreeRTOS.h"
 
 #include "stm32h7xx.h"
+#include "isr-stats.h"
 
 // TODO move ramfunc define to a utils.h
 #define _ramfunc_ __attribute__ ((section(".ramfunctions"),long_call,noinline))
@@ -135,6 +136,7 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef * htim)
 
 _ramfunc_ void STEP_TIM_IRQHandler(void)
 {
+    STEP_ISR_STATS_START();
     //HAL_TIM_IRQHandler(&StepTimHandle);
     /* TIM Update event */
     register TIM_HandleTypeDef *htim = &StepTimHandle;
@@ -145,10 +147,12 @@ _ramfunc_ void STEP_TIM_IRQHandler(void)
             tick_handler();
         }
     }
+    STEP_ISR_STATS_END(ISR_STATS_STEP);
 }
 
 _ramfunc_ void UNSTEP_TIM_IRQHandler(void)
 {
+    STEP_ISR_STATS_START();
     // HAL_TIM_IRQHandler(&UnStepTimHandle);
     register TIM_HandleTypeDef *htim = &UnStepTimHandle;
 
@@ -173,6 +177,7 @@ _ramfunc_ void UNSTEP_TIM_IRQHandler(void)
 
         }
     }
+    STEP_ISR_STATS_END(ISR_STATS_UNSTEP);
 }
 
 // called from within STEP_TIM ISR so must be in SRAM
@@ -199,7 +204,9 @@ _ramfunc_ void unsteptimer_start()
 
 _ramfunc_ void FASTTICK_TIM_IRQHandler(void)
 {
+    ISR_STATS_START();
     HAL_TIM_IRQHandler(&FastTickTimHandle);
+    ISR_STATS_END(ISR_STATS_FASTTICK);
 }
 
 static uint32_t fasttick_timerFreq;
@@ -71,7 +71,7 @@
 #define configUSE_MALLOC_FAILED_HOOK	1
 #define configUSE_APPLICATION_TASK_TAG	0
 #define configUSE_COUNTING_SEMAPHORES	1
-#define configGENERATE_RUN_TIME_STATS	0
+#define configGENERATE_RUN_TIME_STATS	1
 #define configUSE_NEWLIB_REENTRANT      1
 #define configSTACK_DEPTH_TYPE 			uint32_t
 #define configNUM_THREAD_LOCAL_STORAGE_POINTERS 32
@@ -128,6 +128,11 @@ to all Cortex-M ports, and do not rely on any particular library functions. */
 See http://www.FreeRTOS.org/RTOS-Cortex-M3-M4.html. */
 #define configMAX_SYSCALL_INTERRUPT_PRIORITY 	( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY << (8 - configPRIO_BITS) )
 
+/* Run time stats are counted in cpu cycles with the DWT cycle counter, used by the top command.
+NOTE the counter wraps every 2^32 cycles (about 8.9 seconds at 480MHz) so only differences over a shorter time are valid */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() do { CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; } while(0)
+#define portGET_RUN_TIME_COUNTER_VALUE() (DWT->CYCCNT)
+
 /* Normal assert() semantics without relying on the provision of an assert.h
 header file. */
 #ifdef DEBUG
@@ -0,0 +1,122 @@
+#include "../Unity/src/unity.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmath>
+
+#include "TestRegistry.h"
+
+#include "Bezier.h"
+
+// splits the curve the same way as Robot::append_bezier, returns the number of chords
+// and the biggest deviation of the middle of a chord from the curve
+static int tessellate(const float cp[4][2], float max_error, float& max_dev, float end[2])
+{
+    Bezier bezier(cp);
+    float start[2] {cp[0][0], cp[0][1]};
+    float t = 0;
+    int n = 0;
+    max_dev = 0;
+
+    while(t < 1.0F && n < 100000) {
+        float e[2], radius;
+        float t1 = bezier.next_chord(t, start, max_error, e, radius);
+        TEST_ASSERT_TRUE(t1 > t);
+        TEST_ASSERT_TRUE(radius > 0);
+
+        float mid[2];
+        bezier.point((t + t1) / 2, mid);
+        float cx = e[0] - start[0], cy = e[1] - start[1];
+        float clen = hypotf(cx, cy);
+        if(clen > 0.0001F) {
+            float dev = fabsf(cx * (mid[1] - start[1]) - cy * (mid[0] - start[0])) / clen;
+            if(dev > max_dev) max_dev = dev;
+        }
+
+        start[0] = e[0];
+        start[1] = e[1];
+        t = t1;
+        ++n;
+    }
+
+    end[0] = start[0];
+    end[1] = start[1];
+    return n;
+}
+
+REGISTER_TEST(BezierTest, s_curve)
+{
+    const float cp[4][2] {{0, 0}, {10, 0}, {0, 10}, {10, 10}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.01F, dev, end);
+    printf("s curve: %d chords, max deviation %f\n", n, dev);
+
+    // exactly at the end point
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, end[1]);
+    TEST_ASSERT_TRUE(dev <= 0.01F);
+    TEST_ASSERT_TRUE(n > 4 && n < 100);
+}
+
+REGISTER_TEST(BezierTest, straight)
+{
+    // a straight line is split into the longest chords
+    const float cp[4][2] {{0, 0}, {3, 0}, {7, 0}, {10, 0}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.01F, dev, end);
+
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(0.0F, end[1]);
+    TEST_ASSERT_EQUAL_INT(4, n);
+}
+
+REGISTER_TEST(BezierTest, loop)
+{
+    // starts and ends at the same point
+    const float cp[4][2] {{0, 0}, {10, 10}, {0, 10}, {0, 0}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.01F, dev, end);
+    printf("loop: %d chords, max deviation %f\n", n, dev);
+
+    TEST_ASSERT_EQUAL_FLOAT(0.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(0.0F, end[1]);
+    TEST_ASSERT_TRUE(dev <= 0.01F);
+    TEST_ASSERT_TRUE(n < 100);
+}
+
+REGISTER_TEST(BezierTest, control_point_on_end)
+{
+    // the tangent is zero at the start, it must not fall back to the smallest chord
+    const float cp[4][2] {{0, 0}, {0, 0}, {10, 0}, {10, 10}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.01F, dev, end);
+    printf("control point on end: %d chords, max deviation %f\n", n, dev);
+
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(10.0F, end[1]);
+    TEST_ASSERT_TRUE(dev <= 0.01F);
+    TEST_ASSERT_TRUE(n < 100);
+}
+
+REGISTER_TEST(BezierTest, zero_length)
+{
+    const float cp[4][2] {{5, 5}, {5, 5}, {5, 5}, {5, 5}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.01F, dev, end);
+
+    TEST_ASSERT_EQUAL_FLOAT(5.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(5.0F, end[1]);
+    TEST_ASSERT_TRUE(n <= 4);
+}
+
+REGISTER_TEST(BezierTest, bounded)
+{
+    // a big curve with a tiny error can not have more chords than the smallest step allows
+    const float cp[4][2] {{0, 0}, {1000, 0}, {-1000, 1000}, {0, 1000}};
+    float dev, end[2];
+    int n = tessellate(cp, 0.0001F, dev, end);
+    printf("big curve: %d chords, max deviation %f\n", n, dev);
+
+    TEST_ASSERT_EQUAL_FLOAT(0.0F, end[0]);
+    TEST_ASSERT_EQUAL_FLOAT(1000.0F, end[1]);
+    TEST_ASSERT_TRUE(n <= (int)(1.0F / Bezier::min_dt) + 1);
+}
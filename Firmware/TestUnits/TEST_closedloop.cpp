@@ -0,0 +1,59 @@
+#include "../Unity/src/unity.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "TestRegistry.h"
+
+#include "ClosedLoop.h"
+
+REGISTER_TEST(ClosedLoopTest, accumulate_counts)
+{
+    uint32_t last = 100;
+    int32_t pos = ClosedLoop::accumulate_counts(0, last, 150);
+    TEST_ASSERT_EQUAL_INT(50, pos);
+    TEST_ASSERT_EQUAL_INT(150, last);
+
+    pos = ClosedLoop::accumulate_counts(pos, last, 120);
+    TEST_ASSERT_EQUAL_INT(20, pos);
+
+    // the 16 bit counter wrapping forwards and backwards
+    last = 65530;
+    pos = ClosedLoop::accumulate_counts(0, last, 10);
+    TEST_ASSERT_EQUAL_INT(16, pos);
+    pos = ClosedLoop::accumulate_counts(pos, last, 65526);
+    TEST_ASSERT_EQUAL_INT(-4, pos);
+}
+
+REGISTER_TEST(ClosedLoopTest, following_error)
+{
+    // 80 steps/mm with a 100 line/mm encoder read at x4 is 0.2 steps per count
+    TEST_ASSERT_EQUAL_INT(0, ClosedLoop::following_error(800, 4000, 0.2F));
+    // stalled after 800 steps, it only got to 790
+    TEST_ASSERT_EQUAL_INT(10, ClosedLoop::following_error(800, 3950, 0.2F));
+    // overshot
+    TEST_ASSERT_EQUAL_INT(-2, ClosedLoop::following_error(-800, -3990, 0.2F));
+    // an encoder counting the other way has negative steps per count
+    TEST_ASSERT_EQUAL_INT(0, ClosedLoop::following_error(800, -4000, -0.2F));
+    TEST_ASSERT_EQUAL_INT(10, ClosedLoop::following_error(800, -3950, -0.2F));
+    // a part of a step is rounded
+    TEST_ASSERT_EQUAL_INT(0, ClosedLoop::following_error(1, 4, 0.2F));
+    TEST_ASSERT_EQUAL_INT(1, ClosedLoop::following_error(1, 2, 0.2F));
+    // coarse encoder, several steps per count
+    TEST_ASSERT_EQUAL_INT(-2, ClosedLoop::following_error(100, 17, 6.0F));
+}
+
+REGISTER_TEST(ClosedLoopTest, needs_correction)
+{
+    // finer than a step, any whole step is corrected
+    TEST_ASSERT_FALSE(ClosedLoop::needs_correction(0, 0.2F));
+    TEST_ASSERT_TRUE(ClosedLoop::needs_correction(1, 0.2F));
+    TEST_ASSERT_TRUE(ClosedLoop::needs_correction(-1, -0.2F));
+
+    // coarser than a step, only once it is at least an encoder count out
+    TEST_ASSERT_FALSE(ClosedLoop::needs_correction(5, 6.0F));
+    TEST_ASSERT_FALSE(ClosedLoop::needs_correction(-5, -6.0F));
+    TEST_ASSERT_TRUE(ClosedLoop::needs_correction(6, 6.0F));
+    TEST_ASSERT_TRUE(ClosedLoop::needs_correction(-7, 6.0F));
+    TEST_ASSERT_FALSE(ClosedLoop::needs_correction(2, 2.5F));
+    TEST_ASSERT_TRUE(ClosedLoop::needs_correction(3, 2.5F));
+}
@@ -105,3 +105,34 @@ REGISTER_TESTF(Dispatcher, one_off_dispatch)
     TEST_ASSERT_EQUAL_INT(-789, args['Y']);
     TEST_ASSERT_EQUAL_INT(123, args['Z']);
 }
+
+REGISTER_TESTF(Dispatcher, frozen_dispatch)
+{
+    bool cb4= false;
+    THEDISPATCHER->add_handler(Dispatcher::MCODE_HANDLER, 1000, [&cb4](GCode& gc, OutputStream& os) { cb4= true; return true; });
+    THEDISPATCHER->freeze();
+    TEST_ASSERT_TRUE(THEDISPATCHER->is_frozen());
+
+    OutputStream os; // NULL output stream
+    TEST_ASSERT_TRUE(THEDISPATCHER->dispatch(gcodes[0], os));
+    TEST_ASSERT_TRUE( cb1 );
+    TEST_ASSERT_FALSE(cb2);
+    TEST_ASSERT_TRUE( cb3 );
+    TEST_ASSERT_TRUE(THEDISPATCHER->dispatch(gcodes[1], os));
+    TEST_ASSERT_TRUE( cb2 );
+    TEST_ASSERT_FALSE(THEDISPATCHER->dispatch(gcodes[2], os));
+
+    // sparse code
+    TEST_ASSERT_TRUE(THEDISPATCHER->dispatch(os, 'M', 1000, 0));
+    TEST_ASSERT_TRUE( cb4 );
+    TEST_ASSERT_FALSE(THEDISPATCHER->dispatch(os, 'M', 1001, 0));
+
+    // removing a handler unfreezes it
+    THEDISPATCHER->remove_handler(Dispatcher::GCODE_HANDLER, h3);
+    TEST_ASSERT_FALSE(THEDISPATCHER->is_frozen());
+    THEDISPATCHER->freeze();
+    cb1= cb3= false;
+    TEST_ASSERT_TRUE(THEDISPATCHER->dispatch(gcodes[0], os));
+    TEST_ASSERT_TRUE ( cb1 );
+    TEST_ASSERT_FALSE ( cb3 );
+}
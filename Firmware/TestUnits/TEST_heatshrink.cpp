@@ -0,0 +1,72 @@
+#include "../Unity/src/unity.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "TestRegistry.h"
+
+#include "HeatshrinkReader.h"
+
+// "G1 X10\nG1 X10\nG1 Y20\n" compressed with a window of 11 and lookahead of 4,
+// the second line is a single backref and the third starts with one
+static const uint8_t compressed[] = {
+    0xA3, 0xCC, 0x64, 0x15, 0x89, 0x8C, 0xC2, 0x14, 0x00, 0xD3, 0x59, 0x99, 0x4C, 0x21, 0x40
+};
+
+REGISTER_TEST(HeatshrinkTest, is_compressed)
+{
+    TEST_ASSERT_TRUE(HeatshrinkReader::is_compressed("/sd/test.gcode.hs"));
+    TEST_ASSERT_TRUE(HeatshrinkReader::is_compressed("/sd/TEST.HS"));
+    TEST_ASSERT_FALSE(HeatshrinkReader::is_compressed("/sd/test.gcode"));
+    TEST_ASSERT_FALSE(HeatshrinkReader::is_compressed(".hs"));
+}
+
+REGISTER_TEST(HeatshrinkTest, decompress_lines)
+{
+    FILE *fp = fmemopen((void *)compressed, sizeof(compressed), "r");
+    TEST_ASSERT_NOT_NULL(fp);
+
+    HeatshrinkReader *hs = new HeatshrinkReader(fp);
+    TEST_ASSERT_TRUE(hs->is_ok());
+
+    char buf[32];
+    TEST_ASSERT_NOT_NULL(hs->gets(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("G1 X10\n", buf);
+    TEST_ASSERT_NOT_NULL(hs->gets(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("G1 X10\n", buf);
+    TEST_ASSERT_NOT_NULL(hs->gets(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("G1 Y20\n", buf);
+    TEST_ASSERT_FALSE(hs->eof());
+
+    // the padding bits at the end do not decode to anything
+    TEST_ASSERT_NULL(hs->gets(buf, sizeof(buf)));
+    TEST_ASSERT_TRUE(hs->eof());
+    TEST_ASSERT_EQUAL_INT(sizeof(compressed), hs->get_consumed());
+
+    delete hs;
+    fclose(fp);
+}
+
+REGISTER_TEST(HeatshrinkTest, decompress_small_buffer)
+{
+    FILE *fp = fmemopen((void *)compressed, sizeof(compressed), "r");
+    TEST_ASSERT_NOT_NULL(fp);
+
+    HeatshrinkReader *hs = new HeatshrinkReader(fp);
+    TEST_ASSERT_TRUE(hs->is_ok());
+
+    // a line longer than the buffer is returned in pieces, including across a backref
+    char buf[5];
+    std::string out;
+    while(hs->gets(buf, sizeof(buf)) != nullptr) {
+        TEST_ASSERT_TRUE(strlen(buf) <= 4);
+        out.append(buf);
+    }
+
+    TEST_ASSERT_TRUE(hs->eof());
+    TEST_ASSERT_EQUAL_STRING("G1 X10\nG1 X10\nG1 Y20\n", out.c_str());
+
+    delete hs;
+    fclose(fp);
+}
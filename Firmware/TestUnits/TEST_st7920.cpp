@@ -74,8 +74,8 @@ REGISTER_TEST(ST7920, run_tests)
     y += 7;
     int cnt= 0;
     while(true) {
-        uint32_t st = benchmark_timer_start();
-        while(benchmark_timer_as_ms(benchmark_timer_elapsed(st)) < 1000) ;
+        // the display task only runs when this thread is not busy
+        vTaskDelay(pdMS_TO_TICKS(1000));
         std::string str = "Count: ";
         str.append(std::to_string(++cnt));
         // get size of string
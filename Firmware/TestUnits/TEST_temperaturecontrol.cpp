@@ -6,10 +6,13 @@
 #include "Module.h"
 #include "TemperatureControl.h"
 #include "TempSensor.h"
+#include "Thermistor.h"
 #include "Dispatcher.h"
 #include "OutputStream.h"
 #include "SlowTicker.h"
 #include "FastTicker.h"
+#include "Adc.h"
+#include "benchmark_timer.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -177,3 +180,50 @@ REGISTER_TEST(TemperatureControl,temp_range_error)
     TEST_ASSERT_FALSE(Module::is_halted());
 }
 
+const static char thermistor_config[]= "\
+[thermistor]\n\
+thermistor = EPCOS100K\n\
+thermistor_pin = ADC1_2\n\
+";
+
+REGISTER_TEST(TemperatureControl,thermistor_table)
+{
+    std::stringstream ss(thermistor_config);
+    ConfigReader cr(ss);
+    ConfigReader::section_map_t m;
+    TEST_ASSERT_TRUE(cr.get_section("thermistor", m));
+
+    Thermistor *therm = new Thermistor();
+    TEST_ASSERT_TRUE(therm->configure(cr, m, "ADC1_2"));
+
+    // the table must match the exact conversion over the useful range
+    float maxerr = 0;
+    for (uint32_t adc = 1; adc < (uint32_t)Adc::get_max_value(); adc += 13) {
+        float t = therm->calculate_temperature(adc);
+        if(isinf(t) || t < 0 || t > 350) continue;
+        float e = fabsf(therm->adc_value_to_temperature(adc) - t);
+        if(e > maxerr) maxerr = e;
+    }
+    printf("max table error %f\n", maxerr);
+    TEST_ASSERT_TRUE(maxerr < 0.25F);
+
+    TEST_ASSERT_TRUE(isinf(therm->adc_value_to_temperature(0)));
+    TEST_ASSERT_TRUE(isinf(therm->adc_value_to_temperature(Adc::get_max_value())));
+
+    // compare the time taken for each conversion
+    const uint32_t n = 10000;
+    volatile float v;
+    uint32_t st = benchmark_timer_start();
+    for (uint32_t i = 0; i < n; ++i) v = therm->calculate_temperature(1000 + i);
+    uint32_t exact = benchmark_timer_as_us(benchmark_timer_elapsed(st));
+
+    st = benchmark_timer_start();
+    for (uint32_t i = 0; i < n; ++i) v = therm->adc_value_to_temperature(1000 + i);
+    uint32_t lookup = benchmark_timer_as_us(benchmark_timer_elapsed(st));
+    (void)v;
+
+    printf("exact: %1.4f us, table: %1.4f us per conversion\n", (float)exact / n, (float)lookup / n);
+    TEST_ASSERT_TRUE(lookup < exact);
+
+    delete therm;
+}
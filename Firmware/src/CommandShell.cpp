@@ -21,6 +21,7 @@
 #include "Consoles.h"
 #include "BaseSolution.h"
 #include "Uart.h"
+#include "Uploader.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -76,6 +77,7 @@ bool CommandShell::initialize()
     THEDISPATCHER->add_handler( "date", std::bind( &CommandShell::date_cmd, this, _1, _2) );
 
     THEDISPATCHER->add_handler( "mem", std::bind( &CommandShell::mem_cmd, this, _1, _2) );
+    THEDISPATCHER->add_handler( "top", std::bind( &CommandShell::top_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "switch", std::bind( &CommandShell::switch_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "gpio", std::bind( &CommandShell::gpio_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "modules", std::bind( &CommandShell::modules_cmd, this, _1, _2) );
@@ -87,6 +89,7 @@ bool CommandShell::initialize()
     THEDISPATCHER->add_handler( "$J", std::bind( &CommandShell::jog_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "$P", std::bind( &CommandShell::probe_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "$S", std::bind( &CommandShell::switch_poll_cmd, this, _1, _2) );
+    THEDISPATCHER->add_handler( "$T", std::bind( &CommandShell::status_subscribe_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "test", std::bind( &CommandShell::test_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "version", std::bind( &CommandShell::version_cmd, this, _1, _2) );
     THEDISPATCHER->add_handler( "break", std::bind( &CommandShell::break_cmd, this, _1, _2) );
@@ -445,6 +448,94 @@ bool CommandShell::mem_cmd(std::string& params, OutputStream& os)
     return true;
 }
 
+#include "isr-stats.h"
+// Each call shows the cpu used since the previous one and starts a new sample, so the command thread is not held up
+// while sampling and the numbers are for the machine doing whatever it was doing between the calls
+bool CommandShell::top_cmd(std::string& params, OutputStream& os)
+{
+    HELP("show cpu usage of tasks and interrupts since the last top, the first one starts sampling");
+
+    // the last sample
+    static TaskStatus_t *before = nullptr;
+    static UBaseType_t nbefore = 0;
+    static uint32_t start = 0;
+    static TickType_t start_tick = 0;
+
+    UBaseType_t n = uxTaskGetNumberOfTasks() + 2; // allow for a couple of new tasks while sampling
+    TaskStatus_t *after = (TaskStatus_t *)malloc(n * sizeof(TaskStatus_t));
+    if(after == nullptr) {
+        os.printf("Not enough memory for operation\n");
+        return true;
+    }
+
+    UBaseType_t nafter = uxTaskGetSystemState(after, n, NULL);
+    uint32_t now = DWT->CYCCNT;
+    TickType_t now_tick = xTaskGetTickCount();
+
+    // take a copy of the ISR stats before printing as they keep changing
+    isr_stats_t isrs[ISR_STATS_NUM];
+    memcpy(isrs, isr_stats, sizeof(isrs));
+    isr_stats_reset();
+
+    // the run time counters are cpu cycles and wrap every 2^32 cycles
+    float max_secs = 4294967295.0F / SystemCoreClock;
+    uint32_t elapsed = now - start;
+    bool valid = before != nullptr && now_tick - start_tick < pdMS_TO_TICKS(max_secs * 1000) && elapsed > 0;
+
+    if(valid) {
+        float sampled = (float)elapsed / SystemCoreClock;
+        float cycles_per_us = SystemCoreClock / 1000000.0F;
+
+        os.printf("sampled for %1.3f seconds\n", sampled);
+        os.printf("task         cpu%%  stack pri\n");
+        for (UBaseType_t i = 0; i < nafter; ++i) {
+            // find the same task in the first sample, a task created while sampling started from 0
+            uint32_t was = 0;
+            for (UBaseType_t j = 0; j < nbefore; ++j) {
+                if(before[j].xTaskNumber == after[i].xTaskNumber) {
+                    was = before[j].ulRunTimeCounter;
+                    break;
+                }
+            }
+            uint32_t used = after[i].ulRunTimeCounter - was;
+            os.printf("%-10s %6.2f %6u %3u\n", after[i].pcTaskName, used * 100.0F / elapsed,
+                      (unsigned int)after[i].usStackHighWaterMark, (unsigned int)after[i].uxCurrentPriority);
+        }
+
+        os.printf("\nisr          cpu%%       rate  avg us  max us\n");
+        float isr_total = 0;
+        for (int i = 0; i < ISR_STATS_NUM; ++i) {
+#ifndef STEP_ISR_STATS
+            if(i == ISR_STATS_STEP || i == ISR_STATS_UNSTEP) {
+                os.printf("%-10s not measured, build with isrstats=1\n", isrs[i].name);
+                continue;
+            }
+#endif
+            float pc = isrs[i].cycles * 100.0F / elapsed;
+            isr_total += pc;
+            os.printf("%-10s %6.2f %8.0fHz %7.2f %7.2f\n", isrs[i].name, pc, isrs[i].count / sampled,
+                      isrs[i].count > 0 ? isrs[i].cycles / (isrs[i].count * cycles_per_us) : 0.0F, isrs[i].max / cycles_per_us);
+        }
+        os.printf("NOTE the %1.2f%% used by these ISRs is included in the cpu%% of the tasks they interrupted\n", isr_total);
+
+    } else {
+        if(before != nullptr) {
+            os.printf("more than %1.1f seconds since the last top, ", max_secs);
+        }
+        os.printf("sampling started, run top again to see the cpu usage since now\n");
+    }
+
+    // this sample is the start of the next one
+    free(before);
+    before = after;
+    nbefore = nafter;
+    start = now;
+    start_tick = now_tick;
+
+    os.set_no_response();
+    return true;
+}
+
 #if 0
 bool CommandShell::mount_cmd(std::string& params, OutputStream& os)
 {
@@ -658,6 +749,23 @@ bool CommandShell::switch_poll_cmd(std::string& params, OutputStream& os)
     return true;
 }
 
+bool CommandShell::status_subscribe_cmd(std::string& params, OutputStream& os)
+{
+    HELP("$T [0] - subscribe to pushed status reports, 0 unsubscribes")
+    std::string v = stringutils::shift_parameter( params );
+    bool on = v != "0";
+
+    if(!set_status_subscriber(&os, on)) {
+        os.printf("error:status reports are disabled\n");
+    } else {
+        os.printf("[status reports %s]\n", on ? "on" : "off");
+    }
+
+    os.set_no_response();
+
+    return true;
+}
+
 static bool get_spindle_state()
 {
     // get spindle switch state
@@ -1641,20 +1749,16 @@ bool CommandShell::is_busy()
 
 bool CommandShell::download_cmd(std::string& params, OutputStream& os)
 {
-    HELP("dl filename size - fast streaming binary download over USB serial");
+    HELP("dl filename size [md5] - fast streaming binary download over USB serial, can be used while printing");
 
     std::string fn = stringutils::shift_parameter( params );
     std::string sizestr = stringutils::shift_parameter( params );
+    std::string md5 = stringutils::shift_parameter( params );
 
     os.set_no_response(true);
 
     if(fn.empty() || sizestr.empty()) {
-        os.printf("FAIL - Usage dl filename size\n");
-        return true;
-    }
-
-    if(is_busy()) {
-        os.printf("FAIL - download not allowed while printing or heaters are on\n");
+        os.printf("FAIL - Usage dl filename size [md5]\n");
         return true;
     }
 
@@ -1670,61 +1774,13 @@ bool CommandShell::download_cmd(std::string& params, OutputStream& os)
         return true;
     }
 
-    FILE *fp = fopen(fn.c_str(), "w");
-    if(fp == nullptr) {
-        os.printf("FAIL - could not open file: %d\n", errno);
-        return true;
-    }
-
-    printf("DEBUG: fast download over USB serial started\n");
-
-    volatile ssize_t state = 0;
-    SemaphoreHandle_t xSemaphore = xSemaphoreCreateBinary();
-
-    os.fast_capture_fnc = [&fp, &state, xSemaphore, file_size](char *buf, size_t len) {
-        // note this is being run in the Comms thread
-        if(state < 0 || state >= file_size) return true; // we are in an error state or done
-
-        if(fwrite(buf, 1, len, fp) != len) {
-            state = -1;
-            printf("DEBUG: fast download fwrite failed\n");
-            xSemaphoreGive(xSemaphore);
-        } else {
-            state += len;
-            if(state >= file_size) {
-                printf("DEBUG: fast download all bytes received\n");
-                xSemaphoreGive(xSemaphore);
-                return false; // indicates we are done successfully
-            }
-        }
+    if(!md5.empty() && md5.size() != 32) {
+        os.printf("FAIL - md5 is bad: %s\n", md5.c_str());
         return true;
-    };
-
-    // tell host we are ready for the file
-    os.printf("READY - %d\n", file_size);
-
-    // wait for completion or timeout
-    // Note this will block the command thread, and also query processing
-    // may need to call handle_query every now and then (like safe_sleep)
-    if(xSemaphoreTake(xSemaphore, pdMS_TO_TICKS(20000)) != pdTRUE) {
-        printf("DEBUG: fast download timed out\n");
-        state = -2;
-        errno = ETIMEDOUT;
-    }
-
-    os.printf(state <= 0 ? "FAIL - %d\n" : "SUCCESS\n", errno);
-
-    fclose(fp);
-    vSemaphoreDelete(xSemaphore);
-
-    printf("DEBUG: fast download over USB serial ended: %d\n", state);
-
-    if(state <= 0) {
-        // allow incoming buffers to drain
-        vTaskDelay(pdMS_TO_TICKS(1000));
     }
 
-    os.fast_capture_fnc = nullptr;
+    // the download runs in the background and reports SUCCESS or FAIL when it is done
+    Uploader::start(fn, file_size, md5, os);
 
     return true;
 }
@@ -33,11 +33,13 @@ private:
     bool config_set_cmd(std::string& params, OutputStream& os);
     bool config_get_cmd(std::string& params, OutputStream& os);
     bool mem_cmd(std::string& params, OutputStream& os);
+    bool top_cmd(std::string& params, OutputStream& os);
     //bool mount_cmd(std::string& params, OutputStream& os);
     bool cat_cmd(std::string& params, OutputStream& os);
     bool md5sum_cmd(std::string& params, OutputStream& os);
     bool switch_cmd(std::string& params, OutputStream& os);
     bool switch_poll_cmd(std::string& params, OutputStream& os);
+    bool status_subscribe_cmd(std::string& params, OutputStream& os);
     bool modules_cmd(std::string& params, OutputStream& os);
     bool gpio_cmd(std::string& params, OutputStream& os);
     bool get_cmd(std::string& params, OutputStream& os);
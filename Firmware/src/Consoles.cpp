@@ -9,6 +9,7 @@
 #include <malloc.h>
 #include <fstream>
 #include <vector>
+#include <atomic>
 
 #include "benchmark_timer.h"
 #include "CommandShell.h"
@@ -46,6 +47,12 @@ struct query_t {
 };
 static RingBuffer<struct query_t, 8> queries; // thread safe FIFO
 
+// consoles that have subscribed to status reports with $T
+static std::set<OutputStream*> status_subscribers;
+static SemaphoreHandle_t status_mutex;
+static std::atomic_uint n_status_subscribers{0}; // so the command thread can check without taking the mutex
+static uint32_t status_report_period_ms = 100;
+
 static FILE *upload_fp = nullptr;
 static bool loaded_configuration = false;
 bool config_override = false;
@@ -294,6 +301,14 @@ bool process_command_buffer(size_t n, char *rx_buf, OutputStream *os, char *line
                 os->set_stop_request(true);
             }
 
+        } else if((uint8_t)line[cnt] >= 0x90 && (uint8_t)line[cnt] <= 0x97) {
+            // grbl realtime feed and rapid overrides, applied by the command thread
+            Robot::getInstance()->request_override(line[cnt]);
+
+        } else if(cnt == 0 && (line[cnt] == '!' || line[cnt] == '~')) {
+            // grbl realtime feed hold and cycle start, only when not inside a line
+            Conveyor::getInstance()->feed_hold(line[cnt] == '!');
+
         } else if(line[cnt] == '?') {
             if(!queries.full()) {
                 queries.push_back({os, nullptr});
@@ -312,7 +327,7 @@ bool process_command_buffer(size_t n, char *rx_buf, OutputStream *os, char *line
         } else if(line[cnt] == '\n') {
             os->clear_flags(); // clear the done flag here to avoid race conditions
             line[cnt] = '\0'; // remove the \n and nul terminate
-            if(cnt >= 2 && line[0] == '$' && (line[1] == 'I' || line[1] == 'S' || line[1] == 'X')) {
+            if(cnt >= 2 && line[0] == '$' && (line[1] == 'I' || line[1] == 'S' || line[1] == 'T' || line[1] == 'X')) {
                 if(line[1] == 'X') {
                     // handle $X here
                     if(Module::is_halted()) {
@@ -322,7 +337,7 @@ bool process_command_buffer(size_t n, char *rx_buf, OutputStream *os, char *line
                     os->puts("ok\n");
 
                 } else if(!queries.full()) {
-                    // Handle $I and $S as instant queries
+                    // Handle $I, $S and $T as instant queries
                     queries.push_back({os, strdup(line)});
                 }
 
@@ -430,6 +445,7 @@ static void usb_comms(void *param)
         }
 
         output_streams.erase(os);
+        set_status_subscriber(os, false);
         delete os;
     } while(false);
 
@@ -537,6 +553,39 @@ void print_to_all_consoles(const char *str)
     }
 }
 
+// can be called from any thread, streams must unsubscribe before they are deleted
+bool set_status_subscriber(OutputStream *os, bool on)
+{
+    if(on && status_report_period_ms == 0) return false;
+
+    xSemaphoreTake(status_mutex, portMAX_DELAY);
+    if(on) {
+        status_subscribers.insert(os);
+    } else {
+        status_subscribers.erase(os);
+    }
+    n_status_subscribers = status_subscribers.size();
+    xSemaphoreGive(status_mutex);
+    return true;
+}
+
+// the status frame is built once per period and sent to all the subscribers
+static void handle_status_reports()
+{
+    static TickType_t last_report = 0;
+    if(n_status_subscribers == 0 || xTaskGetTickCount() - last_report < pdMS_TO_TICKS(status_report_period_ms)) return;
+    last_report = xTaskGetTickCount();
+
+    char buf[256];
+    size_t n = Robot::getInstance()->get_status_frame(buf, sizeof(buf));
+
+    xSemaphoreTake(status_mutex, portMAX_DELAY);
+    for(auto os : status_subscribers) {
+        if(!os->is_closed()) os->write(buf, n);
+    }
+    xSemaphoreGive(status_mutex);
+}
+
 static void handle_query(bool need_done)
 {
     // set in comms thread, and executed in the command thread to avoid thread clashes.
@@ -559,6 +608,15 @@ static void handle_query(bool need_done)
         // FIXME may not work as expected when there are multiple I/O channels and output streams
         if(need_done && queries.empty()) q.query_os->set_done();
     }
+
+    // apply any realtime overrides
+    Robot::getInstance()->apply_override_request();
+
+    // resume from a feed hold once it has stopped
+    Conveyor::getInstance()->check_feed_hold();
+
+    // also push the status to any subscribers when it is due
+    handle_status_reports();
 }
 
 /*
@@ -647,6 +705,8 @@ void safe_sleep(uint32_t ms)
 static bool uart_console_enabled;
 bool start_consoles()
 {
+    status_mutex = xSemaphoreCreateMutex();
+
     // create queue for incoming buffers from the I/O ports
     if(!create_message_queue()) {
         // Failed to create the queue.
@@ -684,6 +744,9 @@ bool configure_consoles(ConfigReader& cr)
     if(cr.get_section("consoles", cm)) {
         config_second_usb_serial = cr.get_bool(cm, "second_usb_serial_enable", false) ? 1 : 0;
         printf("INFO: second usb serial is %s\n", config_second_usb_serial ? "enabled" : "disabled");
+        // rate in Hz that status reports are pushed to consoles that have subscribed with $T, 0 disables it
+        float rate = cr.get_float(cm, "status_report_rate", 10);
+        status_report_period_ms = rate > 0 ? 1000.0F / rate : 0;
 
     }
 
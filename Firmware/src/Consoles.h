@@ -14,6 +14,8 @@ bool start_consoles();
 bool load_config_override(OutputStream& os, const char *fn=DEFAULT_OVERRIDE_FILE);
 void command_handler();
 UART *get_aux_uart();
+// subscribe or unsubscribe the stream from status reports, returns false if they are disabled
+bool set_status_subscriber(OutputStream *os, bool on);
 
 // print string to all connected consoles
 extern "C" void print_to_all_consoles(const char *);
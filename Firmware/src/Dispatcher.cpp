@@ -9,6 +9,7 @@
 #include <cmath>
 #include <string.h>
 #include <cstdarg>
+#include <algorithm>
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -61,17 +62,42 @@ bool Dispatcher::dispatch(GCode& gc, OutputStream& os, bool need_ok) const
 		}
 	}
 
-	auto& handler = gc.has_g() ? gcode_handlers : mcode_handlers;
-	const auto& f = handler.equal_range(gc.get_code());
 	bool ret = false;
-
-	for (auto it = f.first; it != f.second; ++it) {
-		if(it->second(gc, os)) {
+	auto call = [&](const Handler_t& fnc) {
+		if(fnc(gc, os)) {
 			ret = true;
 		} else {
 			// not really useful as many handlers will only process if certain params are set, so not an error unless no handler deals with it.
 			DEBUG_WARNING("//INFO: handler did not handle %c%d\n", gc.has_g() ? 'G' : 'M', gc.get_code());
 		}
+	};
+
+	uint16_t code = gc.get_code();
+	if(frozen) {
+		const Table_t& table = gc.has_g() ? gcode_table : mcode_table;
+		uint16_t first, last;
+		if(code < dense_codes) {
+			first = table.dense[code];
+			last = table.dense[code + 1];
+		} else {
+			auto it = std::lower_bound(table.sparse.begin(), table.sparse.end(), code, [](const Table_t::Sparse_t& s, uint16_t c) { return s.code < c; });
+			if(it != table.sparse.end() && it->code == code) {
+				first = it->first;
+				last = it->last;
+			} else {
+				first = last = 0;
+			}
+		}
+		for (uint16_t i = first; i < last; ++i) {
+			call(*table.handlers[i]);
+		}
+
+	} else {
+		auto& handler = gc.has_g() ? gcode_handlers : mcode_handlers;
+		const auto& f = handler.equal_range(code);
+		for (auto it = f.first; it != f.second; ++it) {
+			call(it->second);
+		}
 	}
 
 	if(ret) {
@@ -171,6 +197,8 @@ bool Dispatcher::dispatch(const char *line, OutputStream& os) const
 
 Dispatcher::Handlers_t::iterator Dispatcher::add_handler(HANDLER_NAME gcode, uint16_t code, Handler_t fnc)
 {
+	// the tables need to be rebuilt to include this handler
+	frozen = false;
 	Handlers_t::iterator ret;
 	switch(gcode) {
 		case GCODE_HANDLER: ret = gcode_handlers.insert( Handlers_t::value_type(code, fnc) ); break;
@@ -181,6 +209,7 @@ Dispatcher::Handlers_t::iterator Dispatcher::add_handler(HANDLER_NAME gcode, uin
 
 void Dispatcher::remove_handler(HANDLER_NAME gcode, Handlers_t::iterator i)
 {
+	frozen = false;
 	switch(gcode) {
 		case GCODE_HANDLER: gcode_handlers.erase(i); break;
 		case MCODE_HANDLER: mcode_handlers.erase(i); break;
@@ -195,7 +224,49 @@ Dispatcher::CommandHandlers_t::iterator Dispatcher::add_handler(std::string cmd,
 // mainly used for testing
 void Dispatcher::clear_handlers()
 {
+	frozen = false;
 	gcode_handlers.clear();
 	mcode_handlers.clear();
 	command_handlers.clear();
 }
+
+// called once all the handlers have been added at the end of boot
+// builds the flat tables that dispatch uses instead of searching the multimaps
+// adding or removing a handler after this falls back to the multimaps until freeze is called again
+void Dispatcher::freeze()
+{
+	build_table(gcode_handlers, gcode_table);
+	build_table(mcode_handlers, mcode_table);
+	frozen = true;
+}
+
+void Dispatcher::build_table(const Handlers_t& handlers, Table_t& table)
+{
+	table.handlers.clear();
+	table.sparse.clear();
+	table.handlers.reserve(handlers.size());
+
+	// the multimap is sorted by code so the dense codes come first
+	uint16_t c = 0;
+	auto it = handlers.begin();
+	while(it != handlers.end()) {
+		uint16_t code = it->first;
+		uint16_t first = table.handlers.size();
+		for (; it != handlers.end() && it->first == code; ++it) {
+			table.handlers.push_back(&it->second);
+		}
+
+		if(code < dense_codes) {
+			// codes with no handlers get an empty range
+			while(c <= code) table.dense[c++] = first;
+		} else {
+			table.sparse.push_back({code, first, (uint16_t)table.handlers.size()});
+		}
+	}
+
+	uint16_t dense_end = table.sparse.empty() ? table.handlers.size() : table.sparse[0].first;
+	while(c <= dense_codes) table.dense[c++] = dense_end;
+
+	table.handlers.shrink_to_fit();
+	table.sparse.shrink_to_fit();
+}
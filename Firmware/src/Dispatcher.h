@@ -4,6 +4,7 @@
 #include <functional>
 #include <string>
 #include <set>
+#include <vector>
 #include <stdint.h>
 
 #define THEDISPATCHER Dispatcher::getInstance()
@@ -37,6 +38,8 @@ public:
     bool dispatch(const char *line, OutputStream& os) const;
     bool load_configuration() const;
     void clear_handlers();
+    void freeze();
+    bool is_frozen() const { return frozen; }
     bool is_grbl_mode() const { return grbl_mode; }
     void set_grbl_mode(bool flg) { grbl_mode= flg; }
 
@@ -44,10 +47,24 @@ private:
     static Dispatcher *instance;
     Dispatcher(){};
 
+    // flat code indexed table of the handlers built by freeze()
+    // codes below dense_codes index directly into the handlers, the rest are binary searched
+    static const uint16_t dense_codes = 256;
+    struct Table_t {
+        struct Sparse_t { uint16_t code, first, last; };
+        std::vector<const Handler_t*> handlers; // in the same order as in the multimap
+        std::vector<Sparse_t> sparse;           // sorted by code
+        uint16_t dense[dense_codes + 1];        // handlers for code n are from dense[n] to dense[n+1]
+    };
+    static void build_table(const Handlers_t& handlers, Table_t& table);
+
     // use multimap as multiple handlers may be needed per gcode
     Handlers_t gcode_handlers;
     Handlers_t mcode_handlers;
     CommandHandlers_t command_handlers;
+    Table_t gcode_table;
+    Table_t mcode_table;
     bool grbl_mode{false};
+    bool frozen{false};
 };
 
@@ -149,7 +149,7 @@ bool GCodeProcessor::parse(const char *line, GCodes_t& gcodes)
 
                 if(c == 'G' || c == 'M') {
                     gc.set_command(c, std::get<0>(code), std::get<1>(code));
-                    if(c == 'G' && std::get<0>(code) <= 3) {
+                    if(c == 'G' && (std::get<0>(code) <= 3 || std::get<0>(code) == 5)) {
                         group1.clear();
                         group1.set_command(c, std::get<0>(code), std::get<1>(code));
                     }
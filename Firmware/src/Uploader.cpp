@@ -0,0 +1,271 @@
+#include "Uploader.h"
+#include "OutputStream.h"
+#include "Module.h"
+
+#include "task.h"
+
+#include <string.h>
+#include <errno.h>
+#include <tuple>
+#include <algorithm>
+
+// how long to wait for the host to send more data before giving up
+#define RX_TIMEOUT_MS 5000
+// how long to let incoming data drain after an error
+#define DRAIN_MS 1000
+// how long the writer sleeps after each buffer while a file is being played
+#define PLAYING_THROTTLE_MS 20
+
+Uploader *Uploader::instance = nullptr;
+
+bool Uploader::init()
+{
+    free_queue = xQueueCreate(num_buffers, sizeof(int));
+    full_queue = xQueueCreate(num_buffers, sizeof(int));
+    rx_mutex = xSemaphoreCreateMutex();
+    return free_queue != nullptr && full_queue != nullptr && rx_mutex != nullptr;
+}
+
+bool Uploader::allocate()
+{
+    xQueueReset(free_queue);
+    xQueueReset(full_queue);
+
+    for (int i = 0; i < num_buffers; ++i) {
+        buffers[i] = (char *)malloc(buffer_size);
+        if(buffers[i] == nullptr) return false;
+        xQueueSend(free_queue, &i, 0);
+    }
+
+    return true;
+}
+
+void Uploader::release()
+{
+    for (int i = 0; i < num_buffers; ++i) {
+        free(buffers[i]);
+        buffers[i] = nullptr;
+    }
+}
+
+// Called from the command thread, sets up the transfer and returns once the host has been told to start sending
+bool Uploader::start(const std::string& fn, ssize_t size, const std::string& md5, OutputStream& os)
+{
+    if(instance == nullptr) {
+        Uploader *up = new Uploader;
+        if(!up->init()) {
+            os.printf("FAIL - could not start download\n");
+            return false;
+        }
+        instance = up;
+    }
+
+    Uploader *up = instance;
+
+    if(up->busy) {
+        os.printf("FAIL - a download is already in progress\n");
+        return false;
+    }
+
+    if(!up->allocate()) {
+        up->release();
+        os.printf("FAIL - not enough memory for download\n");
+        return false;
+    }
+
+    up->fp = fopen(fn.c_str(), "w");
+    if(up->fp == nullptr) {
+        up->release();
+        os.printf("FAIL - could not open file: %d\n", errno);
+        return false;
+    }
+
+    up->os = &os;
+    up->expected_md5 = md5;
+    up->md5.reinit();
+    up->written = 0;
+    up->error = 0;
+    up->failed = false;
+    up->capture_done = false;
+    up->last_rx = xTaskGetTickCount();
+
+    xSemaphoreTake(up->rx_mutex, portMAX_DELAY);
+    up->file_size = size;
+    up->received = 0;
+    up->fill_idx = -1;
+    up->finished = false;
+    uint32_t gen = ++up->generation;
+    xSemaphoreGive(up->rx_mutex);
+
+    up->busy = true;
+
+    // runs at the same priority as the player so it gets a fair share of the sdcard
+    if(xTaskCreate(writer_task, "Uploader", 3000 / 4, up, (tskIDLE_PRIORITY + 1UL), (TaskHandle_t *) NULL) != pdPASS) {
+        fclose(up->fp);
+        xSemaphoreTake(up->rx_mutex, portMAX_DELAY);
+        up->finished = true;
+        up->release();
+        xSemaphoreGive(up->rx_mutex);
+        up->busy = false;
+        os.printf("FAIL - could not start download\n");
+        return false;
+    }
+
+    printf("DEBUG: fast download over USB serial started\n");
+
+    os.fast_capture_fnc = [up, gen](char *buf, size_t len) { return up->receive(gen, buf, len); };
+
+    // tell host we are ready for the file
+    os.printf("READY - %d\n", size);
+
+    return true;
+}
+
+// note this is being run in the Comms thread
+// returns false when it is done, the comms thread then clears the capture function
+bool Uploader::receive(uint32_t gen, char *buf, size_t len)
+{
+    xSemaphoreTake(rx_mutex, portMAX_DELAY);
+    bool more = gen == generation && !finished && capture(buf, len);
+    xSemaphoreGive(rx_mutex);
+    return more;
+}
+
+// copies the data into the next free buffer, returns false when all the bytes have been received
+bool Uploader::capture(char *buf, size_t len)
+{
+    last_rx = xTaskGetTickCount();
+
+    while(len > 0) {
+        size_t n = std::min(len, (size_t)(file_size - received));
+
+        if(failed) {
+            // we are in an error state so just discard until the host stops sending
+            received += n;
+            if(received >= file_size) {
+                capture_done = true;
+                return false;
+            }
+            return true;
+        }
+
+        if(fill_idx < 0) {
+            // all the buffers are waiting to be written, so hold off the host until the writer frees one up.
+            // This is the only wait and it does not time out, the writer sends -1 if it gives up
+            xQueueReceive(free_queue, &fill_idx, portMAX_DELAY);
+            if(fill_idx < 0) continue;
+            fill_len = 0;
+        }
+
+        n = std::min(n, buffer_size - fill_len);
+        memcpy(buffers[fill_idx] + fill_len, buf, n);
+        fill_len += n;
+        received += n;
+        buf += n;
+        len -= n;
+
+        bool more = received < file_size;
+        if(fill_len == buffer_size || !more) {
+            // hand the full buffer to the writer, there is always room as there are only num_buffers
+            lengths[fill_idx] = fill_len;
+            xQueueSend(full_queue, &fill_idx, 0);
+            fill_idx = -1;
+            if(!more) {
+                capture_done = true;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Uploader::is_playing() const
+{
+    Module *m = Module::lookup("player");
+    if(m == nullptr) return false;
+
+    std::tuple<bool, unsigned long, unsigned char> r;
+    return m->request("is_playing", &r) && std::get<0>(r);
+}
+
+void Uploader::writer_task(void *arg)
+{
+    Uploader *up = static_cast<Uploader *>(arg);
+    up->writer();
+    up->finish();
+    vTaskDelete(NULL);
+}
+
+void Uploader::writer()
+{
+    while(written < file_size && !failed) {
+        int idx;
+        if(xQueueReceive(full_queue, &idx, pdMS_TO_TICKS(100)) != pdTRUE) {
+            if(xTaskGetTickCount() - last_rx > pdMS_TO_TICKS(RX_TIMEOUT_MS)) {
+                printf("DEBUG: fast download timed out\n");
+                error = ETIMEDOUT;
+                break;
+            }
+            continue;
+        }
+
+        size_t len = lengths[idx];
+        if(fwrite(buffers[idx], 1, len, fp) != len) {
+            printf("DEBUG: fast download fwrite failed\n");
+            error = errno;
+            break;
+        }
+
+        md5.update(buffers[idx], len);
+        written += len;
+        xQueueSend(free_queue, &idx, 0);
+
+        if(is_playing()) {
+            // let the player have the sdcard
+            vTaskDelay(pdMS_TO_TICKS(PLAYING_THROTTLE_MS));
+        }
+    }
+
+    fclose(fp);
+    fp = nullptr;
+
+    if(written < file_size) {
+        // wake up the comms thread if it is waiting for a buffer, it discards the rest of the data from here on
+        failed = true;
+        int stop = -1;
+        xQueueSend(free_queue, &stop, 0);
+    }
+}
+
+// sends the result to the host and releases the buffers once the comms thread has finished with them
+void Uploader::finish()
+{
+    if(written >= file_size) {
+        std::string digest = md5.finalize().hexdigest();
+        if(expected_md5.empty() || strcasecmp(expected_md5.c_str(), digest.c_str()) == 0) {
+            os->printf("SUCCESS - %s\n", digest.c_str());
+        } else {
+            os->printf("FAIL - checksum mismatch %s\n", digest.c_str());
+        }
+        printf("DEBUG: fast download over USB serial ended: %d, %s\n", written, digest.c_str());
+
+    } else {
+        os->printf("FAIL - %d\n", error);
+        printf("DEBUG: fast download over USB serial failed: %d\n", written);
+
+        // allow incoming buffers to drain
+        while(!capture_done && xTaskGetTickCount() - last_rx < pdMS_TO_TICKS(DRAIN_MS)) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+
+    // once finished is set the capture function returns false the next time it is called,
+    // which has the comms thread clear it
+    xSemaphoreTake(rx_mutex, portMAX_DELAY);
+    finished = true;
+    release();
+    xSemaphoreGive(rx_mutex);
+    os = nullptr;
+    busy = false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "md5.h"
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include <string>
+#include <stdio.h>
+#include <sys/types.h>
+
+class OutputStream;
+
+// Streams a file upload to the sdcard without blocking the command thread.
+// The comms thread only copies the received data into a ring of buffers, a low priority writer task
+// writes the full buffers to the file and calculates the md5 of the data as it goes.
+// FatFs is re-entrant so the writer can share the sdcard with the player, it is throttled when a file
+// is being played so it does not slow down the running job.
+class Uploader
+{
+public:
+    // sets up the transfer and returns once the host has been told to start sending,
+    // the writer task sends the result to the host when the transfer is complete
+    static bool start(const std::string& fn, ssize_t size, const std::string& md5, OutputStream& os);
+
+private:
+    Uploader() {};
+    bool init();
+    bool allocate();
+    void release();
+    bool receive(uint32_t gen, char *buf, size_t len);
+    bool capture(char *buf, size_t len);
+    static void writer_task(void *);
+    void writer();
+    void finish();
+    bool is_playing() const;
+
+    static const size_t buffer_size = 8192; // multiple of the sector size so fatfs writes whole sectors
+    static const int num_buffers = 4;
+    // never deleted as a capture function that was not cleared yet may still call it
+    static Uploader *instance;
+
+    OutputStream *os{nullptr}; // the USB stream the download came from, it is not deleted while the comms thread runs
+    FILE *fp{nullptr};
+    MD5 md5;
+    std::string expected_md5;
+
+    char *buffers[num_buffers]{};
+    size_t lengths[num_buffers]{};
+    QueueHandle_t free_queue{nullptr}; // buffers the comms thread can fill, -1 is sent when the writer gives up
+    QueueHandle_t full_queue{nullptr}; // buffers waiting to be written
+    SemaphoreHandle_t rx_mutex{nullptr}; // held by the comms thread while it is using the buffers
+
+    ssize_t file_size{0};
+    ssize_t received{0};
+    ssize_t written{0};
+    size_t fill_len{0};
+    int fill_idx{-1};
+    int error{0};
+    uint32_t generation{0}; // stops a stale capture function feeding a later download
+    volatile TickType_t last_rx;
+    volatile bool failed{false};
+    volatile bool capture_done{false};
+    volatile bool busy{false}; // a download is running, set by the command thread and cleared by the writer
+    bool finished{true};
+};
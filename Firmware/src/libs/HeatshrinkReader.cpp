@@ -0,0 +1,106 @@
+#include "HeatshrinkReader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+HeatshrinkReader::HeatshrinkReader(FILE *f) : fp(f)
+{
+    // the window starts as all zeros the same as the encoder
+    window = (uint8_t *)calloc(1 << window_sz2, 1);
+}
+
+HeatshrinkReader::~HeatshrinkReader()
+{
+    free(window);
+}
+
+// compressed files have .hs added to the original name eg foo.gcode.hs
+bool HeatshrinkReader::is_compressed(const char *fn)
+{
+    size_t n = strlen(fn);
+    return n > 3 && strcasecmp(fn + n - 3, ".hs") == 0;
+}
+
+// next compressed byte, -1 at the end of the file
+int HeatshrinkReader::get_byte()
+{
+    if(inpos >= inlen) {
+        inlen = fread(inbuf, 1, sizeof(inbuf), fp);
+        inpos = 0;
+        if(inlen == 0) return -1;
+    }
+    ++consumed;
+    return inbuf[inpos++];
+}
+
+// next n bits msb first, -1 at the end of the file
+int HeatshrinkReader::get_bits(int n)
+{
+    int bits = 0;
+    for (int i = 0; i < n; ++i) {
+        if(bit_mask == 0) {
+            int c = get_byte();
+            if(c < 0) return -1;
+            bit_buf = c;
+            bit_mask = 0x80;
+        }
+        bits <<= 1;
+        if(bit_buf & bit_mask) bits |= 1;
+        bit_mask >>= 1;
+    }
+    return bits;
+}
+
+// next decompressed byte, -1 at the end of the file
+int HeatshrinkReader::get_char()
+{
+    const uint16_t mask = (1 << window_sz2) - 1;
+
+    if(copy_count == 0) {
+        // the padding at the end of the last byte is never enough for a whole literal or backref
+        int tag = get_bits(1);
+        if(tag < 0) return -1;
+
+        if(tag == 1) {
+            // literal
+            int c = get_bits(8);
+            if(c < 0) return -1;
+            window[head++ & mask] = c;
+            return c;
+        }
+
+        // backref to the previous output
+        int index = get_bits(window_sz2);
+        if(index < 0) return -1;
+        int count = get_bits(lookahead_sz2);
+        if(count < 0) return -1;
+        copy_offset = index + 1;
+        copy_count = count + 1;
+    }
+
+    uint8_t c = window[(head - copy_offset) & mask];
+    window[head++ & mask] = c;
+    --copy_count;
+    return c;
+}
+
+char *HeatshrinkReader::gets(char *buf, int size)
+{
+    if(at_eof || size <= 1) return nullptr;
+
+    int n = 0;
+    while(n < size - 1) {
+        int c = get_char();
+        if(c < 0) {
+            at_eof = true;
+            break;
+        }
+        buf[n++] = c;
+        if(c == '\n') break;
+    }
+
+    if(n == 0) return nullptr;
+    buf[n] = '\0';
+    return buf;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming decoder for files compressed with heatshrink (LZSS), decompressed a line at a time as they are read.
+// Uses the heatshrink defaults of an 11 bit window and 4 bit lookahead (heatshrink -e -w 11 -l 4),
+// so it needs a 2KB window in SRAM.
+class HeatshrinkReader
+{
+public:
+    static const uint8_t window_sz2 = 11;
+    static const uint8_t lookahead_sz2 = 4;
+
+    HeatshrinkReader(FILE *fp);
+    ~HeatshrinkReader();
+    bool is_ok() const { return window != nullptr; }
+    // same as fgets but returns the decompressed data
+    char *gets(char *buf, int size);
+    bool eof() const { return at_eof; }
+    // the number of compressed bytes read so far
+    size_t get_consumed() const { return consumed; }
+
+    static bool is_compressed(const char *fn);
+
+private:
+    int get_char();
+    int get_bits(int n);
+    int get_byte();
+
+    FILE *fp;
+    uint8_t *window;
+    uint8_t inbuf[512];
+    size_t inlen{0}, inpos{0};
+    size_t consumed{0};
+    uint16_t head{0};        // where the next output byte goes in the window
+    uint16_t copy_offset{0}; // the backref being copied
+    uint16_t copy_count{0};
+    uint8_t bit_buf{0};
+    uint8_t bit_mask{0};
+    bool at_eof{false};
+};
@@ -1,9 +1,13 @@
 #include "SigmaDeltaPwm.h"
 
 #include "FastTicker.h"
+#include "GpioWave.h"
+#include "Pwm.h"
 #include "FreeRTOS.h"
 #include "task.h"
 
+#include <strings.h>
+
 #define confine(value, min, max) (((value) < (min))?(min):(((value) > (max))?(max):(value)))
 
 #define PID_PWM_MAX 256
@@ -17,7 +21,25 @@ SigmaDeltaPwm::SigmaDeltaPwm(const char *pin_name)
     _pwm = -1;
     _sd_direction = false;
     _sd_accumulator = 0;
+
+    if(strncasecmp(pin_name, "PWM", 3) == 0) {
+        // a hardware PWM channel
+        hwpwm = new Pwm(pin_name);
+        if(!hwpwm->is_valid()) {
+            printf("ERROR: SigmaDeltaPwm: ERROR invalid PWM channel %s\n", pin_name);
+            delete hwpwm;
+            hwpwm = nullptr;
+        }
+        return;
+    }
+
     if(from_string(pin_name) && as_output()) {
+        if(GpioWave::allocate(get_gpioport())) {
+            // output by DMA, no ticker needed
+            use_wave = true;
+            return;
+        }
+
         taskENTER_CRITICAL();
         instances.insert(this);
         taskEXIT_CRITICAL();
@@ -37,20 +59,42 @@ SigmaDeltaPwm::SigmaDeltaPwm(const char *pin_name)
 
 SigmaDeltaPwm::~SigmaDeltaPwm()
 {
+    if(use_wave) {
+        GpioWave::set(get_gpioport(), get_gpiopin(), 0, is_inverting());
+    }
+    delete hwpwm;
     taskENTER_CRITICAL();
     instances.erase(this);
     taskEXIT_CRITICAL();
 }
 
+bool SigmaDeltaPwm::connected() const
+{
+    return hwpwm != nullptr ? hwpwm->is_valid() : Pin::connected();
+}
+
+std::string SigmaDeltaPwm::to_string() const
+{
+    return hwpwm != nullptr ? hwpwm->to_string() : Pin::to_string();
+}
+
 void SigmaDeltaPwm::pwm(int new_pwm)
 {
-    _pwm = confine(new_pwm, 0, _max);
+    new_pwm = confine(new_pwm, 0, _max);
+    // the waveform only needs to be recalculated when it changes
+    if(new_pwm == _pwm) return;
+    _pwm = new_pwm;
+    if(use_wave) {
+        GpioWave::set(get_gpioport(), get_gpiopin(), _pwm == PID_PWM_MAX - 1 ? GpioWave::num_slots : _pwm, is_inverting());
+    } else if(hwpwm != nullptr) {
+        hwpwm->set(_pwm / (float)(PID_PWM_MAX - 1));
+    }
 }
 
 void SigmaDeltaPwm::max_pwm(int new_max)
 {
     _max = confine(new_max, 0, PID_PWM_MAX - 1);
-    _pwm = confine(   _pwm, 0, _max);
+    if(_pwm > _max) pwm(_max);
 }
 
 int SigmaDeltaPwm::max_pwm()
@@ -61,7 +105,13 @@ int SigmaDeltaPwm::max_pwm()
 void SigmaDeltaPwm::set(bool value)
 {
     _pwm = -1;
-    Pin::set(value);
+    if(use_wave) {
+        GpioWave::set(get_gpioport(), get_gpiopin(), value ? GpioWave::num_slots : 0, is_inverting());
+    } else if(hwpwm != nullptr) {
+        hwpwm->set(value ? 1.0F : 0.0F);
+    } else {
+        Pin::set(value);
+    }
 }
 
 // static
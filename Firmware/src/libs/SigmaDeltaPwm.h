@@ -3,12 +3,22 @@
 #include "Pin.h"
 
 #include <set>
+#include <string>
 
+class Pwm;
+
+// Modulates a pin with a sigma delta pattern, the pattern is output by DMA from a waveform buffer (see GpioWave)
+// and is only recalculated when the pwm changes. If no DMA stream is left for the pin's port it falls back
+// to a 2kHz FastTicker toggling the pin.
+// If the pin is a hardware PWM channel (eg PWM1_1) the hardware timer is used instead.
 class SigmaDeltaPwm : public Pin {
 public:
     SigmaDeltaPwm(const char *);
     virtual ~SigmaDeltaPwm();
 
+    bool     connected() const;
+    std::string to_string() const;
+
     void     max_pwm(int);
     int      max_pwm(void);
 
@@ -22,6 +32,8 @@ private:
     void on_tick(void);
 
     static int fastticker;
+    Pwm *hwpwm{nullptr};
+    bool use_wave{false};
     int  _max;
     int  _pwm;
     int  _sd_accumulator;
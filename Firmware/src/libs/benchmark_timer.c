@@ -17,8 +17,11 @@ void benchmark_timer_init(void)
         CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;         //enable debug tracer
 #endif
         //ITM->LAR = 0xC5ACCE55;                                        //unlock access to dwt, if so equip'd
-        DWT->CTRL |= ITM_TCR_ITMENA_Msk;                        //enable dwt cycle count
-        DWT->CYCCNT = 0; // reset the counter
+        // the counter is also used for the run time stats so it is only reset if it is not already running
+        if((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0) {
+                DWT->CYCCNT = 0; // reset the counter
+                DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;            //enable dwt cycle count
+        }
 }
 
 /* Returns number of ticks per second of the benchmark_timer timer */
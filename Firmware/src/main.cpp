@@ -567,6 +567,9 @@ static void smoothie_startup(void *)
     startup_fncs.clear();
     startup_fncs.shrink_to_fit();
 
+    // all the handlers have been added now so build the dispatch tables
+    THEDISPATCHER->freeze();
+
     struct mallinfo mi = mallinfo();
     printf("DEBUG: Initial: free malloc memory= %d, free sbrk memory= %d, Total free= %d\n", mi.fordblks, xPortGetFreeHeapSize() - mi.fordblks, xPortGetFreeHeapSize());
 
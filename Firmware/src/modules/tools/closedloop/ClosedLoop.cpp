@@ -0,0 +1,275 @@
+/*
+    Pairs a stepper with a quadrature encoder on its axis and checks the following error (how far the position
+    the motor was stepped to is from where the encoder says the axis actually is) at a fixed rate.
+    A motor that stalls or loses steps is then either halted, reported, or stepped back into position once it has stopped.
+
+    The encoders are the H/W timer quadrature encoders, see QuadEncoder.h for which pins they use.
+*/
+
+#include "ClosedLoop.h"
+#include "ConfigReader.h"
+#include "SlowTicker.h"
+#include "Consoles.h"
+#include "Dispatcher.h"
+#include "OutputStream.h"
+#include "Robot.h"
+#include "StepperMotor.h"
+#include "Conveyor.h"
+#include "QuadEncoder.h"
+#include "Lathe.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#define enable_key "enable"
+#define axis_key "axis"
+#define encoder_key "encoder"
+#define lines_per_mm_key "lines_per_mm"
+#define max_error_key "max_error"
+#define action_key "action"
+#define check_frequency_key "check_frequency"
+
+REGISTER_MODULE(ClosedLoop, ClosedLoop::create)
+
+std::vector<ClosedLoop*> ClosedLoop::instances;
+
+bool ClosedLoop::create(ConfigReader& cr)
+{
+    printf("DEBUG: configure closed loop\n");
+
+    ConfigReader::sub_section_map_t ssmap;
+    if(!cr.get_sub_sections("closed loop", ssmap)) {
+        printf("INFO: configure-closed-loop: no closed loop section found\n");
+        return false;
+    }
+
+    for(auto& i : ssmap) {
+        // foreach encoder
+        std::string name = i.first;
+        auto& m = i.second;
+        if(cr.get_bool(m, enable_key, false)) {
+            ClosedLoop *t = new ClosedLoop(name.c_str());
+            if(t->configure(cr, m)) {
+                instances.push_back(t);
+            } else {
+                printf("WARNING: failed to configure closed loop %s\n", name.c_str());
+                delete t;
+            }
+        }
+    }
+
+    if(instances.empty()) return false;
+
+    using std::placeholders::_1;
+    using std::placeholders::_2;
+    THEDISPATCHER->add_handler("closedloop", std::bind(&ClosedLoop::closedloop_cmd, _1, _2));
+
+    printf("INFO: %d closed loop axis loaded\n", (int)instances.size());
+    return true;
+}
+
+ClosedLoop::ClosedLoop(const char *name) : Module("closedloop", name)
+{
+    error = 0;
+    peak_error = 0;
+    checks = 0;
+    corrections = 0;
+    faults = 0;
+    reported = false;
+    resync_pending = false;
+}
+
+bool ClosedLoop::configure(ConfigReader& cr, ConfigReader::section_map_t& m)
+{
+    const char *name = get_instance_name();
+
+    int a = cr.get_int(m, axis_key, -1);
+    if(a < 0 || a >= Robot::getInstance()->get_number_registered_motors()) {
+        printf("ERROR: configure-closed-loop %s: axis must be configured and be a registered motor\n", name);
+        return false;
+    }
+    axis = a;
+    motor = Robot::getInstance()->actuators[axis];
+
+    int e = cr.get_int(m, encoder_key, 0);
+    if(e < 0 || e >= NUM_QUADRATURE_ENCODERS) {
+        printf("ERROR: configure-closed-loop %s: encoder must be 0 - %d\n", name, NUM_QUADRATURE_ENCODERS - 1);
+        return false;
+    }
+    encoder = e;
+
+    // encoder lines per mm of travel, negative if it counts the opposite way to the motor
+    float lines_per_mm = cr.get_float(m, lines_per_mm_key, 0);
+    if(lines_per_mm == 0) {
+        printf("ERROR: configure-closed-loop %s: %s must be set\n", name, lines_per_mm_key);
+        return false;
+    }
+    steps_per_count = motor->get_steps_per_mm() / (lines_per_mm * get_quadrature_encoder_div());
+
+    float max_error_mm = cr.get_float(m, max_error_key, 0.1F);
+    max_error = lroundf(max_error_mm * motor->get_steps_per_mm());
+    // the encoder can only resolve one count
+    int32_t resolution = lroundf(ceilf(fabsf(steps_per_count)));
+    if(max_error <= resolution) {
+        printf("ERROR: configure-closed-loop %s: %s is less than the encoder resolution of %1.4f mm\n", name, max_error_key, resolution / motor->get_steps_per_mm());
+        return false;
+    }
+
+    std::string act = cr.get_string(m, action_key, "halt");
+    if(act == "halt") {
+        action = HALT;
+    } else if(act == "report") {
+        action = REPORT;
+    } else if(act == "correct") {
+        // correcting steps the motor, which would also step the slave
+        if(motor->has_slave()) {
+            printf("ERROR: configure-closed-loop %s: correct can not be used on an axis with a slave\n", name);
+            return false;
+        }
+        action = CORRECT;
+    } else {
+        printf("ERROR: configure-closed-loop %s: action must be one of halt, report or correct\n", name);
+        return false;
+    }
+
+    if(!setup_quadrature_encoder(encoder)) {
+        printf("ERROR: configure-closed-loop %s: unable to setup quadrature encoder %d\n", name, encoder);
+        return false;
+    }
+
+    encoder_pos = 0;
+    last_cnt = read_quadrature_encoder(encoder);
+    resync();
+
+    // at 100Hz the 16 bit counter can not wrap between checks below 3 million counts per second
+    uint32_t freq = cr.get_int(m, check_frequency_key, 100);
+    SlowTicker::getInstance()->attach(freq, std::bind(&ClosedLoop::check, this));
+
+    printf("INFO: configure-closed-loop %s: axis %d, encoder %d, %1.4f steps/count, max error %ld steps, action %s\n",
+           name, axis, encoder, steps_per_count, max_error, act.c_str());
+
+    return true;
+}
+
+void ClosedLoop::on_halt(bool flg)
+{
+    // the position is lost when halted so start again from wherever it is when the halt is cleared
+    if(!flg) resync_pending = true;
+}
+
+// the step count and encoder agree from here on
+void ClosedLoop::resync()
+{
+    // a correction that has not been made yet is for the old position
+    motor->cancel_correction();
+    step_ref = motor->get_step_count();
+    encoder_ref = encoder_pos;
+    resync_pending = false;
+}
+
+int32_t ClosedLoop::accumulate_counts(int32_t pos, uint32_t& last, uint32_t cnt)
+{
+    pos += (int16_t)(cnt - last);
+    last = cnt;
+    return pos;
+}
+
+int32_t ClosedLoop::following_error(int32_t steps, int32_t counts, float steps_per_count)
+{
+    int32_t moved = lround(counts * (double)steps_per_count);
+    return steps - moved;
+}
+
+bool ClosedLoop::needs_correction(int32_t err, float steps_per_count)
+{
+    return std::abs(err) >= std::lround(ceilf(fabsf(steps_per_count)));
+}
+
+int32_t ClosedLoop::get_error()
+{
+    return following_error(motor->get_step_count() - step_ref, encoder_pos - encoder_ref, steps_per_count);
+}
+
+// called at check_frequency from the timer task
+void ClosedLoop::check()
+{
+    // accumulate the 16 bit counter so it does not wrap
+    encoder_pos = accumulate_counts(encoder_pos, last_cnt, read_quadrature_encoder(encoder));
+
+    if(Module::is_halted()) return;
+
+    // a disabled motor can be moved by hand
+    if(resync_pending || !motor->is_enabled()) {
+        resync();
+        return;
+    }
+
+    error = get_error();
+    ++checks;
+    int32_t e = std::abs(error);
+    if(e > std::abs(peak_error)) peak_error = error;
+
+    if(e > max_error) {
+        if(action == REPORT) {
+            if(!reported) {
+                char buf[80];
+                snprintf(buf, sizeof(buf), "WARNING: %s following error %1.3f mm\n", get_instance_name(), error / motor->get_steps_per_mm());
+                print_to_all_consoles(buf);
+                reported = true;
+                ++faults;
+            }
+            return;
+        }
+
+        // a correct action will not try to correct an error this big, the path it took is already wrong
+        char buf[80];
+        snprintf(buf, sizeof(buf), "ERROR: %s following error %1.3f mm, halting\n", get_instance_name(), error / motor->get_steps_per_mm());
+        print_to_all_consoles(buf);
+        ++faults;
+        broadcast_halt(true);
+        return;
+    }
+
+    reported = false;
+
+    // step back towards where the motor should be once it has stopped, one step per check so it can follow
+    if(action == CORRECT && needs_correction(error, steps_per_count) && !motor->is_moving() && Conveyor::getInstance()->is_idle() && !is_lathe_follower()) {
+        correct(error);
+    }
+}
+
+// the step ticker makes the step so it can not change the direction or step count under a step it is making
+void ClosedLoop::correct(int32_t err)
+{
+    // a positive error means it needs to move in the positive direction which is dir false
+    if(motor->request_correction(err < 0)) ++corrections;
+}
+
+// the lathe steps its followers from the step ticker without a block, so they look like they have stopped
+bool ClosedLoop::is_lathe_follower() const
+{
+    Lathe *lathe = static_cast<Lathe *>(Module::lookup("Lathe"));
+    return lathe != nullptr && lathe->is_following(motor);
+}
+
+#define HELP(m) if(params == "-h") { os.printf("%s\n", m); return true; }
+bool ClosedLoop::closedloop_cmd(std::string& params, OutputStream& os)
+{
+    HELP("closedloop [-r] - show following error statistics, -r resets them");
+
+    bool reset = params.find("-r") != std::string::npos;
+    for(auto i : instances) {
+        float spmm = i->motor->get_steps_per_mm();
+        os.printf("%s: axis %d, encoder %d, error: %1.4f mm, peak: %1.4f mm, checks: %lu, corrections: %lu, faults: %lu\n",
+                  i->get_instance_name(), i->axis, i->encoder, i->error / spmm, i->peak_error / spmm, i->checks, i->corrections, i->faults);
+        if(reset) {
+            i->peak_error = 0;
+            i->checks = 0;
+            i->corrections = 0;
+            i->faults = 0;
+        }
+    }
+
+    os.set_no_response();
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Module.h"
+#include "ConfigReader.h"
+
+#include <string>
+#include <vector>
+
+class OutputStream;
+class StepperMotor;
+
+// Checks the position of a stepper against a quadrature encoder on the axis, so lost steps do not go unnoticed
+class ClosedLoop : public Module {
+    public:
+        ClosedLoop(const char *name);
+        static bool create(ConfigReader& cr);
+        bool configure(ConfigReader& cr, ConfigReader::section_map_t& m);
+        virtual void on_halt(bool flg);
+
+        // adds the change in a 16 bit H/W counter since last to pos, so pos does not wrap
+        static int32_t accumulate_counts(int32_t pos, uint32_t& last, uint32_t cnt);
+        // how far in steps the motor is behind where it has been stepped to, given the steps and encoder counts moved
+        static int32_t following_error(int32_t steps, int32_t counts, float steps_per_count);
+        // an error smaller than one encoder count can not be corrected
+        static bool needs_correction(int32_t err, float steps_per_count);
+
+    private:
+        enum ACTION_T { HALT, REPORT, CORRECT };
+
+        static bool closedloop_cmd(std::string& params, OutputStream& os);
+        void check();
+        void resync();
+        int32_t get_error();
+        void correct(int32_t err);
+        bool is_lathe_follower() const;
+
+        static std::vector<ClosedLoop*> instances;
+
+        StepperMotor *motor;
+        float steps_per_count;       // steps the motor makes for each encoder count, negative if the encoder counts the other way
+        int32_t max_error;           // in steps
+        int32_t step_ref;            // step count and encoder position when they were last known to agree
+        int32_t encoder_ref;
+        int32_t encoder_pos;         // accumulated encoder counts
+        uint32_t last_cnt;
+
+        // statistics since last reset
+        int32_t error;
+        int32_t peak_error;
+        uint32_t checks;
+        uint32_t corrections;
+        uint32_t faults;
+
+        uint8_t encoder;
+        uint8_t axis;
+        ACTION_T action;
+        bool reported;
+        volatile bool resync_pending;
+};
@@ -46,10 +46,14 @@
 #define max_travel_key "max_travel"
 #define retract_key "retract"
 #define limit_key "limit_enable"
+#define stallguard_threshold_key "stallguard_threshold"
 
 #define STEPPER Robot::getInstance()->actuators
 #define STEPS_PER_MM(a) (STEPPER[a]->get_steps_per_mm())
 
+// StallGuard is not valid while the motor accelerates so it is ignored for this long after the motor starts to move
+#define STALLGUARD_BLANK_MS 200
+
 
 // Homing States
 enum STATES {
@@ -141,7 +145,17 @@ bool Endstops::load_endstops(ConfigReader& cr)
         if(!cr.get_bool(mm, "enable", false)) continue;
 
         endstop_info_t *pin_info = new endstop_info_t;
-        if(!pin_info->pin.from_string(cr.get_string(mm, pin_key, "nc")) || !pin_info->pin.as_input() || !pin_info->pin.connected()) {
+        pin_info->stallguard = cr.get_int(mm, stallguard_threshold_key, 0);
+        pin_info->moving_ms = 0;
+        if(pin_info->stallguard > 0) {
+            // sensorless, the motor driver detects when the axis runs into the end, so there is no pin
+#ifndef DRIVER_TMC
+            printf("ERROR: configure-endstop: %s needs TMC drivers for %s\n", stallguard_threshold_key, name.c_str());
+            delete pin_info;
+            continue;
+#endif
+
+        } else if(!pin_info->pin.from_string(cr.get_string(mm, pin_key, "nc")) || !pin_info->pin.as_input() || !pin_info->pin.connected()) {
             // no pin defined try next
             printf("ERROR: configure-endstop: no pin defined or illegal pin for %s\n", name.c_str());
             delete pin_info;
@@ -178,6 +192,11 @@ bool Endstops::load_endstops(ConfigReader& cr)
 
         // are limits enabled
         pin_info->limit_enable = cr.get_bool(mm, limit_key, false);
+        if(pin_info->limit_enable && pin_info->stallguard > 0) {
+            // StallGuard is only read while homing
+            printf("WARNING: configure-endstop: %s can not be used as a limit for %s\n", stallguard_threshold_key, name.c_str());
+            pin_info->limit_enable = false;
+        }
         limit_enabled |= pin_info->limit_enable;
 
         // enter into endstop array
@@ -357,7 +376,7 @@ void Endstops::read_endstops()
 
         if(STEPPER[m]->is_moving()) {
             // if it is moving then we check the associated endstop, and debounce it
-            if(e.pin_info->pin.get()) {
+            if(e.pin_info->stallguard > 0 ? stalled(e.pin_info) : e.pin_info->pin.get()) {
                 if(e.pin_info->debounce < debounce_ms) {
                     e.pin_info->debounce += 10; // as each iteration is 10ms
 
@@ -378,12 +397,34 @@ void Endstops::read_endstops()
                 // The endstop was not hit yet
                 e.pin_info->debounce = 0;
             }
+
+        } else {
+            e.pin_info->moving_ms = 0;
         }
     }
 
     return;
 }
 
+// a sensorless endstop is hit when the StallGuard reading drops below the threshold as the axis runs into the end
+bool Endstops::stalled(endstop_info_t *e)
+{
+#ifdef DRIVER_TMC
+    StepperMotor *m = STEPPER[e->axis_index];
+    int sg = m->get_stallguard();
+    m->request_stallguard(); // read in the background for next time
+
+    if(e->moving_ms < STALLGUARD_BLANK_MS) {
+        e->moving_ms += 10;
+        return false;
+    }
+
+    return sg >= 0 && sg < e->stallguard;
+#else
+    return false;
+#endif
+}
+
 // this is called from read endstops every 10ms if limits are enabled
 void Endstops::check_limits()
 {
@@ -548,6 +589,7 @@ void Endstops::home(axis_bitmap_t a)
     // reset debounce counts for all endstops
     for(auto& e : endstops) {
         e->debounce = 0;
+        e->moving_ms = 0;
         e->triggered = false;
     }
 
@@ -655,6 +697,7 @@ void Endstops::home(axis_bitmap_t a)
     Conveyor::getInstance()->wait_for_idle();
 
     // Start moving the axes towards the endstops slowly
+    for(auto& e : endstops) e->moving_ms = 0;
     this->status = MOVING_TO_ENDSTOP_SLOW;
     for (auto& i : homing_axis) {
         int c = i.axis_index;
@@ -1026,7 +1069,11 @@ bool Endstops::handle_mcode(GCode& gcode, OutputStream& os)
                 std::string str(1, p->axis);
                 if(p->home) str.append(":H");
                 if(p->limit_enable) str.append(":L");
-                os.printf("(%s)%s ", str.c_str(), p->pin.to_string().c_str());
+                if(p->stallguard > 0) {
+                    os.printf("(%s)stallguard:%d ", str.c_str(), p->stallguard);
+                } else {
+                    os.printf("(%s)%s ", str.c_str(), p->pin.to_string().c_str());
+                }
             }
         }
         break;
@@ -1294,6 +1341,11 @@ bool Endstops::move_slaved_axis(uint8_t paxis, bool adjust, OutputStream& os)
             return false;
         }
 
+        if(e->stallguard > 0) {
+            os.printf("error: the endstop %d must have a pin, it can not use StallGuard\n", sa->get_motor_id());
+            return false;
+        }
+
         es= e;
     }
 
@@ -50,6 +50,8 @@ class Endstops : public Module
         // per endstop settings
         using endstop_info_t = struct {
             Pin pin;
+            uint16_t stallguard;  // sensorless when set, the StallGuard reading below which the endstop is hit
+            uint16_t moving_ms;   // how long the motor has been moving, StallGuard is ignored until it is up to speed
             struct {
                 uint16_t debounce:16;
                 char axis:8; // one of XYZABC
@@ -77,6 +79,8 @@ class Endstops : public Module
             };
         };
 
+        bool stalled(endstop_info_t *e);
+
         // array of endstops
         std::vector<endstop_info_t *> endstops;
 
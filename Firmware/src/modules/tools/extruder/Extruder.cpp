@@ -158,8 +158,9 @@ void Extruder::select()
 {
     selected = true;
     stepper_motor->set_selected(true);
-    // set the function pointer to return the current scaling
+    // set the function pointers to return the current scaling and rate limit
     Robot::getInstance()->get_e_scale_fnc = std::bind(&Extruder::get_e_scale, this);
+    Robot::getInstance()->get_e_rate_fnc = std::bind(&Extruder::get_rate, this, std::placeholders::_1, std::placeholders::_2);
 }
 
 void Extruder::deselect()
@@ -210,6 +211,11 @@ bool Extruder::request(const char *key, void *value)
     if(strcmp(key, "restore_state") == 0) {
         restore_position();
         this->selected = this->saved_selected;
+        if(this->selected) {
+            // another extruder may have been selected since the state was saved
+            Robot::getInstance()->get_e_scale_fnc = std::bind(&Extruder::get_e_scale, this);
+            Robot::getInstance()->get_e_rate_fnc = std::bind(&Extruder::get_rate, this, std::placeholders::_1, std::placeholders::_2);
+        }
         return true;
     }
 
@@ -232,19 +238,18 @@ bool Extruder::request(const char *key, void *value)
         return true;
     }
 
-    // handle extrude rates request from robot
-    if(strcmp(key, "get_rate") == 0 && this->selected) {
-        // disabled extruders do not reply NOTE only one enabled extruder supported
-        float *d = static_cast<float *>(value);
-        float delta = d[0]; // the E passed in on Gcode is the delta volume in mm³
-        float isecs = d[1]; // inverted secs
+    return false;
+}
 
-        // check against maximum speeds and return rate modifier
-        d[1] = check_max_speeds(delta, isecs);
-        return true;
-    }
+// called by robot for each move with an E delta, to check extrude rates
+// delta is the E passed in on Gcode, the delta volume in mm³, isecs is inverted secs
+float Extruder::get_rate(float delta, float isecs)
+{
+    // disabled extruders do not limit NOTE only one enabled extruder supported
+    if(!this->selected) return 1.0F;
 
-    return false;
+    // check against maximum speeds and return rate modifier
+    return check_max_speeds(delta, isecs);
 }
 
 void Extruder::save_position()
@@ -21,6 +21,7 @@ public:
     void select();
     void deselect();
     float get_e_scale(void) const { return volumetric_multiplier * extruder_multiplier; }
+    float get_rate(float delta, float isecs);
 
     bool request(const char *key, void *value);
     // using pad_extruder_t = struct pad_extruder {
@@ -10,6 +10,7 @@
 #include "QuadEncoder.h"
 #include "Robot.h"
 #include "StepperMotor.h"
+#include "Conveyor.h"
 #include "main.h"
 #include "OutputStream.h"
 #include "Pin.h"
@@ -24,6 +25,14 @@
 #define enable_key "enable"
 #define ppr_key "encoder_ppr"
 #define index_pin_key "index_pin"
+#define acceleration_key "acceleration"
+
+// the K value is held to this many fractions of a mm when converted to the gear ratio
+#define GEAR_SCALE 10000
+// 1.0 in the fixed point velocity and acceleration
+#define FP_ONE (1LL << 32)
+// how often in ticks the speed of the target is sampled, a power of 2
+#define SAMPLE_SHIFT 8
 
 REGISTER_MODULE(Lathe, Lathe::create)
 
@@ -80,27 +89,22 @@ bool Lathe::configure(ConfigReader& cr)
     ppr = cr.get_float(m, ppr_key, 1000);
     printf("INFO: configure-lathe: encoder ppr %f\n", ppr);
 
-    // Actuator that is synchronized with the spindle
+    // acceleration of the axes following the spindle, defaults to the acceleration of each axis
+    acceleration = cr.get_float(m, acceleration_key, 0);
+
     // on a Lathe Z is the leadscrew for the carriage, X is the cross carriage
-    // TODO needs to be configurable
-    stepper_motor = Robot::getInstance()->actuators[Z_AXIS];
-    motor_id = stepper_motor->get_motor_id();
-    if(motor_id != Z_AXIS) {
-        // error registering, maybe too many
-        printf("ERROR: configure-lathe: unable to get stepper motor\n");
+    if(Robot::getInstance()->get_number_registered_motors() <= Z_AXIS) {
+        printf("ERROR: configure-lathe: needs X, Y and Z actuators\n");
         return false;
     }
 
-    // what is the step accuracy in mm to 4 decimal places rounded up
-    delta_mm = roundf((1.0F / stepper_motor->get_steps_per_mm()) * 10000.0F) / 10000.0F;
-
     // register gcodes and mcodes
     using std::placeholders::_1;
     using std::placeholders::_2;
 
-    benchmark_timer_init();
-
     Dispatcher::getInstance()->add_handler(Dispatcher::GCODE_HANDLER, 33, std::bind(&Lathe::handle_gcode, this, _1, _2));
+    Dispatcher::getInstance()->add_handler(Dispatcher::GCODE_HANDLER, 76, std::bind(&Lathe::handle_gcode, this, _1, _2));
+    Dispatcher::getInstance()->add_handler(Dispatcher::GCODE_HANDLER, 84, std::bind(&Lathe::handle_gcode, this, _1, _2));
     Dispatcher::getInstance()->add_handler("rpm", std::bind( &Lathe::rpm_cmd, this, _1, _2) );
 
     SlowTicker::getInstance()->attach(10, std::bind(&Lathe::handle_rpm, this));
@@ -122,6 +126,16 @@ bool Lathe::handle_gcode(GCode& gcode, OutputStream& os)
 {
     int code = gcode.get_code();
 
+    if(code == 76) {
+        thread_cycle(gcode, os);
+        return true;
+    }
+
+    if(code == 84) {
+        tap_cycle(gcode, os);
+        return true;
+    }
+
     if(code == 33) {
         if(gcode.has_arg('K')) {
             dpr = gcode.get_arg('K'); // distance per revolution
@@ -130,95 +144,59 @@ bool Lathe::handle_gcode(GCode& gcode, OutputStream& os)
                 return true;
             }
 
-            if(dpr < 0) {
-                reversed = true;
-                dpr = -dpr;
-            } else {
-                reversed = false;
-            }
+            reversed = dpr < 0;
 
         } else {
             gcode.set_error("K argument required");
             return true;
         }
 
-        if(gcode.has_arg('Z')) {
+        if(gcode.has_arg('X') || gcode.has_arg('Y') || gcode.has_arg('Z')) {
             if(rpm == 0) {
                 gcode.set_error("Spindle must be running");
                 return true;
             }
 
-            float distance = gcode.get_arg('Z'); // distance to move
-            end_pos = stepper_motor->get_current_position() + distance;
-
-            if(distance < 0) {
-                reversed = true;
-                distance = -distance;
-            } else {
-                reversed = false;
+            // K is the distance per rev along Z (or the axis given if Z is not), other axes are geared to move in proportion
+            // so tapers are cut by giving X and Z. A negative K is for when the spindle runs in reverse.
+            float distance[3];
+            int ref = -1;
+            for (int i = Z_AXIS; i >= X_AXIS; --i) {
+                distance[i] = gcode.has_arg('X' + i) ? gcode.get_arg('X' + i) : 0;
+                if(ref < 0 && distance[i] != 0) ref = i;
             }
-
-            // if we have an index_pin then we wait to start by synchronizing to it
-            // NOTE the spindle and encoder must be geared 1:1 (or multiple spindle turns per 1 encoder turn)
-            // for this to have the desired effect, ie always start at the same place.
-            if(index_pin != nullptr) {
-                uint32_t curindex = index_pulse;
-                while(curindex == index_pulse) {
-                    // wait for index pulse to be hit
-                    // TODO may need to do safe_sleep here but that may take too long
-                    if(Module::is_halted() || rpm == 0) return true;
-                }
+            if(ref < 0) {
+                // nothing to move
+                return true;
             }
 
-            running = true;
-
-            // We have to wait for this to complete
-            while(running && !Module::is_halted()) {
-                safe_sleep(100);
-                // update DROs occasionally
-                Robot::getInstance()->reset_position_from_current_actuator_position();
-                if(rpm == 0) {
-                    os.printf("error: Spindle stopped running\n");
-                    broadcast_halt(true);
-                    break;
+            Conveyor::getInstance()->wait_for_idle();
+
+            n_followers = 0;
+            for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+                if(distance[i] == 0) continue;
+                if(!setup_follower(i, dpr * fabsf(distance[i] / distance[ref]), distance[i])) {
+                    gcode.set_error("Unable to gear axis to the spindle");
+                    return true;
                 }
             }
 
-            running = false;
-
-            // reset the position based on current actuator position
-            Robot::getInstance()->reset_position_from_current_actuator_position();
+            end_pos = Robot::getInstance()->actuators[ref]->get_current_position() + distance[ref];
 
-        } else if(gcode.has_arg('X') || gcode.has_arg('Y')) {
-            gcode.set_error("Only (Lathe) Z axis currently supported");
+            // if we have an index_pin then we start synchronized to it
+            run_pass(os, index_pin != nullptr, true);
 
         } else {
-            // no Z arg means manual mode where the half nut must be engaged and disengaged, control Y will stop it
-            // K sets the mm per revolution
+            // no axis args means manual mode where the half nut must be engaged and disengaged, control Y will stop it
+            // K sets the mm per revolution, negative moves the carriage the other way
             end_pos = NAN;
-            target_position = stepper_motor->get_current_position();
-            if(!stepper_motor->is_enabled()) stepper_motor->enable(true);
-            current_direction = stepper_motor->get_direction();
-
-            // have stepticker call us
-            StepTicker::getInstance()->callback_fnc = std::bind(&Lathe::update_position, this);
-            running = true;
-
-            while(!os.get_stop_request() && !Module::is_halted()) {
-                safe_sleep(100);
-                // update DROs occasionally
-                Robot::getInstance()->reset_position_from_current_actuator_position();
-                //printf("%f %ld\n", target_position, read_quadrature_encoder());
-                // if(rpm == 0) {
-                //     // also stop if spindle stops
-                //     break;
-                // }
+            n_followers = 0;
+            if(!setup_follower(Z_AXIS, dpr, NAN)) {
+                gcode.set_error("Unable to gear axis to the spindle");
+                return true;
             }
-            running = false;
 
-            StepTicker::getInstance()->callback_fnc = nullptr;
-
-            os.set_stop_request(false);
+            run_pass(os, false, false);
             safe_sleep(100);
             // reset the position based on current actuator position
             Robot::getInstance()->reset_position_from_current_actuator_position();
@@ -231,10 +209,244 @@ bool Lathe::handle_gcode(GCode& gcode, OutputStream& os)
     return false;
 }
 
+// run the followers that have been setup until they are done, or until stopped if they are not bounded.
+// If sync is set they are engaged by the index pulse, so every pass starts at the same angle of the spindle.
+// returns false if it was aborted
+bool Lathe::run_pass(OutputStream& os, bool sync, bool stop_if_spindle_stops)
+{
+    // we start counting from here and stepticker calls us
+    last_cnt = read_quadrature_encoder();
+    running = !sync;
+    armed = sync;
+    StepTicker::getInstance()->callback_fnc = std::bind(&Lathe::update_position, this);
+
+    bool ok = true;
+    while(armed) {
+        // wait for the index pulse to start us
+        safe_sleep(1);
+        if(Module::is_halted() || os.get_stop_request() || rpm == 0) {
+            ok = false;
+            break;
+        }
+    }
+
+    // We have to wait for this to complete
+    while(ok && running) {
+        safe_sleep(100);
+        if(Module::is_halted() || os.get_stop_request()) {
+            ok = false;
+            break;
+        }
+        // update DROs occasionally
+        Robot::getInstance()->reset_position_from_current_actuator_position();
+        if(stop_if_spindle_stops && rpm == 0) {
+            os.printf("error: Spindle stopped running\n");
+            broadcast_halt(true);
+            ok = false;
+            break;
+        }
+    }
+
+    armed = false;
+    running = false;
+    StepTicker::getInstance()->callback_fnc = nullptr;
+    os.set_stop_request(false);
+
+    // reset the position based on current actuator position
+    Robot::getInstance()->reset_position_from_current_actuator_position();
+
+    return ok;
+}
+
+// get the current position in the work coordinate system once all moves are done
+static void get_wcs_position(float& x, float& z)
+{
+    Conveyor::getInstance()->wait_for_idle();
+    float pos[3];
+    Robot::getInstance()->get_axis_position(pos);
+    Robot::wcs_t wpos = Robot::getInstance()->mcs2wcs(pos);
+    x = std::get<X_AXIS>(wpos);
+    z = std::get<Z_AXIS>(wpos);
+}
+
+/*
+ G76 threading cycle as in linuxcnc, starts from the drive line which is the current X and Z position
+    P - pitch in mm per rev, negative if the spindle is running in reverse
+    Z - end of the thread
+    I - offset of the thread crest from the drive line, negative for external threads, positive for internal threads
+    J - depth of the first cut
+    K - full depth of the thread
+    R - depth degression, each pass N is cut to J * N^(1/R), default 1 takes the same depth each pass
+    Q - compound infeed angle in degrees, each pass is shifted back along Z by its depth * tan(Q), default 0
+    H - number of spring passes at full depth, default 0
+ Each pass is engaged at the index pulse so the passes all follow the same groove.
+*/
+void Lathe::thread_cycle(GCode& gcode, OutputStream& os)
+{
+    if(!gcode.has_arg('P') || !gcode.has_arg('Z') || !gcode.has_arg('I') || !gcode.has_arg('J') || !gcode.has_arg('K')) {
+        gcode.set_error("P, Z, I, J and K arguments required");
+        return;
+    }
+
+    float pitch = gcode.get_arg('P');
+    float z_end = gcode.get_arg('Z');
+    float crest = gcode.get_arg('I');
+    float first_depth = gcode.get_arg('J');
+    float full_depth = gcode.get_arg('K');
+    float degression = gcode.has_arg('R') ? gcode.get_arg('R') : 1.0F;
+    float angle = gcode.has_arg('Q') ? gcode.get_arg('Q') : 0;
+    int spring_passes = gcode.has_arg('H') ? gcode.get_int_arg('H') : 0;
+
+    if(pitch == 0 || first_depth <= 0 || full_depth < first_depth || degression < 1.0F) {
+        gcode.set_error("Bad threading arguments");
+        return;
+    }
+    if(index_pin == nullptr) {
+        gcode.set_error("An index pin is needed to keep the passes in phase");
+        return;
+    }
+    if(!Robot::getInstance()->absolute_mode) {
+        gcode.set_error("Relative mode not supported");
+        return;
+    }
+    if(rpm == 0) {
+        gcode.set_error("Spindle must be running");
+        return;
+    }
+
+    float x0, z0;
+    get_wcs_position(x0, z0);
+
+    float length = z_end - z0;
+    if(length == 0) {
+        gcode.set_error("Z must be different from the current position");
+        return;
+    }
+
+    float cut_dir = crest > 0 ? 1.0F : -1.0F;
+    float back = length > 0 ? -1.0F : 1.0F;
+    float tan_angle = tanf(angle * (float)M_PI / 180.0F);
+
+    dpr = pitch;
+    reversed = pitch < 0;
+    end_pos = NAN;
+
+    OutputStream nullos;
+    int pass = 1;
+    int spring = 0;
+    while(true) {
+        float depth = first_depth * powf(pass, 1.0F / degression);
+        if(depth >= full_depth) {
+            // full depth then the spring passes
+            depth = full_depth;
+            if(spring++ > spring_passes) break;
+        }
+
+        float z_start = z0 + back * depth * tan_angle;
+        float x_cut = x0 + crest + cut_dir * depth;
+
+        os.printf("// G76 pass %d depth %1.4f\n", pass, depth);
+
+        // move to the start of the pass at the depth of cut
+        THEDISPATCHER->dispatch(nullos, 'G', 0, 'Z', z_start, 0);
+        THEDISPATCHER->dispatch(nullos, 'G', 0, 'X', x_cut, 0);
+        Conveyor::getInstance()->wait_for_idle();
+        if(Module::is_halted()) return;
+
+        n_followers = 0;
+        if(!setup_follower(Z_AXIS, pitch, length)) {
+            gcode.set_error("Unable to gear axis to the spindle");
+            return;
+        }
+        end_pos = Robot::getInstance()->actuators[Z_AXIS]->get_current_position() + length;
+
+        if(!run_pass(os, true, true)) {
+            // leave the tool where it is, it is in the thread
+            os.printf("// G76 aborted\n");
+            return;
+        }
+
+        // back out to the drive line
+        THEDISPATCHER->dispatch(nullos, 'G', 0, 'X', x0, 0);
+        ++pass;
+    }
+
+    // back to where we started
+    THEDISPATCHER->dispatch(nullos, 'G', 0, 'Z', z0, 0);
+    Conveyor::getInstance()->wait_for_idle();
+    end_pos = NAN;
+}
+
+/*
+ G84 tapping cycle geared to the spindle from the current position
+    Z - bottom of the hole
+    K - pitch of the tap in mm per rev
+ The tap feeds in with the spindle until it reaches Z and holds there, when the spindle is reversed it follows the tap
+ back out to where it started. As the spindle is turned by hand it will overrun the depth so use a tapping head that allows for that.
+ control Y aborts.
+*/
+void Lathe::tap_cycle(GCode& gcode, OutputStream& os)
+{
+    if(!gcode.has_arg('Z') || !gcode.has_arg('K')) {
+        gcode.set_error("Z and K arguments required");
+        return;
+    }
+
+    float pitch = gcode.get_arg('K');
+    if(pitch == 0) {
+        gcode.set_error("K argument cannot be 0");
+        return;
+    }
+    if(rpm == 0) {
+        gcode.set_error("Spindle must be running");
+        return;
+    }
+
+    float x0, z0;
+    get_wcs_position(x0, z0);
+    float depth = Robot::getInstance()->absolute_mode ? gcode.get_arg('Z') - z0 : gcode.get_arg('Z');
+    if(depth == 0) return;
+
+    dpr = pitch;
+    reversed = pitch < 0;
+
+    // feed in
+    n_followers = 0;
+    if(!setup_follower(Z_AXIS, pitch, depth)) {
+        gcode.set_error("Unable to gear axis to the spindle");
+        return;
+    }
+    end_pos = Robot::getInstance()->actuators[Z_AXIS]->get_current_position() + depth;
+    if(!run_pass(os, false, true)) {
+        os.printf("// G84 aborted\n");
+        return;
+    }
+
+    // and follow the reversed spindle back out, the spindle stops before it reverses
+    os.printf("// G84 at depth, reverse the spindle to retract\n");
+    n_followers = 0;
+    if(!setup_follower(Z_AXIS, -pitch, -depth)) {
+        gcode.set_error("Unable to gear axis to the spindle");
+        return;
+    }
+    end_pos = Robot::getInstance()->actuators[Z_AXIS]->get_current_position() - depth;
+    if(!run_pass(os, false, false)) {
+        os.printf("// G84 aborted\n");
+    }
+    end_pos = NAN;
+}
+
 void Lathe::handle_index_irq()
 {
     // count index pulses
     ++index_pulse;
+
+    if(armed) {
+        // engage the followers at the same angle every time
+        armed = false;
+        last_cnt = read_quadrature_encoder();
+        running = true;
+    }
 }
 
 // called every 100 ms to calculate current RPM
@@ -312,109 +524,226 @@ void Lathe::handle_rpm_encoder(uint32_t deltams)
     }
 }
 
-// given move in spindle, calculate where the controlled axis should be
-float Lathe::calculate_position(int32_t cnt)
+static int64_t gcd(int64_t a, int64_t b)
 {
-    // TODO calculate position given counts per rotation
-    // TODO fixed 100 cpr needs to be set in config though
-    float mm_per_rotation = 1.0F;
-    return cnt / 100.0F * mm_per_rotation;
+    while(b != 0) {
+        int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
 }
 
-#define _ramfunc_ __attribute__ ((section(".ramfunctions"),long_call,noinline))
+// true if the motor is geared to the spindle by the pass that is running or waiting for the index pulse
+bool Lathe::is_following(const StepperMotor *motor) const
+{
+    if(!running && !armed) return false;
+    for (int i = 0; i < n_followers; ++i) {
+        if(followers[i].motor == motor) return true;
+    }
+    return false;
+}
 
-// As these are called from the stepticker put them in RAM for faster execution
-// return true if a and b are within the delta range of each other
-_ramfunc_
-static bool equal_within(float a, float b, float delta)
+// gear the axis to the spindle so it moves mm_per_rev for each rev, and stops after distance if it is not NAN.
+// A negative mm_per_rev is for a spindle running in reverse, when there is a distance it sets the direction of travel.
+bool Lathe::setup_follower(int axis, float mm_per_rev, float distance)
 {
-    float diff = a - b;
-    if (diff < 0) diff = -diff;
-    if (delta < 0) delta = -delta;
-    return (diff <= delta);
+    if(n_followers >= 3) return false;
+    if(distance < 0) mm_per_rev = -mm_per_rev;
+
+    Robot *robot = Robot::getInstance();
+    StepperMotor *motor = robot->actuators[axis];
+    Follower& f = followers[n_followers];
+    float steps_per_mm = motor->get_steps_per_mm();
+
+    // steps per encoder count as a fraction, so the position is always exactly where the spindle says it should be
+    int64_t cpr = lroundf(ppr) * get_quadrature_encoder_div();
+    f.num = llround((double)mm_per_rev * steps_per_mm * GEAR_SCALE);
+    f.den = cpr * GEAR_SCALE;
+    int64_t g = gcd(f.num < 0 ? -f.num : f.num, f.den);
+    if(g == 0) return false;
+    f.num /= g;
+    f.den /= g;
+
+    f.motor = motor;
+    f.motor_id = motor->get_motor_id();
+    f.start = motor->get_current_step_position();
+    f.bounded = !std::isnan(distance);
+    f.end = f.bounded ? f.start + lroundf(distance * steps_per_mm) : f.start;
+    f.target = f.start;
+    f.last_target = f.start;
+    f.rem = 0;
+    f.target_velocity = 0;
+    f.velocity = 0;
+    f.fraction = 0;
+
+    // convert the limits to steps per tick, it can step at most once per tick
+    float freq = STEP_TICKER_FREQUENCY;
+    float acc = acceleration > 0 ? acceleration : robot->get_axis_acceleration(axis);
+    if(acc <= 0) acc = robot->get_default_acceleration();
+    f.acceleration = llround((double)acc * steps_per_mm / (freq * freq) * FP_ONE);
+    // keeps the stopping distance calculation in range
+    if(f.acceleration < 256) f.acceleration = 256;
+    float v = motor->get_max_rate() * steps_per_mm / freq;
+    f.max_velocity = v >= 1.0F ? FP_ONE : llround((double)v * FP_ONE);
+
+    if(!motor->is_enabled()) motor->enable(true);
+
+    ++n_followers;
+    return true;
 }
 
+#define _ramfunc_ __attribute__ ((section(".ramfunctions"),long_call,noinline))
+
+// As these are called from the stepticker put them in RAM for faster execution
+// returns the encoder counts since the last call
 _ramfunc_
-float Lathe::get_encoder_delta()
+int32_t Lathe::get_encoder_counts()
 {
-    static uint32_t last_cnt = 0;
-    float delta = 0;
     uint32_t cnt = read_quadrature_encoder();
     uint32_t qemax = get_quadrature_encoder_max_count();
-    uint32_t qediv = get_quadrature_encoder_div();
-    int sign = 1;
+    int32_t delta;
 
-    // handle encoder wrap around and get encoder pulses since last read
+    // handle encoder wrap around
     if(cnt < last_cnt && (last_cnt - cnt) > (qemax / 2)) {
         delta = (qemax - last_cnt) + cnt + 1;
-        sign = 1;
     } else if(cnt > last_cnt && (cnt - last_cnt) > (qemax / 2)) {
-        delta = (qemax - cnt) + last_cnt + 1;
-        sign = -1;
-    } else if(cnt > last_cnt) {
-        delta = cnt - last_cnt;
-        sign = 1;
-    } else if(cnt < last_cnt) {
-        delta = last_cnt - cnt;
-        sign = -1;
+        delta = -(int32_t)((qemax - cnt) + last_cnt + 1);
+    } else {
+        delta = (int32_t)(cnt - last_cnt);
     }
     last_cnt = cnt;
 
-    return (sign * delta) / qediv;
+    return delta;
 }
 
-// called from stepticker every 5us
-// @2000RPM that is an encoder pulse (2000ppr) every 15us.
-// Depending on steps/mm the chances are good that only one step will keep up with the spindle at this callback rate
-// if not then two or more steps maybe issued at a very fast rate
-// NOTE We could run this at a much slower rate and try to setup a block to move the distance accumulated, at a rate
-// determined by the spindle RPM. Not sure if that is practical though.
+// move the target by the spindle counts then step towards it without exceeding the acceleration or velocity limits.
+// The target speed is fed forward so once up to speed the follower does not lag behind the spindle.
+// returns true if it stepped
 _ramfunc_
-int Lathe::update_position()
+bool Lathe::update_follower(Follower& f, int32_t counts, bool sample)
 {
-    if(!running || Module::is_halted()) return -1;
+    if(counts != 0) {
+        f.rem += counts * f.num;
+        if(f.rem >= f.den || f.rem <= -f.den) {
+            int64_t q = f.rem / f.den;
+            f.target += q;
+            f.rem -= q * f.den;
+        }
 
-    float current_position = stepper_motor->get_current_position();
+        if(f.bounded) {
+            // never go past the end, or behind the start if the spindle turns back
+            int32_t lo = f.start < f.end ? f.start : f.end;
+            int32_t hi = f.start < f.end ? f.end : f.start;
+            if(f.target < lo) f.target = lo;
+            else if(f.target > hi) f.target = hi;
+        }
+    }
 
-    if(!std::isnan(end_pos)) {
-        // G33 Znnn mode run the lead screw at the given rate (mm/rev in dpr) until distance is reached
-        // check if we have travelled the required distance
-        // FIXME an equality operation is probably risky here we need to do > or < based on direction of travel
-        if(equal_within(end_pos, current_position, delta_mm)) {
-            running = false;
-            return -1;
+    if(sample) {
+        f.target_velocity = (int64_t)(f.target - f.last_target) << (32 - SAMPLE_SHIFT);
+        f.last_target = f.target;
+    }
+
+    int32_t pos = f.motor->get_current_step_position();
+    int32_t err = f.target - pos;
+
+    // a bounded follower has to stop at the end even though its target is still moving at speed until it gets
+    // clamped there, so also brake once the distance needed to stop reaches the end
+    bool end_brake = false;
+    if(f.bounded && f.velocity != 0) {
+        int64_t to_end = (int64_t)f.end - pos;
+        if(to_end == 0) {
+            // got to the end, don't keep any speed heading past it
+            if((f.velocity > 0) == (f.end > f.start)) f.velocity = 0;
+
+        } else if((f.velocity > 0) == (to_end > 0)) {
+            int64_t speed = f.velocity > 0 ? f.velocity : -f.velocity;
+            int64_t stop = ((speed / f.acceleration) * speed) >> 33;
+            end_brake = stop >= (to_end > 0 ? to_end : -to_end);
         }
     }
 
-    float delta = get_encoder_delta();
+    if(end_brake) {
+        // slow down towards stopped, but not past it
+        int64_t dir = f.velocity > 0 ? 1 : -1;
+        f.velocity -= dir * f.acceleration;
+        if(f.velocity * dir < 0) f.velocity = 0;
 
-    if(delta != 0) {
-        // calculate fraction of a rotation since last time and based on dpr calculate how far to move
-        float mm = dpr * (delta / ppr); // calculate mm to move based on requested distance per rev
-        target_position += mm; // accumulate target move
+    } else if(err == 0) {
+        // match the target speed
+        int64_t d = f.target_velocity - f.velocity;
+        if(d > f.acceleration) d = f.acceleration;
+        else if(d < -f.acceleration) d = -f.acceleration;
+        f.velocity += d;
+
+    } else {
+        // speed up towards the target unless we need to start slowing down to stop at it
+        int64_t dir = err > 0 ? 1 : -1;
+        int64_t closing = (f.velocity - f.target_velocity) * dir;
+        int64_t aerr = err > 0 ? err : -err;
+        bool brake = false;
+        if(closing > 0) {
+            // steps needed to slow down to the target speed
+            int64_t stop = ((closing / f.acceleration) * closing) >> 33;
+            brake = stop >= aerr;
+        }
+        f.velocity += brake ? -dir * f.acceleration : dir * f.acceleration;
     }
 
-    // issue steps until we hit the target move specified by the encoder/chuck rotation
-    // we first check if the target is equal to current within the limits of the step increment
-    if(!equal_within(target_position, current_position, delta_mm)) {
-        if(target_position > current_position) {
-            if(current_direction) {
-                stepper_motor->set_direction(false ^ reversed);
-                current_direction = false;
-            }
-            stepper_motor->step();
-            return motor_id;
-        } else if(target_position < current_position) {
-            if(!current_direction) {
-                stepper_motor->set_direction(true ^ reversed);
-                current_direction = true;
-            }
-            stepper_motor->step();
-            return motor_id;
+    if(f.velocity > f.max_velocity) f.velocity = f.max_velocity;
+    else if(f.velocity < -f.max_velocity) f.velocity = -f.max_velocity;
+
+    f.fraction += f.velocity;
+    if(f.fraction >= FP_ONE) {
+        f.fraction -= FP_ONE;
+        // never step past the target
+        if(err > 0) {
+            if(f.motor->get_direction()) f.motor->set_direction(false);
+            f.motor->step();
+            return true;
+        }
+        f.fraction = 0;
+
+    } else if(f.fraction <= -FP_ONE) {
+        f.fraction += FP_ONE;
+        if(err < 0) {
+            if(!f.motor->get_direction()) f.motor->set_direction(true);
+            f.motor->step();
+            return true;
+        }
+        f.fraction = 0;
+    }
+
+    return false;
+}
+
+// called from stepticker every 10us
+// @2000RPM that is an encoder pulse (2000ppr) every 15us, each axis steps at most once per call
+// returns the motors that stepped
+_ramfunc_
+uint32_t Lathe::update_position()
+{
+    if(!running || Module::is_halted()) return 0;
+
+    int32_t counts = get_encoder_counts();
+    bool sample = (++ticks & ((1 << SAMPLE_SHIFT) - 1)) == 0;
+    uint32_t stepped = 0;
+    bool done = true;
+
+    for (int i = 0; i < n_followers; ++i) {
+        Follower& f = followers[i];
+        if(update_follower(f, counts, sample)) {
+            stepped |= (1 << f.motor_id);
+        }
+        if(!f.bounded || f.motor->get_current_step_position() != f.end || f.velocity != 0) {
+            done = false;
         }
     }
 
-    return -1;
+    if(done) running = false;
+
+    return stepped;
 }
 
 void Lathe::on_halt(bool flg)
@@ -17,31 +17,53 @@ class Lathe : public Module {
         bool is_running() const { return running; }
         bool is_reversed() const { return reversed; }
         float get_end_position() const { return end_pos; }
+        bool is_following(const StepperMotor *motor) const;
 
     private:
+        // one axis geared to the spindle, the ratio is steps per encoder count held as an exact fraction so it never drifts
+        // velocities and acceleration are in steps per tick scaled by 2^32
+        struct Follower {
+            StepperMotor *motor;
+            uint8_t motor_id;
+            bool bounded; // stops at end, otherwise runs until told to stop
+            int64_t num, den; // gear ratio, num is signed
+            int64_t rem; // remainder of the ratio not yet added to target
+            int32_t start, end; // step positions
+            int32_t target; // step position the spindle has moved us to
+            int32_t last_target;
+            int64_t target_velocity; // how fast target is moving
+            int64_t velocity;
+            int64_t fraction; // fraction of a step moved so far
+            int64_t acceleration; // limits
+            int64_t max_velocity;
+        };
+
         bool handle_gcode(GCode& gcode, OutputStream& os);
         bool rpm_cmd(std::string& params, OutputStream& os);
-        int update_position();
-        float calculate_position(int32_t cnt);
-        float get_encoder_delta();
+        bool run_pass(OutputStream& os, bool sync, bool stop_if_spindle_stops);
+        void thread_cycle(GCode& gcode, OutputStream& os);
+        void tap_cycle(GCode& gcode, OutputStream& os);
+        bool setup_follower(int axis, float steps_per_rev, float distance);
+        uint32_t update_position();
+        bool update_follower(Follower& f, int32_t counts, bool sample);
+        int32_t get_encoder_counts();
         void handle_rpm();
         void handle_rpm_encoder(uint32_t deltams);
         void handle_index_irq();
 
-        float wanted_pos{0};
-        StepperMotor *stepper_motor;
+        Follower followers[3];
+        uint8_t n_followers{0};
+        uint32_t ticks{0};
+        uint32_t last_cnt{0};
         Pin *index_pin{nullptr};
         volatile uint32_t index_pulse{0};
 
-        uint8_t motor_id;
-        bool current_direction;
-        float delta_mm;
         float end_pos;
         float dpr; // distance per rotation set by K
+        float acceleration; // mm/sec² limit for the followers, 0 uses the axis acceleration
         float ppr;  // encoder pulses per rotation
-        float target_position{0}; // position in mm we want the Z axis to move
         float rpm{0};
         volatile bool running{false};
-        bool started{false};
+        volatile bool armed{false}; // start running on the next index pulse
         bool reversed{false};
 };
@@ -484,6 +484,22 @@ bool Switch::request(const char *key, void *value)
 
     } else if(strcmp(key, "is_output") == 0) {
         return is_output();
+
+    } else if(strcmp(key, "duty") == 0) {
+        // the current output as a fraction of full on (0.0 to 1.0) whatever the output type
+        if(!is_output()) return false;
+        // read back what the output is actually set to
+        float d = 0;
+        if(switch_state) {
+            if(output_type == SIGMADELTA) {
+                d = sigmadelta_pin->get_pwm() / 255.0F;
+            } else if (output_type == HWPWM) {
+                d = pwm_pin->get();
+            } else if (output_type == DIGITAL) {
+                d = 1.0F;
+            }
+        }
+        *(float *)value = d;
     }
 
     return true;
@@ -0,0 +1,262 @@
+#include "MPC_Autotuner.h"
+#include "TemperatureControl.h"
+#include "SigmaDeltaPwm.h"
+#include "OutputStream.h"
+#include "Module.h"
+#include "main.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <cmath>
+
+// sample period during calibration
+#define SAMPLE_MS 100
+// window the heat up slope is measured over
+#define SLOPE_SAMPLES 10
+// give up if the target is not reached within this time
+#define HEAT_UP_TIMEOUT_MS (10 * 60 * 1000)
+
+MPC_Autotuner::MPC_Autotuner(TemperatureControl *tc) : temp_control(tc)
+{
+    max_slope = 0;
+    slope_temp = 0;
+    dead_time = 0;
+}
+
+/**
+ * The heater is turned on full from cold until it reaches the target, the steepest part of the heat up gives
+ * the heat capacity and how long the sensor lags behind the block.
+ * The target is then held using the model found so far and the average power needed to hold it gives the ambient loss,
+ * then if a fan is configured the same is done with the fan on to find how much more it takes away.
+ * Heater power can not be measured thermally so the configured value is used, the other values are scaled to match it.
+ */
+void MPC_Autotuner::start(float target, OutputStream& os)
+{
+    TemperatureControl *tc = temp_control;
+
+    if(target > tc->max_temp) {
+        os.printf("ERROR: Target %5.1f is above the maximum temperature %5.1f\n", target, tc->max_temp);
+        return;
+    }
+
+    ambient = tc->get_temperature();
+    if(std::isinf(ambient) || std::isnan(ambient)) {
+        os.printf("ERROR: Bad temperature\n");
+        return;
+    }
+    if(ambient > 50 || target - ambient < 20) {
+        os.printf("ERROR: %s is at %5.1f, it must be cooled down to room temperature first\n", tc->get_designator(), ambient);
+        return;
+    }
+
+    // restored if the calibration does not complete
+    saved_use_mpc = tc->use_mpc;
+    saved_model[0] = tc->mpc_heat_capacity;
+    saved_model[1] = tc->mpc_sensor_response;
+    saved_model[2] = tc->mpc_ambient_loss;
+    saved_model[3] = tc->mpc_fan_loss;
+    saved_model[4] = tc->mpc_ambient;
+
+    target_temperature = target;
+    full_power = tc->mpc_heater_power * tc->heater_pin->max_pwm() / 255.0F;
+
+    os.printf("%s: Starting MPC calibration, target: %5.1f, ambient: %5.1f, control X aborts\n", tc->get_designator(), target, ambient);
+
+    if(!heat_up(os)) {
+        abort();
+        return;
+    }
+
+    os.printf("// Max heat up rate %1.3f°C/sec at %5.1f, sensor lag %1.2f secs\n", max_slope, slope_temp, dead_time);
+
+    // hold using the model ignoring losses, the controller compensates by running slightly below the target
+    tc->mpc_heat_capacity = full_power / max_slope;
+    tc->mpc_sensor_response = 1.0F / dead_time;
+    tc->mpc_ambient_loss = 0;
+    tc->mpc_fan_loss = 0;
+    tc->mpc_ambient = ambient;
+    tc->mpc_reset();
+    tc->use_mpc = true;
+    tc->use_bangbang = false;
+    tc->target_temperature = target_temperature;
+
+    uint32_t settle_ms = 30000 + (uint32_t)(dead_time * 5000);
+    float power, temp;
+    if(!hold(os, settle_ms, 30000, power, temp)) {
+        abort();
+        return;
+    }
+
+    float ambient_loss = power / (temp - ambient);
+    // now correct the heat capacity for the heat that was being lost during the heat up
+    float heat_capacity = (full_power - ambient_loss * (slope_temp - ambient)) / max_slope;
+    tc->mpc_ambient_loss = ambient_loss;
+    if(heat_capacity > 0) tc->mpc_heat_capacity = heat_capacity;
+
+    float fan_loss = 0;
+    Module *fan = tc->mpc_fan.empty() ? nullptr : Module::lookup("switch", tc->mpc_fan.c_str());
+    if(fan != nullptr) {
+        bool was_on = false;
+        fan->request("state", &was_on);
+        bool on = true;
+        fan->request("set-state", &on);
+        float duty = 0;
+        fan->request("duty", &duty);
+
+        if(duty > 0) {
+            os.printf("// Measuring fan loss with %s at %1.0f%%\n", tc->mpc_fan.c_str(), duty * 100);
+            float fan_power, fan_temp;
+            bool ok = hold(os, 20000, 30000, fan_power, fan_temp);
+            fan->request("set-state", &was_on);
+            if(!ok) {
+                abort();
+                return;
+            }
+            fan_loss = (fan_power / (fan_temp - ambient) - ambient_loss) / duty;
+            if(fan_loss < 0) fan_loss = 0;
+
+        } else {
+            fan->request("set-state", &was_on);
+            os.printf("WARNING: fan %s has no output when on, fan loss not measured\n", tc->mpc_fan.c_str());
+        }
+    }
+    tc->mpc_fan_loss = fan_loss;
+
+    os.printf("\tP(power): %1.2f\n\tC(capacity): %1.4f\n\tR(response): %1.4f\n\tA(ambient loss): %1.4f\n\tF(fan loss): %1.4f\n\tB(ambient): %1.1f\n",
+              tc->mpc_heater_power, tc->mpc_heat_capacity, tc->mpc_sensor_response, tc->mpc_ambient_loss, tc->mpc_fan_loss, tc->mpc_ambient);
+    os.printf("MPC calibration Complete! The settings above have been loaded into memory and MPC enabled, but not written to your config file.\n");
+
+    // turn off the heater but leave MPC enabled with the new settings
+    tc->target_temperature = 0;
+    tc->heater_pin->set(false);
+    tc->o = 0;
+    temp_control = nullptr;
+}
+
+// heat at full power until the target is reached, recording the steepest slope
+bool MPC_Autotuner::heat_up(OutputStream& os)
+{
+    TemperatureControl *tc = temp_control;
+
+    // the ISR does not control the heater when there is no target
+    tc->target_temperature = 0;
+    tc->o = tc->heater_pin->max_pwm();
+    tc->heater_pin->pwm(tc->o);
+
+    float window[SLOPE_SAMPLES];
+    int n = 0;
+    float slope_time = 0;
+    TickType_t start = xTaskGetTickCount();
+
+    while(true) {
+        float temp;
+        if(!sample(os, temp)) return false;
+
+        float secs = TICKS2MS(xTaskGetTickCount() - start) / 1000.0F;
+
+        if(n >= SLOPE_SAMPLES) {
+            float oldest = window[n % SLOPE_SAMPLES];
+            float slope = (temp - oldest) / (SLOPE_SAMPLES * SAMPLE_MS / 1000.0F);
+            if(slope > max_slope) {
+                max_slope = slope;
+                slope_temp = (temp + oldest) / 2;
+                slope_time = secs - (SLOPE_SAMPLES * SAMPLE_MS / 2000.0F);
+            }
+        }
+        window[n % SLOPE_SAMPLES] = temp;
+        ++n;
+
+        if(temp >= target_temperature) break;
+
+        if(secs * 1000 > HEAT_UP_TIMEOUT_MS) {
+            os.printf("ERROR: %s did not reach %5.1f, check the heater\n", tc->get_designator(), target_temperature);
+            return false;
+        }
+
+        if((n % 10) == 0) {
+            os.printf("// MPC heating - %5.1f/%5.1f @%d\n", temp, target_temperature, tc->o);
+        }
+    }
+
+    if(max_slope <= 0) {
+        os.printf("ERROR: No temperature rise was measured\n");
+        return false;
+    }
+
+    // where the steepest tangent crosses the starting temperature is how far the sensor lags behind the heater
+    dead_time = slope_time - (slope_temp - ambient) / max_slope;
+    if(dead_time < tc->PIDdt) dead_time = tc->PIDdt;
+
+    return true;
+}
+
+// let the temperature settle at the target then return the average heater power and temperature
+bool MPC_Autotuner::hold(OutputStream& os, uint32_t settle_ms, uint32_t measure_ms, float& power, float& temp)
+{
+    TemperatureControl *tc = temp_control;
+    float sum_o = 0, sum_t = 0;
+    int cnt = 0;
+
+    for (uint32_t ms = 0; ms < settle_ms + measure_ms; ms += SAMPLE_MS) {
+        float t;
+        if(!sample(os, t)) return false;
+
+        if(ms >= settle_ms) {
+            sum_o += tc->o;
+            sum_t += t;
+            ++cnt;
+        }
+
+        if((ms % 1000) == 0) {
+            os.printf("// MPC %s - %5.1f/%5.1f @%d\n", ms < settle_ms ? "settling" : "measuring", t, target_temperature, tc->o);
+        }
+    }
+
+    power = tc->mpc_heater_power * (sum_o / cnt) / 255.0F;
+    temp = sum_t / cnt;
+    return true;
+}
+
+bool MPC_Autotuner::sample(OutputStream& os, float& temp)
+{
+    safe_sleep(SAMPLE_MS);
+
+    if(temp_control->is_halted()) {
+        // control X breaks out
+        os.printf("MPC calibration aborted\n");
+        return false;
+    }
+
+    temp = temp_control->get_temperature();
+    if(std::isinf(temp) || std::isnan(temp)) {
+        os.printf("ERROR: Bad temperature\n");
+        return false;
+    }
+
+    // the ISR only checks this when it is controlling the heater
+    if(temp > temp_control->max_temp) {
+        os.printf("ERROR: Maximum temperature exceeded\n");
+        return false;
+    }
+
+    return true;
+}
+
+void MPC_Autotuner::abort()
+{
+    if (temp_control == nullptr)
+        return;
+
+    // the model is incomplete so put back what we had
+    temp_control->use_mpc = saved_use_mpc;
+    temp_control->mpc_heat_capacity = saved_model[0];
+    temp_control->mpc_sensor_response = saved_model[1];
+    temp_control->mpc_ambient_loss = saved_model[2];
+    temp_control->mpc_fan_loss = saved_model[3];
+    temp_control->mpc_ambient = saved_model[4];
+    temp_control->target_temperature = 0;
+    temp_control->heater_pin->set(false);
+    temp_control->o = 0;
+    temp_control = nullptr;
+}
@@ -0,0 +1,36 @@
+/**
+ * Calibrates the TemperatureControl MPC model with a single heat up and hold
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class TemperatureControl;
+class OutputStream;
+
+class MPC_Autotuner
+{
+public:
+    MPC_Autotuner(TemperatureControl *);
+    void start(float target, OutputStream&);
+
+private:
+    bool heat_up(OutputStream& os);
+    bool hold(OutputStream& os, uint32_t settle_ms, uint32_t measure_ms, float& power, float& temp);
+    bool sample(OutputStream& os, float& temp);
+    void abort();
+
+    TemperatureControl *temp_control;
+    float target_temperature;
+    float ambient;
+    float full_power;
+
+    // results of the heat up
+    float max_slope;
+    float slope_temp;
+    float dead_time;
+
+    float saved_model[5];
+    bool saved_use_mpc;
+};
@@ -9,6 +9,7 @@
 #include "Dispatcher.h"
 #include "main.h"
 #include "PID_Autotuner.h"
+#include "MPC_Autotuner.h"
 #include "Consoles.h"
 
 #include <math.h>
@@ -42,6 +43,20 @@
 #define d_factor_key "d_factor"
 #define ponm_key "use_ponm"
 
+#define use_mpc_key "use_mpc"
+#define mpc_heater_power_key "mpc_heater_power"
+#define mpc_heat_capacity_key "mpc_heat_capacity"
+#define mpc_sensor_response_key "mpc_sensor_response"
+#define mpc_ambient_loss_key "mpc_ambient_loss"
+#define mpc_fan_loss_key "mpc_fan_loss"
+#define mpc_filament_heat_key "mpc_filament_heat"
+#define mpc_ambient_key "mpc_ambient"
+#define mpc_fan_key "mpc_fan"
+#define mpc_extruder_key "mpc_extruder"
+
+// fraction of the difference between the measured and modeled sensor temperature applied to the model each reading
+#define MPC_SMOOTHING 0.5F
+
 #define i_max_key "i_max"
 #define windup_key "windup"
 
@@ -235,6 +250,27 @@ bool TemperatureControl::configure(ConfigReader& cr, ConfigReader::section_map_t
     // use Proportional on measurement otherwise Proportional on Error (legacy)
     ponm = cr.get_bool(m, ponm_key, false);
 
+    // Model predictive control, defaults are for a typical 40W hotend, M306 will calibrate them
+    use_mpc = cr.get_bool(m, use_mpc_key, false);
+    mpc_heater_power = cr.get_float(m, mpc_heater_power_key, 40.0F);
+    mpc_heat_capacity = cr.get_float(m, mpc_heat_capacity_key, 16.7F);
+    mpc_sensor_response = cr.get_float(m, mpc_sensor_response_key, 0.22F);
+    mpc_ambient_loss = cr.get_float(m, mpc_ambient_loss_key, 0.068F);
+    mpc_fan_loss = cr.get_float(m, mpc_fan_loss_key, 0.0F);
+    mpc_filament_heat = cr.get_float(m, mpc_filament_heat_key, 0.0056F);
+    mpc_ambient = cr.get_float(m, mpc_ambient_key, 25.0F);
+    mpc_fan = cr.get_string(m, mpc_fan_key, "");
+    mpc_extruder = cr.get_string(m, mpc_extruder_key, "");
+    have_e_pos = false;
+    if(!readonly && (!mpc_fan.empty() || !mpc_extruder.empty())) {
+        // sample the fan and extrusion rate for the feed forward
+        SlowTicker::getInstance()->attach(1, std::bind(&TemperatureControl::update_feedforward, this));
+    }
+    if(use_mpc && use_bangbang) {
+        printf("WARNING: configure-temperature: %s both bang_bang and use_mpc are set, using MPC\n", name);
+        use_bangbang = false;
+    }
+
     if(!this->readonly) {
         // set to the same as max_pwm by default
         this->i_max = cr.get_float(m, i_max_key, this->heater_pin->max_pwm());
@@ -257,6 +293,7 @@ bool TemperatureControl::configure(ConfigReader& cr, ConfigReader::section_map_t
         Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, 143, std::bind(&TemperatureControl::handle_mcode, this, _1, _2));
         Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, 301, std::bind(&TemperatureControl::handle_mcode, this, _1, _2));
         Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, 303, std::bind(&TemperatureControl::handle_autopid, this, _1, _2));
+        Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, 306, std::bind(&TemperatureControl::handle_mpc, this, _1, _2));
         Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, 500, std::bind(&TemperatureControl::handle_mcode, this, _1, _2));
 
         Dispatcher::getInstance()->add_handler(Dispatcher::MCODE_HANDLER, set_m_code, std::bind(&TemperatureControl::handle_mcode, this, _1, _2));
@@ -316,6 +353,62 @@ bool TemperatureControl::handle_autopid(GCode& gcode, OutputStream& os)
     return false;
 }
 
+// M306 S<tool id> sets the MPC model, P heater power, C heat capacity, R sensor response, A ambient loss,
+// F fan loss, H filament heat capacity, B ambient temperature, Z1 enables MPC Z0 disables it
+// M306 S<tool id> T<temp> calibrates the model by heating to the given temperature, control X to abort
+// M306 with no S reports the current model
+bool TemperatureControl::handle_mpc(GCode& gcode, OutputStream& os)
+{
+    if (gcode.has_arg('S') && (gcode.get_int_arg('S') == this->tool_id)) {
+        if(gcode.has_arg('T')) {
+            float target = gcode.get_arg('T');
+            if(target <= 0) target = tool_id >= 250 ? 70 : 200;
+            os.printf("// Running MPC calibration on (%s) %s, toolid %d, control X to abort\n", get_designator(), get_instance_name(), tool_id);
+            MPC_Autotuner *autompc = new MPC_Autotuner(this);
+            // will not return until complete
+            autompc->start(target, os);
+            delete autompc;
+            return true;
+        }
+
+        if (gcode.has_arg('P'))
+            this->mpc_heater_power = gcode.get_arg('P');
+        if (gcode.has_arg('C'))
+            this->mpc_heat_capacity = gcode.get_arg('C');
+        if (gcode.has_arg('R'))
+            this->mpc_sensor_response = gcode.get_arg('R');
+        if (gcode.has_arg('A'))
+            this->mpc_ambient_loss = gcode.get_arg('A');
+        if (gcode.has_arg('F'))
+            this->mpc_fan_loss = gcode.get_arg('F');
+        if (gcode.has_arg('H'))
+            this->mpc_filament_heat = gcode.get_arg('H');
+        if (gcode.has_arg('B'))
+            this->mpc_ambient = gcode.get_arg('B');
+        if (gcode.has_arg('Z')) {
+            bool en = gcode.get_arg('Z') == 1;
+            if(en && !this->use_mpc) mpc_reset();
+            this->use_mpc = en;
+            if(en) this->use_bangbang = false;
+        }
+
+        if(this->mpc_heater_power <= 0 || this->mpc_heat_capacity <= 0 || this->mpc_sensor_response <= 0) {
+            os.printf("WARNING: heater power, heat capacity and sensor response must be greater than zero, MPC disabled\n");
+            this->use_mpc = false;
+        }
+
+        return true;
+
+    } else if(!gcode.has_arg('S')) {
+        os.printf("%s(S%d): MPC: %d P(power): %g C(capacity): %g R(response): %g A(ambient loss): %g F(fan loss): %g H(filament): %g B(ambient): %g\n",
+                  this->designator.c_str(), this->tool_id, this->use_mpc, this->mpc_heater_power, this->mpc_heat_capacity, this->mpc_sensor_response,
+                  this->mpc_ambient_loss, this->mpc_fan_loss, this->mpc_filament_heat, this->mpc_ambient);
+        return true;
+    }
+
+    return false;
+}
+
 bool TemperatureControl::handle_mcode(GCode & gcode, OutputStream & os)
 {
     if( gcode.get_code() == this->get_m_code) {
@@ -348,7 +441,7 @@ bool TemperatureControl::handle_mcode(GCode & gcode, OutputStream & os)
             return true;
 
         } else if(!gcode.has_arg('S')) {
-            os.printf("%s(S%d): using %s - active: %d", this->designator.c_str(), this->tool_id, this->readonly ? "Readonly" : this->use_bangbang ? "Bangbang" : "PID", active);
+            os.printf("%s(S%d): using %s - active: %d", this->designator.c_str(), this->tool_id, this->readonly ? "Readonly" : this->use_mpc ? "MPC" : this->use_bangbang ? "Bangbang" : "PID", active);
             if(!readonly) {
                 os.printf(", %s\n", heater_pin->to_string().c_str());
             } else {
@@ -412,6 +505,9 @@ bool TemperatureControl::handle_mcode(GCode & gcode, OutputStream & os)
     } else if (gcode.get_code() == 500) { // M500 saves some volatile settings to config override file
         os.printf(";PID settings, i_max, max_pwm, PonM:\nM301 S%d P%1.4f I%1.4f D%1.4f X%1.4f Y%d Z%d\n", this->tool_id, this->p_factor, this->i_factor / this->PIDdt, this->d_factor * this->PIDdt, this->i_max, this->heater_pin->max_pwm(), this->ponm);
 
+        os.printf(";MPC model settings:\nM306 S%d P%1.4f C%1.4f R%1.4f A%1.4f F%1.4f H%1.6f B%1.2f Z%d\n", this->tool_id, this->mpc_heater_power, this->mpc_heat_capacity,
+                  this->mpc_sensor_response, this->mpc_ambient_loss, this->mpc_fan_loss, this->mpc_filament_heat, this->mpc_ambient, this->use_mpc);
+
         os.printf(";Max temperature setting:\nM143 S%d P%1.4f\n", this->tool_id, this->max_temp);
 
         if(this->sensor_settings) {
@@ -536,6 +632,7 @@ void TemperatureControl::set_desired_temperature(float desired_temperature)
         this->iTerm = this->o;
         if (this->iTerm > this->i_max) this->iTerm = this->i_max;
         else if (this->iTerm < 0.0F) this->iTerm = 0.0F;
+        mpc_reset();
     }
 
     // reset the runaway state, even if it was a temp change
@@ -574,6 +671,11 @@ void TemperatureControl::thermistor_read_tick()
  */
 void TemperatureControl::pid_process(float temperature)
 {
+    if(use_mpc) {
+        mpc_process(temperature);
+        return;
+    }
+
     if(use_bangbang) {
         // bang bang is very simple, if temp is < target - hysteresis turn on full else if  temp is > target + hysteresis turn heater off
         // good for relays
@@ -645,6 +747,75 @@ void TemperatureControl::pid_process(float temperature)
     }
 }
 
+// start the model from the current reading, assumes the block and sensor are at the same temperature
+void TemperatureControl::mpc_reset()
+{
+    model_block = last_reading;
+    model_sensor = last_reading;
+}
+
+/**
+ * Model predictive control, the heater block and sensor are modeled as two lumps,
+ * the block is heated by the heater and loses heat to ambient, the fan and the filament being extruded,
+ * the sensor lags behind the block.
+ * The model is corrected by the measured temperature and the output is the power needed to bring the
+ * modeled block to the target temperature in the next period, plus what is being lost at that temperature.
+ * Based on the Marlin MPC algorithm.
+ */
+void TemperatureControl::mpc_process(float temperature)
+{
+    // heat lost per degree above ambient
+    float loss = mpc_ambient_loss + mpc_fan_loss * fan_duty + mpc_filament_heat * e_rate;
+
+    // advance the model by the power that was applied over the last period
+    float power = mpc_heater_power * this->o / 255.0F;
+    model_block += (power - loss * (model_block - mpc_ambient)) * PIDdt / mpc_heat_capacity;
+    model_sensor += mpc_sensor_response * (model_block - model_sensor) * PIDdt;
+
+    // pull the model towards the measured temperature, the block is assumed to be off by the same amount
+    float delta = (temperature - model_sensor) * MPC_SMOOTHING;
+    model_sensor += delta;
+    model_block += delta;
+
+    // the power needed to get the block to the target within one period and keep it there
+    power = (target_temperature - model_block) * mpc_heat_capacity / PIDdt + loss * (target_temperature - mpc_ambient);
+
+    float output = power * 255.0F / mpc_heater_power;
+    if(output > heater_pin->max_pwm()) output = heater_pin->max_pwm();
+    else if(output < 0) output = 0;
+    this->o = output;
+    heater_pin->pwm(this->o);
+}
+
+// called every second to update the feed forward inputs to MPC
+void TemperatureControl::update_feedforward()
+{
+    if(!mpc_fan.empty()) {
+        float d;
+        Module *m = Module::lookup("switch", mpc_fan.c_str());
+        if(m != nullptr && m->request("duty", &d)) {
+            fan_duty = d;
+        }
+    }
+
+    if(!mpc_extruder.empty()) {
+        float pos;
+        Module *m = Module::lookup("extruder", mpc_extruder.c_str());
+        if(m != nullptr && m->request("get_current_position", &pos)) {
+            // only forward extrusion takes heat, also ignores position resets from G92
+            float d = have_e_pos ? pos - last_e_pos : 0;
+            e_rate = d > 0 ? d : 0;
+            last_e_pos = pos;
+            have_e_pos = true;
+
+        } else {
+            // not selected so it is not extruding
+            e_rate = 0;
+            have_e_pos = false;
+        }
+    }
+}
+
 // called every second
 void TemperatureControl::check_runaway()
 {
@@ -31,6 +31,7 @@ public:
     };
 
     friend class PID_Autotuner;
+    friend class MPC_Autotuner;
 
 private:
     bool configure(ConfigReader& cr, ConfigReader::section_map_t& m, const char *name);
@@ -41,6 +42,9 @@ private:
 
     void thermistor_read_tick(void);
     void pid_process(float);
+    void mpc_process(float);
+    void mpc_reset();
+    void update_feedforward();
     void setPIDp(float p);
     void setPIDi(float i);
     void setPIDd(float d);
@@ -48,6 +52,7 @@ private:
     bool handle_mcode(GCode& gcode, OutputStream& os);
     bool handle_M6(GCode& gcode, OutputStream& os);
     bool handle_autopid(GCode& gcode, OutputStream& os);
+    bool handle_mpc(GCode& gcode, OutputStream& os);
 
     float target_temperature;
     float max_temp, min_temp;
@@ -73,6 +78,23 @@ private:
     float d_factor;
     float PIDdt;
 
+    // MPC model settings
+    float mpc_heater_power;     // W at full output
+    float mpc_heat_capacity;    // J/K of the heater block
+    float mpc_sensor_response;  // 1/sec, how fast the sensor follows the block
+    float mpc_ambient_loss;     // W/K lost to ambient
+    float mpc_fan_loss;         // extra W/K lost to ambient with the fan on full
+    float mpc_filament_heat;    // J/K per mm of filament extruded
+    float mpc_ambient;          // °C
+    // MPC model state
+    float model_block;
+    float model_sensor;
+    // feed forward inputs, updated once a second
+    float fan_duty{0};
+    float e_rate{0};
+    float last_e_pos{0};
+    std::string mpc_fan;
+    std::string mpc_extruder;
 
     enum RUNAWAY_TYPE {NOT_HEATING, HEATING_UP, COOLING_DOWN, TARGET_TEMPERATURE_REACHED};
 
@@ -98,6 +120,8 @@ private:
         bool windup: 1;
         bool sensor_settings: 1;
         bool ponm:1;
+        bool use_mpc:1;
+        bool have_e_pos:1;
     };
 };
 
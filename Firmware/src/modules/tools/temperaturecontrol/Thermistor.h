@@ -23,10 +23,14 @@ class Thermistor : public TempSensor
         static std::tuple<float,float,float> calculate_steinhart_hart_coefficients(float t1, float r1, float t2, float r2, float t3, float r3);
         static bool print_predefined_thermistors(std::string& params, OutputStream& os);
 
+        // public for testing
+        float adc_value_to_temperature(uint32_t adc_value);
+        float calculate_temperature(uint32_t adc_value);
+
     private:
         int new_thermistor_reading();
-        float adc_value_to_temperature(uint32_t adc_value);
         bool calc_jk();
+        void build_table();
 
         // Thermistor computation settings using beta, not used if using Steinhart-Hart
         float r0;
@@ -52,6 +56,10 @@ class Thermistor : public TempSensor
 
         Adc *thermistor_pin{nullptr};
 
+        // temperature for every (1 << table_shift) ADC values, interpolated in between
+        int16_t *table{nullptr};
+        uint8_t table_shift;
+
         float min_temp, max_temp;
 
         bool use_steinhart_hart;
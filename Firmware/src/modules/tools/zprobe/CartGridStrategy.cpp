@@ -51,6 +51,23 @@
     Display mode of current grid can be changed to human redable mode (table with coordinates) by using
        human_readable  true
 
+    The grid can be probed as one pipelined scan, where the lift off the bed and the travel to the next point are queued
+    together with the probe move so Z retracts while XY travels, and only the probe trigger is waited for...
+        pipelined_scan  true
+    The probe is lifted vertically by scan_lift mm (default 0.5) before the XY travel starts
+        scan_lift  0.5
+    NOTE dwell_before_probing is not used when scanning
+
+    The compensation between grid points is bilinear by default, bicubic follows a warped bed more smoothly...
+        interpolation  bicubic
+    The interpolation coefficients for each cell are calculated once when the grid is probed or loaded.
+
+    Instead of splitting every line into mm_per_line_segment segments, lines can be split only where they need to be to
+    follow the compensation within segment_tolerance mm, so moves over flat areas of the bed are not split at all...
+        adaptive_segmentation  true
+        segment_tolerance  0.01
+    mm_per_line_segment should then be left at 0
+
     For probes like the bltouch you can define a before probe and after probe GCode sequence (to deploy and stow the probe)
         before_probe_gcode M280
         after_probe_gcode M281
@@ -61,6 +78,7 @@
 
     G32 probes the grid and turns the compensation on, this will remain in effect until reset or M561/M370
         optional parameters {{Xn}} {{Yn}} sets the size for this rectangular probe, which gets saved with M375
+        optional parameter S1 uses a pipelined scan, S0 disables it, for this probe only
 
 
     M370 clears the grid and turns off compensation
@@ -111,6 +129,11 @@
 #define dampening_start_key "dampening_start"
 #define before_probe_gcode_key "before_probe_gcode"
 #define after_probe_gcode_key "after_probe_gcode"
+#define pipelined_scan_key "pipelined_scan"
+#define scan_lift_key "scan_lift"
+#define interpolation_key "interpolation"
+#define adaptive_segmentation_key "adaptive_segmentation"
+#define segment_tolerance_key "segment_tolerance"
 
 #define GRIDFILE "/sd/cartesian.grid"
 
@@ -121,11 +144,13 @@
 CartGridStrategy::CartGridStrategy(ZProbe *zprb) : ZProbeStrategy(zprb)
 {
     grid = nullptr;
+    mesh = nullptr;
 }
 
 CartGridStrategy::~CartGridStrategy()
 {
     if(grid != nullptr) free(grid);
+    if(mesh != nullptr) free(mesh);
 }
 
 bool CartGridStrategy::configure(ConfigReader& cr)
@@ -143,6 +168,12 @@ bool CartGridStrategy::configure(ConfigReader& cr)
     do_home = cr.get_bool(m, do_home_key, true);
     only_by_two_corners = cr.get_bool(m, only_by_two_corners_key, false);
     human_readable = cr.get_bool(m, human_readable_key, false);
+    pipelined_scan = cr.get_bool(m, pipelined_scan_key, false);
+    scan_lift = cr.get_float(m, scan_lift_key, 0.5F);
+    std::string interpolation = cr.get_string(m, interpolation_key, "bilinear");
+    bicubic = (interpolation == "bicubic");
+    adaptive_segmentation = cr.get_bool(m, adaptive_segmentation_key, false);
+    segment_tolerance = cr.get_float(m, segment_tolerance_key, 0.01F);
 
     this->height_limit = cr.get_float(m, height_limit_key, 0);
     this->dampening_start = cr.get_float(m, dampening_start_key, 0);
@@ -180,8 +211,10 @@ bool CartGridStrategy::configure(ConfigReader& cr)
 
     // allocate
     grid = (float *)malloc(configured_grid_x_size * configured_grid_y_size * sizeof(float));
+    // there are always fewer cells than grid points whatever size is probed
+    mesh = (float *)malloc(configured_grid_x_size * configured_grid_y_size * (bicubic ? 16 : 4) * sizeof(float));
 
-    if(grid == nullptr) {
+    if(grid == nullptr || mesh == nullptr) {
         printf("configure-cart-grid: Not enough memory\n");
         return false;
     }
@@ -507,12 +540,20 @@ bool CartGridStrategy::handle_mcode(GCode& gcode, OutputStream& os)
 void CartGridStrategy::setAdjustFunction(bool on)
 {
     if(on) {
+        build_mesh();
+
         // set the compensationTransform in robot
         using std::placeholders::_1;
         using std::placeholders::_2;
+        using std::placeholders::_3;
+        using std::placeholders::_4;
         Robot::getInstance()->compensationTransform = std::bind(&CartGridStrategy::doCompensation, this, _1, _2); // [this](float *target, bool inverse) { doCompensation(target, inverse); };
+        if(adaptive_segmentation) {
+            Robot::getInstance()->compensationSegmenter = std::bind(&CartGridStrategy::find_splits, this, _1, _2, _3, _4);
+        }
     } else {
         // clear it
+        Robot::getInstance()->compensationSegmenter = nullptr;
         Robot::getInstance()->reset_compensated_machine_position();
     }
 }
@@ -533,9 +574,25 @@ bool CartGridStrategy::findBed(float x, float y)
     return true;
 }
 
+// probe at x,y (probe position in MCS) and return the distance moved from the probe height in mm
+bool CartGridStrategy::probe_point(float &mm, float x, float y, float z_start, bool scan)
+{
+    if(!scan) {
+        return zprobe->doProbeAt(mm, x - X_PROBE_OFFSET_FROM_EXTRUDER, y - Y_PROBE_OFFSET_FROM_EXTRUDER);
+    }
+
+    float z;
+    if(!zprobe->scan_probe_at(z, x - X_PROBE_OFFSET_FROM_EXTRUDER, y - Y_PROBE_OFFSET_FROM_EXTRUDER, z_start, scan_lift)) return false;
+    mm = z_start - z;
+    return true;
+}
+
 bool CartGridStrategy::doProbe(GCode& gcode, OutputStream& os)
 {
     bool use_wcs= false;
+    bool scan= pipelined_scan;
+    if(gcode.has_arg('S')) scan= (gcode.get_int_arg('S') == 1);
+
     os.printf("Rectangular Grid Probe...\n");
 
     // if R1 then force only_by_two_corners using current position for start point
@@ -601,9 +658,13 @@ bool CartGridStrategy::doProbe(GCode& gcode, OutputStream& os)
 
     os.printf("Probe start ht: %0.3f mm, start MCS x,y: %0.3f,%0.3f, rectangular bed width,height in mm: %0.3f,%0.3f, grid size: %dx%d\n", zprobe->getProbeHeight(), x_start, y_start, x_size, y_size, current_grid_x_size, current_grid_y_size);
 
+    // the height findBed left us at, every probe starts from here
+    float z_start= Robot::getInstance()->get_axis_position(Z_AXIS);
+    if(scan) os.printf("Using pipelined scan\n");
+
     // do first probe at start point
     float mm;
-    if(!zprobe->doProbeAt(mm, this->x_start - X_PROBE_OFFSET_FROM_EXTRUDER, this->y_start - Y_PROBE_OFFSET_FROM_EXTRUDER)) return false;
+    if(!probe_point(mm, this->x_start, this->y_start, z_start, scan)) return false;
     float z_reference = zprobe->getProbeHeight() - mm; // this should be zero
     os.printf("probe at 0,0 is %1.3f mm\n", z_reference);
 
@@ -627,7 +688,7 @@ bool CartGridStrategy::doProbe(GCode& gcode, OutputStream& os)
         for (int xCount = xStart; xCount != xStop; xCount += xInc) {
             float xProbe = this->x_start + (this->x_size / (this->current_grid_x_size - 1)) * xCount;
 
-            if(!zprobe->doProbeAt(mm, xProbe - X_PROBE_OFFSET_FROM_EXTRUDER, yProbe - Y_PROBE_OFFSET_FROM_EXTRUDER)){
+            if(!probe_point(mm, xProbe, yProbe, z_start, scan)){
                 return false;
             }
 
@@ -638,6 +699,11 @@ bool CartGridStrategy::doProbe(GCode& gcode, OutputStream& os)
         }
     }
 
+    if(scan) {
+        // the scan leaves the probe on the bed, so return to the start height
+        zprobe->move_z(z_start, zprobe->getFastFeedrate());
+    }
+
     print_bed_level(os);
     os.printf("Maximum delta: %1.3f\n", max_delta);
     setAdjustFunction(true);
@@ -647,7 +713,7 @@ bool CartGridStrategy::doProbe(GCode& gcode, OutputStream& os)
 
 void CartGridStrategy::doCompensation(float *target, bool inverse)
 {
-    // Adjust print surface height by linear interpolation over the bed_level array.
+    // Adjust print surface height by interpolation over the precalculated mesh.
     // offset scale: 1 for default (use offset as is)
     float scale = 1.0F;
     if (this->damping_interval > 0.001F) {
@@ -662,32 +728,7 @@ void CartGridStrategy::doCompensation(float *target, bool inverse)
         }
     }
 
-    // find min/maxes, and handle the case where size is negative (assuming this is possible? Legacy code supported this)
-    float min_x = std::min(this->x_start, this->x_start + this->x_size);
-    float max_x = std::max(this->x_start, this->x_start + this->x_size);
-    float min_y = std::min(this->y_start, this->y_start + this->y_size);
-    float max_y = std::max(this->y_start, this->y_start + this->y_size);
-
-    // clamp the input to the bounds of the compensation grid
-    // if a point is beyond the bounds of the grid, it will get the offset of the closest grid point
-    float x_target = std::min(std::max(target[X_AXIS], min_x), max_x);
-    float y_target = std::min(std::max(target[Y_AXIS], min_y), max_y);
-
-    // we need to make sure that floor_x and floor_y are always < grid_size-1
-    float grid_x = std::max(0.001F, std::min(this->current_grid_x_size - 1.001F, (x_target - this->x_start) / (this->x_size / (this->current_grid_x_size - 1))));
-    float grid_y = std::max(0.001F, std::min(this->current_grid_y_size - 1.001F, (y_target - this->y_start) / (this->y_size / (this->current_grid_y_size - 1))));
-
-    int floor_x = floorf(grid_x);
-    int floor_y = floorf(grid_y);
-    float ratio_x = grid_x - floor_x;
-    float ratio_y = grid_y - floor_y;
-    float z1 = grid[(floor_x) + ((floor_y) * this->current_grid_x_size)];
-    float z2 = grid[(floor_x) + ((floor_y + 1) * this->current_grid_x_size)];
-    float z3 = grid[(floor_x + 1) + ((floor_y) * this->current_grid_x_size)];
-    float z4 = grid[(floor_x + 1) + ((floor_y + 1) * this->current_grid_x_size)];
-    float left = (1 - ratio_y) * z1 + ratio_y * z2;
-    float right = (1 - ratio_y) * z3 + ratio_y * z4;
-    float offset = (1 - ratio_x) * left + ratio_x * right;
+    float offset = mesh_offset(target[X_AXIS], target[Y_AXIS]);
 
     // handle case where the grid was incomplete (should never happen)
     if(isnan(offset)) return;
@@ -697,25 +738,177 @@ void CartGridStrategy::doCompensation(float *target, bool inverse)
     } else {
         target[Z_AXIS] += (offset * scale);
     }
+}
 
-    /*THEKERNEL->streams->printf("//DEBUG: TARGET: %f, %f, %f\n", target[0], target[1], target[2]);
-     THEKERNEL->streams->printf("//DEBUG: grid_x= %f\n", grid_x);
-     THEKERNEL->streams->printf("//DEBUG: grid_y= %f\n", grid_y);
-     THEKERNEL->streams->printf("//DEBUG: floor_x= %d\n", floor_x);
-     THEKERNEL->streams->printf("//DEBUG: floor_y= %d\n", floor_y);
-     THEKERNEL->streams->printf("//DEBUG: ratio_x= %f\n", ratio_x);
-     THEKERNEL->streams->printf("//DEBUG: ratio_y= %f\n", ratio_y);
-     THEKERNEL->streams->printf("//DEBUG: z1= %f\n", z1);
-     THEKERNEL->streams->printf("//DEBUG: z2= %f\n", z2);
-     THEKERNEL->streams->printf("//DEBUG: z3= %f\n", z3);
-     THEKERNEL->streams->printf("//DEBUG: z4= %f\n", z4);
-     THEKERNEL->streams->printf("//DEBUG: left= %f\n", left);
-     THEKERNEL->streams->printf("//DEBUG: right= %f\n", right);
-     THEKERNEL->streams->printf("//DEBUG: offset= %f\n", offset);
-     THEKERNEL->streams->printf("//DEBUG: scale= %f\n", scale);
-     */
+// calculate the interpolation coefficients for each cell of the grid, done whenever a grid is probed or loaded
+void CartGridStrategy::build_mesh()
+{
+    const int nx = current_grid_x_size;
+    const int ny = current_grid_y_size;
+
+    // handles the case where size is negative
+    inv_cell_x = (nx - 1) / x_size;
+    inv_cell_y = (ny - 1) / y_size;
+
+    auto z = [this, nx](int x, int y) { return grid[x + (nx * y)]; };
+    // slopes at a grid point in grid units, central difference inside the grid and one sided at the edges
+    auto dx = [nx, &z](int x, int y) {
+        if(x == 0) return z(1, y) - z(0, y);
+        if(x == nx - 1) return z(x, y) - z(x - 1, y);
+        return (z(x + 1, y) - z(x - 1, y)) / 2;
+    };
+    auto dy = [ny, &z](int x, int y) {
+        if(y == 0) return z(x, 1) - z(x, 0);
+        if(y == ny - 1) return z(x, y) - z(x, y - 1);
+        return (z(x, y + 1) - z(x, y - 1)) / 2;
+    };
+    auto dxy = [ny, &dx](int x, int y) {
+        if(y == 0) return dx(x, 1) - dx(x, 0);
+        if(y == ny - 1) return dx(x, y) - dx(x, y - 1);
+        return (dx(x, y + 1) - dx(x, y - 1)) / 2;
+    };
+
+    // hermite basis, converts the values and slopes at both ends of a cell to polynomial coefficients
+    static const float h[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+
+    for (int cy = 0; cy < ny - 1; cy++) {
+        for (int cx = 0; cx < nx - 1; cx++) {
+            if(!bicubic) {
+                float *c = &mesh[(cx + ((nx - 1) * cy)) * 4];
+                c[0] = z(cx, cy);
+                c[1] = z(cx + 1, cy) - z(cx, cy);
+                c[2] = z(cx, cy + 1) - z(cx, cy);
+                c[3] = z(cx + 1, cy + 1) - z(cx + 1, cy) - z(cx, cy + 1) + z(cx, cy);
+                continue;
+            }
+
+            const float f[4][4] = {
+                {z(cx, cy),      z(cx, cy + 1),      dy(cx, cy),      dy(cx, cy + 1)},
+                {z(cx + 1, cy),  z(cx + 1, cy + 1),  dy(cx + 1, cy),  dy(cx + 1, cy + 1)},
+                {dx(cx, cy),     dx(cx, cy + 1),     dxy(cx, cy),     dxy(cx, cy + 1)},
+                {dx(cx + 1, cy), dx(cx + 1, cy + 1), dxy(cx + 1, cy), dxy(cx + 1, cy + 1)}
+            };
+
+            // c = h * f * h', c[i*4+j] is the coefficient of u^i v^j
+            float t[4][4];
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    t[i][j] = h[i][0] * f[0][j] + h[i][1] * f[1][j] + h[i][2] * f[2][j] + h[i][3] * f[3][j];
+                }
+            }
+            float *c = &mesh[(cx + ((nx - 1) * cy)) * 16];
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    c[i * 4 + j] = t[i][0] * h[j][0] + t[i][1] * h[j][1] + t[i][2] * h[j][2] + t[i][3] * h[j][3];
+                }
+            }
+        }
+    }
+}
+
+// get the compensation offset at x,y from the mesh, beyond the bounds of the grid it will get the offset at the closest edge
+float CartGridStrategy::mesh_offset(float x, float y) const
+{
+    const int nx = current_grid_x_size;
+    const int ny = current_grid_y_size;
+
+    float grid_x = std::min(std::max((x - x_start) * inv_cell_x, 0.0F), nx - 1.0F);
+    float grid_y = std::min(std::max((y - y_start) * inv_cell_y, 0.0F), ny - 1.0F);
+    int cell_x = std::min((int)grid_x, nx - 2);
+    int cell_y = std::min((int)grid_y, ny - 2);
+    float u = grid_x - cell_x;
+    float v = grid_y - cell_y;
+
+    if(!bicubic) {
+        const float *c = &mesh[(cell_x + ((nx - 1) * cell_y)) * 4];
+        return c[0] + (c[1] * u) + ((c[2] + (c[3] * u)) * v);
+    }
+
+    const float *c = &mesh[(cell_x + ((nx - 1) * cell_y)) * 16];
+    float offset = 0;
+    for (int i = 3; i >= 0; i--) {
+        const float *a = &c[i * 4];
+        offset = (offset * u) + (((a[3] * v + a[2]) * v + a[1]) * v + a[0]);
+    }
+    return offset;
 }
 
+// Find where a line from start to end needs to be split so the segments follow the compensation within segment_tolerance.
+// The surface is only smooth within a cell so the candidates are where the line crosses the grid lines, a cell that is
+// curved too much is split evenly. The splits are returned as a fraction of the line in ascending order.
+int CartGridStrategy::find_splits(const float *start, const float *end, float *splits, int max)
+{
+    // there is no compensation above the height limit
+    if(this->damping_interval > 0.001F && start[Z_AXIS] > this->height_limit && end[Z_AXIS] > this->height_limit) return 0;
+
+    const int nx = current_grid_x_size;
+    const int ny = current_grid_y_size;
+    const float dx = end[X_AXIS] - start[X_AXIS];
+    const float dy = end[Y_AXIS] - start[Y_AXIS];
+
+    // points along the line, the start, every grid line crossing and the end
+    float pts_buf[nx + ny + 2];
+    float *pts = pts_buf;
+    int npts = 0;
+    pts[npts++] = 0;
+
+    float g0 = (start[X_AXIS] - x_start) * inv_cell_x;
+    float g1 = (end[X_AXIS] - x_start) * inv_cell_x;
+    for (int k = 0; k < nx; k++) {
+        if((k > g0 && k < g1) || (k < g0 && k > g1)) pts[npts++] = (k - g0) / (g1 - g0);
+    }
+    g0 = (start[Y_AXIS] - y_start) * inv_cell_y;
+    g1 = (end[Y_AXIS] - y_start) * inv_cell_y;
+    for (int k = 0; k < ny; k++) {
+        if((k > g0 && k < g1) || (k < g0 && k > g1)) pts[npts++] = (k - g0) / (g1 - g0);
+    }
+    std::sort(pts + 1, pts + npts);
+    pts[npts++] = 1;
+
+    auto offset_at = [&](float t) { return mesh_offset(start[X_AXIS] + dx * t, start[Y_AXIS] + dy * t); };
+    float z_buf[npts];
+    float *z = z_buf;
+    for (int i = 0; i < npts; i++) {
+        z[i] = offset_at(pts[i]);
+    }
+
+    // the worst error of a straight segment from pts[a] to pts[b], checked at each crossing and the middle of each cell in between
+    auto deviation = [&](int a, int b) {
+        float slope = (z[b] - z[a]) / (pts[b] - pts[a]);
+        float dev = 0;
+        for (int i = a; i < b; i++) {
+            if(i > a) dev = std::max(dev, fabsf(z[i] - (z[a] + slope * (pts[i] - pts[a]))));
+            float t = (pts[i] + pts[i + 1]) / 2;
+            dev = std::max(dev, fabsf(offset_at(t) - (z[a] + slope * (t - pts[a]))));
+        }
+        return dev;
+    };
+
+    int n = 0;
+    int a = 0;
+    const int last = npts - 1;
+    while(a < last && n < max) {
+        // extend the segment over as many cells as possible
+        int b = a + 1;
+        while(b < last && deviation(a, b + 1) <= segment_tolerance) b++;
+
+        if(b == a + 1) {
+            // the error of a segment goes with the square of its length
+            float dev = deviation(a, b);
+            if(dev > segment_tolerance) {
+                int pieces = ceilf(sqrtf(dev / segment_tolerance));
+                for (int i = 1; i < pieces && n < max; i++) {
+                    splits[n++] = pts[a] + ((pts[b] - pts[a]) * i / pieces);
+                }
+            }
+        }
+
+        if(b < last && n < max) splits[n++] = pts[b];
+        a = b;
+    }
+
+    return n;
+}
 
 // Print calibration results for plotting or manual frame adjustment.
 void CartGridStrategy::print_bed_level(OutputStream& os)
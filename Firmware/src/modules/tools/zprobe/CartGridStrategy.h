@@ -22,10 +22,14 @@ private:
     bool handle_mcode(GCode& gcode, OutputStream& os);
 
     bool doProbe(GCode& gcode, OutputStream& os);
+    bool probe_point(float &mm, float x, float y, float z_start, bool scan);
     bool findBed(float x, float y);
     void setAdjustFunction(bool on);
     void print_bed_level(OutputStream& os);
     void doCompensation(float *target, bool inverse);
+    void build_mesh();
+    float mesh_offset(float x, float y) const;
+    int find_splits(const float *start, const float *end, float *splits, int max);
     void reset_bed_level();
     void save_grid(OutputStream& os);
     bool load_grid(OutputStream& os);
@@ -37,9 +41,14 @@ private:
     float height_limit;
     float dampening_start;
     float damping_interval;
+    float scan_lift;
+    float segment_tolerance;
     std::string before_probe, after_probe;
 
     float *grid;
+    // per cell interpolation coefficients, 4 per cell for bilinear, 16 per cell for bicubic
+    float *mesh;
+    float inv_cell_x, inv_cell_y;
     std::tuple<float, float, float> probe_offsets;
     float x_start,y_start;
     float x_size,y_size;
@@ -53,5 +62,8 @@ private:
         bool do_home:1;
         bool only_by_two_corners:1;
         bool human_readable:1;
+        bool pipelined_scan:1;
+        bool bicubic:1;
+        bool adaptive_segmentation:1;
     };
 };
@@ -56,6 +56,7 @@ bool ZProbe::create(ConfigReader& cr)
 ZProbe::ZProbe() : Module("zprobe")
 {
     probing = false;
+    scanning = false;
     invert_override = false;
 }
 
@@ -169,8 +170,17 @@ void ZProbe::read_probe()
 {
     if(!probing || probe_detected) return;
 
-    // we check all axis as it maybe a G38.2 X10 for instance, not just a probe in Z
-    if(STEPPER[X_AXIS]->is_moving() || STEPPER[Y_AXIS]->is_moving() || STEPPER[Z_AXIS]->is_moving()) {
+    bool moving;
+    if(scanning) {
+        // when scanning the lift and travel moves are queued while the probe is still triggered,
+        // so we only check while Z is moving towards the bed (direction is set for negative steps)
+        moving = STEPPER[Z_AXIS]->is_moving() && STEPPER[Z_AXIS]->which_direction() != reverse_z;
+    } else {
+        // we check all axis as it maybe a G38.2 X10 for instance, not just a probe in Z
+        moving = STEPPER[X_AXIS]->is_moving() || STEPPER[Y_AXIS]->is_moving() || STEPPER[Z_AXIS]->is_moving();
+    }
+
+    if(moving) {
         // if it is moving then we check the probe, and debounce it
         if(this->pin.get()) {
             if(debounce < debounce_ms) {
@@ -270,6 +280,64 @@ bool ZProbe::doProbeAt(float &mm, float x, float y)
     return run_probe_return(mm, slow_feedrate);
 }
 
+// Pipelined probe used when scanning a grid.
+// The lift off the bed, the travel to x,y at z_start (MCS) and the probe move are queued back to back
+// so the planner blends them and Z retracts while XY travels, the only wait is for the probe to trigger.
+// NOTE dwell_before_probing is not used as there is no stop before the probe move
+// returns the Z machine position the probe triggered at in z
+bool ZProbe::scan_probe_at(float &z, float x, float y, float z_start, float lift)
+{
+    Robot *robot = Robot::getInstance();
+
+    // enable the probe checking in the timer before queuing anything as the queue may start immediately
+    scanning = true;
+    probe_detected = false;
+    debounce = 0;
+    probing = true;
+
+    float delta[3] = {0, 0, 0};
+    if(lift > 0 && this->pin.get()) {
+        // break contact vertically before moving in XY
+        delta[Z_AXIS] = reverse_z ? -lift : lift;
+        robot->delta_move(delta, fast_feedrate, 3);
+    }
+
+    // travel to the next point, Z retracts to the start height while XY moves
+    delta[X_AXIS] = x - robot->get_axis_position(X_AXIS);
+    delta[Y_AXIS] = y - robot->get_axis_position(Y_AXIS);
+    delta[Z_AXIS] = z_start - robot->get_axis_position(Z_AXIS);
+    robot->delta_move(delta, fast_feedrate, 3);
+
+    // probe move, stopped by read_probe()
+    delta[X_AXIS] = 0;
+    delta[Y_AXIS] = 0;
+    delta[Z_AXIS] = reverse_z ? max_travel : -max_travel;
+    robot->delta_move(delta, slow_feedrate, 3);
+
+    // wait until the probe triggers or the probe move completes
+    Conveyor::getInstance()->wait_for_idle();
+
+    probing = false;
+    scanning = false;
+
+    if(Module::is_halted()) return false;
+
+    // the probe move stopped short so resync the machine position with where the actuators are
+    robot->reset_position_from_current_actuator_position();
+    z = robot->get_axis_position(Z_AXIS);
+
+    // if the probe triggered on the way down during the travel we did not get to x,y
+    if(fabsf(robot->get_axis_position(X_AXIS) - x) > 2.0F / STEPS_PER_MM(X_AXIS) ||
+       fabsf(robot->get_axis_position(Y_AXIS) - y) > 2.0F / STEPS_PER_MM(Y_AXIS)) {
+        printf("ERROR: ZProbe triggered before reaching X%1.3f Y%1.3f\n", x, y);
+        return false;
+    }
+
+    robot->set_last_probe_position(std::make_tuple(x, y, z, probe_detected ? 1 : 0));
+
+    return probe_detected;
+}
+
 bool ZProbe::handle_gcode(GCode& gcode, OutputStream& os)
 {
     // G30 can be move to predefined position if in grbl mode and nist_G30 is set
@@ -25,6 +25,7 @@ public:
     bool run_probe(float& mm, float feedrate, float max_dist= -1, bool reverse= false);
     bool run_probe_return(float& mm, float feedrate, float max_dist= -1, bool reverse= false);
     bool doProbeAt(float &mm, float x, float y);
+    bool scan_probe_at(float &z, float x, float y, float z_start, float lift);
 
     void move_xy(float x, float y, float feedrate, bool relative=false);
     void move_x(float x, float feedrate, bool relative=false);
@@ -61,6 +62,7 @@ private:
         bool probing:1;
         bool reverse_z:1;
         bool invert_override:1;
+        volatile bool scanning:1;
         volatile bool probe_detected:1;
     };
 };
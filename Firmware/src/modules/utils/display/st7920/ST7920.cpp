@@ -4,6 +4,10 @@
 #include "Pin.h"
 #include "benchmark_timer.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
 #include <cstring>
 
 // memory mapped character glyphs
@@ -140,6 +144,7 @@ static const uint8_t font5x8[] = {
 };
 
 // Use S/W SPI as it is slow anyway as it writes a nibble at a time, so the H/W SPI won't really be much faster
+// all writes are done from the display task so the waits do not hold up the command thread
 #define ST7920_CS()
 #define ST7920_NCS()
 #define ST7920_WRITE_BYTE(a)     {spi_write((uint8_t)((a)&0xf0));spi_write((uint8_t)((a)<<4));wait_us(10);}
@@ -159,7 +164,7 @@ static const uint8_t font5x8[] = {
 static void wait_us(uint32_t us)
 {
     if(us >= 10000) {
-        safe_sleep(us / 1000);
+        vTaskDelay(pdMS_TO_TICKS(us / 1000));
     } else {
         uint32_t st = benchmark_timer_start();
         while(benchmark_timer_as_us(benchmark_timer_elapsed(st)) < us) ;
@@ -194,6 +199,15 @@ ST7920::~ST7920()
     if(fb != nullptr) {
         free(fb);
     }
+    if(txfb != nullptr) {
+        free(txfb);
+    }
+    if(shadow != nullptr) {
+        free(shadow);
+    }
+    if(tx_mutex != nullptr) {
+        vSemaphoreDelete((SemaphoreHandle_t)tx_mutex);
+    }
     if(clk != nullptr) {
         delete clk;
     }
@@ -228,12 +242,21 @@ bool ST7920::configure(ConfigReader& cr)
     printf("DEBUG:config_st7920: spi mosi pin: %s\n", mosi->to_string().c_str());
 
 
-    fb = (uint8_t *)malloc(FB_SIZE); // grab some memory for the frame buffer
-    if(fb == nullptr) {
+    // grab some memory for the frame buffer and the copies used to only send what changed
+    fb = (uint8_t *)malloc(FB_SIZE);
+    txfb = (uint8_t *)malloc(FB_SIZE);
+    shadow = (uint8_t *)malloc(FB_SIZE);
+    if(fb == nullptr || txfb == nullptr || shadow == nullptr) {
         printf("ERROR:config_st7920: Not enough memory available for frame buffer");
         return false;
     }
 
+    tx_mutex = xSemaphoreCreateMutex();
+    if(tx_mutex == nullptr) {
+        printf("ERROR:config_st7920: could not create mutex\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -253,8 +276,28 @@ void ST7920::initDisplay()
 {
     if(fb == NULL) return;
 
-    ST7920_CS();
     clearScreen();  // clear framebuffer
+    if(task_handle == nullptr) {
+        // lower priority than the command thread so it only sends when the command thread is waiting
+        if(xTaskCreate(display_task, "ST7920", 1000 / 4, this, (tskIDLE_PRIORITY + 1UL), (TaskHandle_t *)&task_handle) != pdPASS) {
+            printf("ERROR: ST7920 failed to create display task\n");
+        }
+    }
+}
+
+void ST7920::display_task(void *arg)
+{
+    ST7920 *st = static_cast<ST7920*>(arg);
+    st->init_lcd();
+    while(true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        st->update_display();
+    }
+}
+
+void ST7920::init_lcd()
+{
+    ST7920_CS();
     wait_us(90000);                 //initial delay for boot up
     ST7920_SET_CMD();
     ST7920_WRITE_BYTE(0x08);       //display off, cursor+blink off
@@ -272,7 +315,49 @@ void ST7920::initDisplay()
     }
     ST7920_WRITE_BYTE(0x0C); //display on, cursor+blink off
     ST7920_NCS();
-    inited = true;
+    memset(shadow, 0, FB_SIZE);
+}
+
+// sends the refreshed rows that differ from what is on the display
+void ST7920::update_display()
+{
+    xSemaphoreTake((SemaphoreHandle_t)tx_mutex, portMAX_DELAY);
+    uint64_t rows = pending_rows;
+    pending_rows = 0;
+    xSemaphoreGive((SemaphoreHandle_t)tx_mutex);
+
+    for (int y = 0; y < HEIGHT; ++y) {
+        if((rows & (1ULL << y)) == 0) continue;
+
+        uint8_t row[WIDTH / 8];
+        // if refresh() updates the row after this it is in pending_rows again and gets sent next time
+        xSemaphoreTake((SemaphoreHandle_t)tx_mutex, portMAX_DELAY);
+        memcpy(row, &txfb[y * (WIDTH / 8)], WIDTH / 8);
+        xSemaphoreGive((SemaphoreHandle_t)tx_mutex);
+
+        // the display is addressed in 16 bit words so only send from the first to the last word that changed
+        uint8_t *s = &shadow[y * (WIDTH / 8)];
+        int w0 = 0, w1 = WIDTH / 16 - 1;
+        while(w0 <= w1 && row[w0 * 2] == s[w0 * 2] && row[w0 * 2 + 1] == s[w0 * 2 + 1]) ++w0;
+        if(w0 > w1) continue;
+        while(row[w1 * 2] == s[w1 * 2] && row[w1 * 2 + 1] == s[w1 * 2 + 1]) --w1;
+
+        send_row(y, &row[w0 * 2], w0, w1);
+        memcpy(&s[w0 * 2], &row[w0 * 2], (w1 - w0 + 1) * 2);
+    }
+}
+
+// the bottom half of the screen is to the right of the top half in GDRAM
+void ST7920::send_row(int y, const uint8_t *data, int w0, int w1)
+{
+    ST7920_CS();
+    ST7920_SET_CMD();
+    ST7920_WRITE_BYTE(0x80 | (y % PAGE_HEIGHT));
+    ST7920_WRITE_BYTE(0x80 | ((y < PAGE_HEIGHT ? 0 : 0x08) + w0));
+    ST7920_SET_DAT();
+    int n = (w1 - w0 + 1) * 2;
+    ST7920_WRITE_BYTES(data, n); // data gets incremented in this macro
+    ST7920_NCS();
 }
 
 int16_t ST7920::width(void) const
@@ -289,7 +374,19 @@ void ST7920::clearScreen()
 {
     if(fb == NULL) return;
     memset(fb, 0, FB_SIZE);
-    dirty = true;
+    mark_dirty(0, HEIGHT);
+}
+
+void ST7920::mark_dirty(int y, int h)
+{
+    if(y < 0) {
+        h += y;
+        y = 0;
+    }
+    if(y + h > HEIGHT) h = HEIGHT - y;
+    for (int i = y; i < y + h; ++i) {
+        dirty_rows |= (1ULL << i);
+    }
 }
 
 // render into local screenbuffer
@@ -299,7 +396,7 @@ void ST7920::displayString(int row, int col, const char *ptr, int length)
         displayChar(row, col, ptr[i]);
         col += 1;
     }
-    dirty = true;
+    mark_dirty(row * 8, 8);
 }
 
 void ST7920::renderChar(uint8_t *f, char c, int ox, int oy)
@@ -360,7 +457,7 @@ void ST7920::renderGlyph(int xp, int yp, const uint8_t *g, int pixelWidth, int p
         // if(rf != 0) {
 
         // }
-        dirty = true;
+        mark_dirty(yp, pixelHeight);
         return;
     }
 
@@ -383,7 +480,7 @@ void ST7920::renderGlyph(int xp, int yp, const uint8_t *g, int pixelWidth, int p
             }
         }
     }
-    dirty = true;
+    mark_dirty(yp, pixelHeight);
 }
 
 // displays a selectable rectangle from the glyph
@@ -410,32 +507,24 @@ void ST7920::bltGlyph(int x, int y, int w, int h, const uint8_t *glyph, int span
     }
 }
 
-// copy frame buffer to graphic buffer on display
-void ST7920::fillGDRAM(const uint8_t *bitmap)
+void ST7920::refresh()
 {
-    unsigned char i, y;
-    for ( i = 0 ; i < 2 ; i++ ) {
-        ST7920_CS();
-        for ( y = 0 ; y < PAGE_HEIGHT ; y++ ) {
-            ST7920_SET_CMD();
-            ST7920_WRITE_BYTE(0x80 | y);
-            if ( i == 0 ) {
-                ST7920_WRITE_BYTE(0x80);
-            } else {
-                ST7920_WRITE_BYTE(0x80 | 0x08);
-            }
-            ST7920_SET_DAT();
-            ST7920_WRITE_BYTES(bitmap, WIDTH / 8); // bitmap gets incremented in this macro
+    if(fb == NULL || dirty_rows == 0) return;
+
+    // the display task only holds the lock while it copies a single row out of txfb
+    xSemaphoreTake((SemaphoreHandle_t)tx_mutex, portMAX_DELAY);
+    for (int y = 0; y < HEIGHT; ++y) {
+        if((dirty_rows & (1ULL << y)) != 0) {
+            memcpy(&txfb[y * (WIDTH / 8)], &fb[y * (WIDTH / 8)], WIDTH / 8);
         }
-        ST7920_NCS();
     }
-}
+    pending_rows |= dirty_rows;
+    xSemaphoreGive((SemaphoreHandle_t)tx_mutex);
+    dirty_rows = 0;
 
-void ST7920::refresh()
-{
-    if(!inited || !dirty) return;
-    fillGDRAM(this->fb);
-    dirty = false;
+    if(task_handle != nullptr) {
+        xTaskNotifyGive((TaskHandle_t)task_handle);
+    }
 }
 
 void ST7920::drawByte(int index, uint8_t mask, int color)
@@ -447,7 +536,7 @@ void ST7920::drawByte(int index, uint8_t mask, int color)
     } else {
         fb[index] ^= mask;
     }
-    dirty = true;
+    dirty_rows |= (1ULL << (index / (WIDTH / 8)));
 }
 
 void ST7920::pixel(int x, int y, int color)
@@ -524,7 +613,6 @@ void ST7920::displayAFString(int x, int y, int color, const char *ptr, int lengt
         int w = drawAFChar(x, y, ptr[i], color);
         x += (w + 1);
     }
-    dirty = true;
 }
 
 void ST7920::charBounds(unsigned char c, int16_t *x, int16_t *y,
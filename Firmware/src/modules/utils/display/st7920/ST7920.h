@@ -19,13 +19,13 @@ public:
     static bool create(ConfigReader& cr);
     bool configure(ConfigReader& cr);
 
+    // starts the display task which initializes the display then sends it the frame buffer on each refresh
     void initDisplay(void);
     void clearScreen(void);
     void displayString(int row, int column, const char *ptr, int length);
+    // queues the rows changed since the last refresh to be sent by the display task, it does not wait for them to be sent
     void refresh();
 
-    void fillGDRAM(const uint8_t *bitmap);
-
     // copy the bits in g, of X line size pixels, to x, y in frame buffer
     void renderGlyph(int x, int y, const uint8_t *g, int pixelWidth, int pixelHeight);
     void bltGlyph(int x, int y, int w, int h, const uint8_t *glyph, int span, int x_offset, int y_offset);
@@ -66,6 +66,12 @@ private:
     void drawByte(int index, uint8_t mask, int color);
     int drawAFChar(int x, int y, uint8_t c, int color);
 
+    void mark_dirty(int y, int h);
+    static void display_task(void *arg);
+    void init_lcd();
+    void update_display();
+    void send_row(int y, const uint8_t *data, int w0, int w1);
+
     void spi_write(uint8_t v);
     const GFXfont *gfxFont{nullptr};
 
@@ -73,7 +79,11 @@ private:
     Pin *mosi{nullptr};
     // Pin *miso{nullptr};
     uint8_t *fb{nullptr};
-    bool inited{false};
-    bool dirty{false};
+    uint8_t *txfb{nullptr};   // copy of the frame buffer taken at the last refresh, this is what the display task sends
+    uint8_t *shadow{nullptr}; // what is currently on the display
+    void *task_handle{nullptr};
+    void *tx_mutex{nullptr};  // guards txfb and pending_rows between refresh() and the display task
+    uint64_t dirty_rows{0};   // one bit per row drawn to since the last refresh
+    uint64_t pending_rows{0}; // rows refreshed but not yet looked at by the display task
 };
 
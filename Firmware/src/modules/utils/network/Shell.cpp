@@ -75,6 +75,7 @@ static void close_shell(shell_t *p_shell)
 
     FreeRTOS_FD_CLR(p_shell->socket, p_shell->ss, eSELECT_ALL);
     FreeRTOS_closesocket(p_shell->socket);
+    set_status_subscriber(p_shell->os, false);
 
     // if we delete the OutputStream now and command thread is still outputting stuff we will crash
     // it needs to stick around until the command has completed
@@ -11,6 +11,7 @@
 #include "main.h"
 #include "MessageQueue.h"
 #include "Consoles.h"
+#include "HeatshrinkReader.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -53,6 +54,7 @@ Player::Player() : Module("player")
 {
     this->playing_file = false;
     this->current_file_handler = nullptr;
+    this->decoder = nullptr;
     this->booted = false;
     this->start_ticks = 0;
     this->reply_os = nullptr;
@@ -269,7 +271,7 @@ bool Player::play_command( std::string& params, OutputStream& os )
     this->filename = params;
 
     if(this->current_file_handler != nullptr) { // must have been a paused print
-        fclose(this->current_file_handler);
+        close_file();
     }
 
     this->current_file_handler = fopen( this->filename.c_str(), "r");
@@ -278,6 +280,16 @@ bool Player::play_command( std::string& params, OutputStream& os )
         return true;
     }
 
+    if(HeatshrinkReader::is_compressed(this->filename.c_str())) {
+        // compressed files are decompressed as they are played
+        this->decoder = new HeatshrinkReader(this->current_file_handler);
+        if(!this->decoder->is_ok()) {
+            close_file();
+            os.printf("Not enough memory to decompress: %s\n", this->filename.c_str());
+            return true;
+        }
+    }
+
     os.printf("Playing %s\n", this->filename.c_str());
 
     if( options.find_first_of("Pp") == std::string::npos ) {
@@ -485,6 +497,26 @@ void Player::in_command_ctx(bool idle)
     }
 }
 
+char *Player::read_line(char *buf, int size)
+{
+    if(decoder != nullptr) return decoder->gets(buf, size);
+    return fgets(buf, size, current_file_handler);
+}
+
+bool Player::is_eof() const
+{
+    if(decoder != nullptr) return decoder->eof();
+    return feof(current_file_handler);
+}
+
+void Player::close_file()
+{
+    delete decoder;
+    decoder = nullptr;
+    fclose(current_file_handler);
+    current_file_handler = nullptr;
+}
+
 void Player::player_thread()
 {
     printf("DEBUG: Player thread starting\n");
@@ -494,7 +526,7 @@ void Player::player_thread()
     bool discard = false;
     uint32_t linecnt = 0;
 
-    while(fgets(buf, sizeof(buf), this->current_file_handler) != NULL) {
+    while(read_line(buf, sizeof(buf)) != NULL) {
         while(!playing_file && !abort_thread && !Module::is_halted()) {
             // we must be paused
             vTaskDelay(pdMS_TO_TICKS(200)); // sleep and yield
@@ -509,7 +541,7 @@ void Player::player_thread()
         int len = strlen(buf);
         if(len == 0) continue; // empty line? should not be possible
         // TODO remove \r\n
-        if(buf[len - 1] == '\n' || feof(this->current_file_handler)) {
+        if(buf[len - 1] == '\n' || is_eof()) {
             if(discard) { // we are discarding a long line
                 discard = false;
                 continue;
@@ -533,7 +565,8 @@ void Player::player_thread()
 
             send_message_queue(buf, &nullos);
 
-            played_cnt += len;
+            // for compressed files the progress is how much of the file has been read as file_size is the compressed size
+            played_cnt = (decoder != nullptr) ? decoder->get_consumed() : played_cnt + len;
 
             if((++linecnt % 100) == 0) {
                 // yield to some other threads every 100 lines or so
@@ -552,8 +585,7 @@ void Player::player_thread()
     this->filename = "";
     played_cnt = 0;
     file_size = 0;
-    fclose(this->current_file_handler);
-    current_file_handler = nullptr;
+    close_file();
     this->current_os = nullptr;
 
     printf("DEBUG: Player thread exiting\n");
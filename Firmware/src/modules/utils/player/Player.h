@@ -9,6 +9,7 @@
 
 class OutputStream;
 class GCode;
+class HeatshrinkReader;
 
 class Player : public Module {
     public:
@@ -34,6 +35,9 @@ class Player : public Module {
         void suspend_part2();
         static void play_thread(void *);
         void player_thread();
+        char *read_line(char *buf, int size);
+        bool is_eof() const;
+        void close_file();
         static OutputStream nullos;
         static Player *instance;
         std::string filename;
@@ -44,6 +48,7 @@ class Player : public Module {
         OutputStream *reply_os;
 
         FILE* current_file_handler;
+        HeatshrinkReader *decoder;
         long file_size;
         unsigned long played_cnt;
         unsigned long start_ticks;
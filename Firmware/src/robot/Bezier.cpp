@@ -0,0 +1,74 @@
+#include "Bezier.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+constexpr float Bezier::min_dt;
+constexpr float Bezier::max_dt;
+constexpr float Bezier::max_radius;
+
+Bezier::Bezier(const float c[4][2])
+{
+    memcpy(cp, c, sizeof(cp));
+}
+
+// point on the curve at t
+void Bezier::point(float t, float pt[2]) const
+{
+    float mt = 1.0F - t;
+    float a = mt * mt * mt, b = 3 * mt * mt * t, c = 3 * mt * t * t, d = t * t * t;
+    for (int i = 0; i < 2; ++i) {
+        pt[i] = a * cp[0][i] + b * cp[1][i] + c * cp[2][i] + d * cp[3][i];
+    }
+}
+
+// radius of curvature at t, and the length of the tangent (mm per unit of t)
+float Bezier::radius(float t, float& speed) const
+{
+    float mt = 1.0F - t;
+    float d1[2], d2[2];
+    for (int i = 0; i < 2; ++i) {
+        d1[i] = 3 * mt * mt * (cp[1][i] - cp[0][i]) + 6 * mt * t * (cp[2][i] - cp[1][i]) + 3 * t * t * (cp[3][i] - cp[2][i]);
+        d2[i] = 6 * mt * (cp[2][i] - 2 * cp[1][i] + cp[0][i]) + 6 * t * (cp[3][i] - 2 * cp[2][i] + cp[1][i]);
+    }
+    speed = hypotf(d1[0], d1[1]);
+    float cross = fabsf(d1[0] * d2[1] - d1[1] * d2[0]);
+    if(cross < 1e-9F) return max_radius; // straight
+    return std::min(speed * speed * speed / cross, max_radius);
+}
+
+float Bezier::next_chord(float t, const float start[2], float max_error, float end[2], float& chord_radius) const
+{
+    // start with the chord length that gives the allowed error for the curvature here
+    float speed;
+    float r = radius(t, speed);
+    float len = r > max_error ? 2 * sqrtf(max_error * (2 * r - max_error)) : max_error;
+    // a control point on top of the start makes the tangent zero there, so start with the longest chord and let the
+    // deviation check below shorten it
+    float dt = speed > 0.0001F ? std::max(min_dt, std::min(len / speed, max_dt)) : max_dt;
+
+    // the curvature changes along the chord so check the deviation at its middle and shrink it until it is in tolerance
+    for (int n = 0; n < 8; ++n) {
+        if(t + dt > 1.0F) dt = 1.0F - t;
+        float mid[2];
+        point(t + dt, end);
+        point(t + dt / 2, mid);
+        float cx = end[0] - start[0], cy = end[1] - start[1];
+        float clen = hypotf(cx, cy);
+        float dev = clen > 0.0001F ? fabsf(cx * (mid[1] - start[1]) - cy * (mid[0] - start[0])) / clen : hypotf(mid[0] - start[0], mid[1] - start[1]);
+        if(dev <= max_error || dt <= min_dt) break;
+        dt /= 2;
+    }
+
+    float t1 = (1.0F - (t + dt) < min_dt) ? 1.0F : t + dt;
+    if(t1 == 1.0F) {
+        end[0] = cp[3][0];
+        end[1] = cp[3][1];
+    }
+
+    // the tightest curvature on the chord limits its speed
+    float s;
+    chord_radius = std::min({r, radius((t + t1) / 2, s), radius(t1, s)});
+    return t1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// A cubic bezier in a plane, split into chords for G5
+class Bezier
+{
+public:
+    // the 4 control points, start, first control point, second control point, end
+    Bezier(const float cp[4][2]);
+
+    void point(float t, float pt[2]) const;
+    float radius(float t, float& speed) const;
+
+    // Finds the next chord from t, start is the point at t. The chord length adapts to the curvature so its
+    // deviation from the curve stays within max_error. Returns the t at the end of the chord (exactly 1 for the last one),
+    // end is set to the point there and radius to the tightest radius of curvature along it.
+    float next_chord(float t, const float start[2], float max_error, float end[2], float& radius) const;
+
+    // limits for the chords in units of the curve parameter, and the radius used for a straight part of the curve
+    static constexpr float min_dt = 0.0001F;
+    static constexpr float max_dt = 0.25F;
+    static constexpr float max_radius = 1.0e6F;
+
+private:
+    float cp[4][2];
+};
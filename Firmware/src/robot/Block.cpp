@@ -48,8 +48,12 @@ void Block::clear()
     recalculate_flag    = false;
     nominal_length_flag = false;
     max_entry_speed     = 0.0F;
+    requested_speed     = 0.0F;
+    speed_limit         = 0.0F;
+    junction_speed      = 0.0F;
     is_ticking          = false;
     is_g123             = false;
+    is_g0               = false;
     locked              = false;
     s_value             = 0.0F;
 
@@ -69,6 +73,7 @@ void Block::clear()
         tick_info[i].acceleration_change = 0;
         tick_info[i].deceleration_change = 0;
         tick_info[i].plateau_rate = 0;
+        tick_info[i].hold_change = 0;
         tick_info[i].steps_to_move = 0;
         tick_info[i].step_count = 0;
         tick_info[i].next_accel_event = 0;
@@ -37,6 +37,11 @@ public:
 
     float max_entry_speed;
 
+    // needed to rescale the block for realtime overrides
+    float requested_speed;    // speed asked for before the limits, nominal_speed is this limited to speed_limit
+    float speed_limit;        // slowest of the axis and actuator speed limits for this move
+    float junction_speed;     // junction deviation limit on max_entry_speed, 0 if it uses minimum_planner_speed
+
     // this is tick info needed for this block. applies to all motors
     uint32_t accelerate_until;
     uint32_t decelerate_after;
@@ -50,6 +55,7 @@ public:
         int64_t acceleration_change; // 2.62 fixed point signed
         int64_t deceleration_change; // 2.62 fixed point
         int64_t plateau_rate; // 2.62 fixed point
+        int64_t hold_change; // 2.62 fixed point, deceleration used for a feed hold
         uint32_t steps_to_move;
         uint32_t step_count;
         uint32_t next_accel_event;
@@ -67,6 +73,7 @@ public:
         bool is_ready: 1;
         bool primary_axis: 1;                // set if this move is a primary axis
         bool is_g123: 1;                     // set if this is a G1, G2 or G3
+        bool is_g0: 1;                       // set if this is a G0
         volatile bool is_ticking: 1;         // set when this block is being actively ticked by the stepticker
         volatile bool locked: 1;             // set to true when the critical data is being updated, stepticker will have to skip if this is set
         uint16_t s_value: 12;                // for laser 1.11 Fixed point
@@ -37,6 +37,7 @@ Conveyor::Conveyor() : Module("conveyor")
     halted= false;
     continuous_mode= 0;
     hold_queue= false;
+    resume_pending= false;
 }
 
 bool Conveyor::configure(ConfigReader& cr)
@@ -65,9 +66,16 @@ void Conveyor::on_halt(bool flg)
         flush= true;
         continuous_mode= 0 ;
         hold_queue= false;
+        resume_pending= false;
     }
 }
 
+// number of blocks in the planner queue
+size_t Conveyor::get_queue_depth() const
+{
+    return PQUEUE->size();
+}
+
 // see if we are idle
 // this checks the block queue is empty, and that the step queue is empty and
 // checks that all motors are no longer moving
@@ -87,6 +95,9 @@ bool Conveyor::is_idle() const
 // This must be called in the command thread context and will stall the command thread
 void Conveyor::wait_for_idle(bool wait_for_motors)
 {
+    // anything held back for path blending has to go on the queue first
+    Robot::getInstance()->flush_blend();
+
     // wait for the job queue to empty, forcing stepticker to run them
     while (!PQUEUE->empty()) {
         check_queue(true); // forces queue to be made available to stepticker
@@ -132,6 +143,44 @@ void Conveyor::check_queue(bool force)
     }
 }
 
+// Feed hold decelerates whatever is moving to a stop along its path and holds there,
+// the queue is kept and replanned from the stop when it is released.
+// can be called from any thread, the release is done by check_feed_hold() in the command thread
+void Conveyor::feed_hold(bool f)
+{
+    if(f) {
+        resume_pending= false;
+        StepTicker::getInstance()->feed_hold();
+    } else if(is_feed_hold()) {
+        resume_pending= true;
+    }
+}
+
+bool Conveyor::is_feed_hold() const
+{
+    return StepTicker::getInstance()->is_feed_hold();
+}
+
+// called in the command thread context when it is idle or waiting
+void Conveyor::check_feed_hold()
+{
+    if(!resume_pending) return;
+
+    StepTicker *st= StepTicker::getInstance();
+    if(!st->is_feed_hold()) {
+        // a halt will have cancelled it
+        resume_pending= false;
+        return;
+    }
+
+    // wait until it has actually stopped
+    if(!st->is_held()) return;
+
+    resume_pending= false;
+    Planner::getInstance()->replan_from_stop(st->get_held_block());
+    st->resume();
+}
+
 bool Conveyor::set_continuous_mode(bool f)
 {
     if(f) {
@@ -34,9 +34,13 @@ public:
     void force_queue() { check_queue(true); }
     bool set_continuous_mode(bool flg);
     void set_hold(bool f) { hold_queue= f; }
+    void feed_hold(bool f);
+    bool is_feed_hold() const;
+    void check_feed_hold();
 
 
     float get_current_feedrate() const { return current_feedrate; }
+    size_t get_queue_depth() const;
 
     // debug function
     void dump_queue();
@@ -53,6 +57,7 @@ private:
         volatile bool running:1;
         volatile bool allow_fetch:1;
         volatile bool hold_queue:1;
+        volatile bool resume_pending:1;
         volatile uint8_t continuous_mode:2;
         bool flush:1;
         bool halted:1;
@@ -12,6 +12,7 @@
 #include "MemoryPool.h"
 
 #include <math.h>
+#include <float.h>
 #include <algorithm>
 #include <vector>
 
@@ -59,7 +60,7 @@ bool Planner::initialize(uint8_t n)
 }
 
 // Append a block to the queue, compute it's speed factors
-bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors, float rate_mm_s, float distance, float *unit_vec, float acceleration, float s_value, bool g123)
+bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors, float rate_mm_s, float speed_limit, float distance, float *unit_vec, float acceleration, float s_value, bool g123, bool g0, float arc_radius, float lookahead_mm)
 {
     // get the head block
     Block* block = queue->get_head();
@@ -91,6 +92,7 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
     // info needed by laser
     block->s_value = roundf(s_value*(1<<11)); // 1.11 fixed point
     block->is_g123 = g123;
+    block->is_g0 = g0;
 
     // use default JD
     float junction_deviation = this->xy_junction_deviation;
@@ -125,6 +127,11 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
 
     block->millimeters = distance;
 
+    // we keep the requested rate and the limit so realtime overrides can rescale the block
+    block->requested_speed = rate_mm_s;
+    block->speed_limit = speed_limit;
+    rate_mm_s = std::min(rate_mm_s, speed_limit);
+
     // Calculate speed in mm/sec for each axis. No divide by zero due to previous checks.
     if( distance > 0.0F ) {
         block->nominal_speed = rate_mm_s;           // (mm/s) Always > 0
@@ -160,7 +167,13 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
         Block *prev_block = queue->tailward_get(); // gets block prior to head, ie last block
         float previous_nominal_speed = prev_block->primary_axis ? prev_block->nominal_speed : 0;
 
-        if (junction_deviation > 0.0F && previous_nominal_speed > 0.0F) {
+        if (arc_radius > 0.0F && previous_nominal_speed > 0.0F) {
+            // this continues the arc the previous block was a chord of, so the path is smooth here
+            // and the cornering speed is what keeps the centripetal acceleration within limits, v²/r <= a
+            block->junction_speed = sqrtf(acceleration * arc_radius);
+            vmax_junction = std::min({previous_nominal_speed, block->nominal_speed, block->junction_speed});
+
+        } else if (junction_deviation > 0.0F && previous_nominal_speed > 0.0F) {
             // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
             // NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
             float cos_theta = - this->previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
@@ -175,20 +188,26 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
             // Skip and use default max junction speed for 0 degree acute junction.
             if (cos_theta <= 0.9999F) {
                 vmax_junction = std::min(previous_nominal_speed, block->nominal_speed);
+                block->junction_speed = FLT_MAX;
                 // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
                 if (cos_theta >= -0.9999F) {
                     // Compute maximum junction velocity based on maximum acceleration and junction deviation
                     float sin_theta_d2 = sqrtf(0.5F * (1.0F - cos_theta)); // Trig half angle identity. Always positive.
-                    vmax_junction = std::min(vmax_junction, sqrtf(acceleration * junction_deviation * sin_theta_d2 / (1.0F - sin_theta_d2)));
+                    block->junction_speed = sqrtf(junction_acceleration(unit_vec, acceleration) * junction_deviation * sin_theta_d2 / (1.0F - sin_theta_d2));
+                    vmax_junction = std::min(vmax_junction, block->junction_speed);
                 }
             }
         }
     }
     block->max_entry_speed = vmax_junction;
 
+    // the rest of an arc is queued straight after this chord, so the queue does not have to be able to stop at the end of
+    // this block, only at the end of the arc. Otherwise an arc of many short chords is limited by the length of the queue
+    lookahead = lookahead_mm;
+
     // Initialize block entry speed. Compute based on deceleration to user-defined minimum_planner_speed.
     float v_allowable = max_allowable_speed(-acceleration, minimum_planner_speed, block->millimeters);
-    block->entry_speed = std::min(vmax_junction, v_allowable);
+    block->entry_speed = std::min(vmax_junction, max_allowable_speed(-acceleration, newest_exit_speed(block), block->millimeters));
 
     // Initialize planner efficiency flags
     // Set flag if block will always reach maximum junction speed regardless of entry/exit speeds.
@@ -225,6 +244,7 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
         return false; // if we got a halt then we are done here
     }
 
+    head_pending = true;
     while(!queue->queue_head()) {
         // queue is full
         // stall the command thread until we have room in the queue
@@ -234,17 +254,130 @@ bool Planner::append_block(ActuatorCoordinates& actuator_pos, uint8_t n_motors,
             // we do not want to stick more stuff on the queue if we are in halt state
             // clear the block on the head
             block->clear();
+            head_pending = false;
             return false; // if we got a halt then we are done here
         }
 
         // we check the queue to see if it is ready to run
         Conveyor::getInstance()->check_queue();
     }
+    head_pending = false;
 
     return true;
 }
 
-void Planner::recalculate()
+// Rescale the blocks that have not started yet for a realtime feed or rapid override and replan them.
+// The block currently executing finishes its own trapezoid, the following blocks are not allowed to go slower
+// than they can decelerate to from the speed it exits at, so the change takes effect as soon as it physically can.
+// Called in the command thread context.
+void Planner::apply_override(float feed_ratio, float rapid_ratio)
+{
+    if(queue->empty()) return;
+
+    // walk back to the tail
+    queue->start_iteration();
+    Block *b;
+    do {
+        b = queue->tailward_get();
+    } while(!queue->is_at_tail());
+
+    // the slowest speed the next block can be entered at
+    float floor_speed = -1;
+    float prev_nominal_speed = 0;
+    bool changed = false;
+
+    // walk towards the head
+    while(true) {
+        if(!b->is_ticking) {
+            // the first one has to keep its entry speed as it joins the block that is or was just executing
+            if(floor_speed < 0) floor_speed = b->entry_speed;
+
+            // stop stepticker picking it up until we are done
+            b->locked = true;
+            float ratio = b->is_g123 ? feed_ratio : b->is_g0 ? rapid_ratio : 1.0F;
+            b->requested_speed *= ratio;
+            float nominal = std::max(std::min(b->requested_speed, b->speed_limit), floor_speed);
+            if(nominal != b->nominal_speed) {
+                b->nominal_rate *= nominal / b->nominal_speed;
+                b->nominal_speed = nominal;
+                b->nominal_length_flag = nominal <= max_allowable_speed(-b->acceleration, minimum_planner_speed, b->millimeters);
+                changed = true;
+            }
+
+            // the junction speed depends on the nominal speed of this and the previous block
+            if(b->junction_speed > 0 && prev_nominal_speed > 0) {
+                b->max_entry_speed = std::max(std::min({prev_nominal_speed, nominal, b->junction_speed}), floor_speed);
+            }
+            b->recalculate_flag = true;
+            b->locked = false;
+
+            // decelerating as hard as possible is the slowest we can get to by the end of this block
+            floor_speed = sqrtf(std::max(0.0F, floor_speed * floor_speed - 2.0F * b->acceleration * b->millimeters));
+        }
+
+        prev_nominal_speed = b->primary_axis ? b->nominal_speed : 0;
+
+        if(queue->is_at_head()) break; // that was the new block waiting to be queued
+        b = queue->headward_get();
+        if(queue->is_at_head() && !head_pending) break;
+    }
+
+    // if append_block is waiting for room the new block is still at the head and has to be included
+    if(changed) recalculate(!head_pending);
+}
+
+// Replan the queue to start from a standstill after a feed hold has stopped.
+// The block that was interrupted (if any) is cut down to the steps it has left to do and is replanned with the rest,
+// the stepticker is held so it will not touch the blocks until it is told to resume.
+// Called in the command thread context.
+void Planner::replan_from_stop(Block *held)
+{
+    if(queue->empty()) return;
+
+    Block *tail = queue->get_tail();
+    if(held != nullptr) {
+        uint32_t left = 0;
+        for (uint8_t m = 0; m < Block::n_actuators; m++) {
+            auto& ti = held->tick_info[m];
+            // steps_to_move is zeroed when the motor has finished or was stopped externally
+            uint32_t s = ti.steps_to_move == 0 ? 0 : ti.steps_to_move - ti.step_count;
+            if(s > left) left = s;
+            held->steps[m] = s;
+            ti.steps_to_move = s;
+        }
+
+        if(left == 0) {
+            // it had finished, it just needs to be discarded on resume and the next one starts from a stop
+            held->exit_speed = 0;
+
+        } else {
+            // what is left of the block, the nominal rate does not change as steps and distance scale the same
+            held->millimeters *= (float)left / held->steps_event_count;
+            held->steps_event_count = left;
+            held->nominal_length_flag = held->nominal_speed <= max_allowable_speed(-held->acceleration, minimum_planner_speed, held->millimeters);
+            held->entry_speed = 0;
+            held->is_ticking = false;
+        }
+
+    } else {
+        tail->entry_speed = 0;
+    }
+
+    // everything needs to be replanned
+    queue->start_iteration();
+    Block *b = head_pending ? queue->get_head() : queue->tailward_get();
+    while(true) {
+        b->recalculate_flag = true;
+        if(queue->is_at_tail()) break;
+        b = queue->tailward_get();
+    }
+
+    recalculate(!head_pending);
+
+    if(held != nullptr) held->is_ticking = true;
+}
+
+void Planner::recalculate(bool queued_only)
 {
     Block* previous;
     Block* current;
@@ -280,11 +413,13 @@ void Planner::recalculate()
      * For each block, given the exit speed and acceleration, find the maximum entry speed
      */
 
-    float entry_speed = minimum_planner_speed;
-
-    // start the iteration at the head
+    // start the iteration at the head, which is normally the new block about to be queued
+    // if queued_only is set we are replanning what is already on the queue so the newest is the one before the head
     queue->start_iteration();
-    current = queue->get_head();
+    Block *newest = queued_only ? queue->tailward_get() : queue->get_head();
+    current = newest;
+
+    float entry_speed = newest_exit_speed(newest);
 
     if (!queue->empty()) {
         while (!queue->is_at_tail() && current->recalculate_flag) {
@@ -303,7 +438,7 @@ void Planner::recalculate()
 
         float exit_speed = max_exit_speed(current);
 
-        while (!queue->is_at_head()) {
+        while (current != newest) {
             previous = current;
             current = queue->headward_get();
 
@@ -322,7 +457,40 @@ void Planner::recalculate()
 
     // now current points to the head item
     // which has not had calculate_trapezoid run yet
-    calculate_trapezoid(current, current->entry_speed, minimum_planner_speed);
+    calculate_trapezoid(current, current->entry_speed, newest_exit_speed(current));
+}
+
+// the newest block has to be able to stop by its end, unless more of the path is known to follow it
+float Planner::newest_exit_speed(Block *block)
+{
+    if(lookahead <= 0) return minimum_planner_speed;
+    return std::min(block->nominal_speed, max_allowable_speed(-block->acceleration, minimum_planner_speed, lookahead));
+}
+
+// The acceleration in the direction the velocity changes at a junction, limited by each axis in that direction rather than
+// by the acceleration of the move, so a corner mostly on a light axis is not held back by a heavy one.
+// Falls back to the block acceleration when the axis are not independent (delta, corexy etc)
+float Planner::junction_acceleration(const float *unit_vec, float acceleration) const
+{
+    float jv[N_PRIMARY_AXIS];
+    float len = 0;
+    for (int i = 0; i < N_PRIMARY_AXIS; ++i) {
+        jv[i] = unit_vec[i] - previous_unit_vec[i];
+        len += jv[i] * jv[i];
+    }
+    len = sqrtf(len);
+    if(len < 0.0001F) return acceleration;
+
+    float limit = FLT_MAX;
+    for (int i = 0; i < N_PRIMARY_AXIS; ++i) {
+        float c = fabsf(jv[i]) / len;
+        if(c < 0.0001F) continue;
+        float a = Robot::getInstance()->get_axis_acceleration(i);
+        if(a <= 0) return acceleration;
+        limit = std::min(limit, a / c);
+    }
+
+    return limit < FLT_MAX ? limit : acceleration;
 }
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the
@@ -520,6 +688,8 @@ void Planner::prepare(Block *block, float acceleration_in_steps, float decelerat
     // float deceleration_per_tick = deceleration_in_steps / STEP_TICKER_FREQUENCY_2;
     double acceleration_per_tick = acceleration_in_steps * fp_scale; // this is now scaled to fit a 2.62 fixed point number
     double deceleration_per_tick = deceleration_in_steps * fp_scale;
+    // a feed hold can happen anywhere in the block so it uses the full acceleration
+    double hold_per_tick = ((block->acceleration * block->steps_event_count) / block->millimeters) * fp_scale;
 
     for (uint8_t m = 0; m < Block::n_actuators; m++) {
         uint32_t steps = block->steps[m];
@@ -552,6 +722,7 @@ void Planner::prepare(Block *block, float acceleration_in_steps, float decelerat
         block->tick_info[m].acceleration_change= (int64_t)round(acceleration_change * aratio);
         block->tick_info[m].deceleration_change= -(int64_t)round(deceleration_per_tick * aratio);
         block->tick_info[m].plateau_rate= (int64_t)round(((block->maximum_rate * aratio) / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE);
+        block->tick_info[m].hold_change= -(int64_t)round(hold_per_tick * aratio);
 
         #if 0
         printf("spt: %08lX %08lX, ac: %08lX %08lX, dc: %08lX %08lX, pr: %08lX %08lX\n",
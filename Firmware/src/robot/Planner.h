@@ -33,19 +33,25 @@ private:
     Planner();
     float max_exit_speed(Block *);
     float max_allowable_speed( float acceleration, float target_velocity, float distance);
+    float newest_exit_speed(Block *);
+    float junction_acceleration(const float *unit_vec, float acceleration) const;
 
     void calculate_trapezoid(Block *, float entry_speed, float exit_speed );
     float reverse_pass(Block *, float exit_speed);
     float forward_pass(Block *, float next_entry_speed);
     void prepare(Block *, float acceleration_in_steps, float deceleration_in_steps);
 
-    bool append_block(ActuatorCoordinates& target, uint8_t n_motors, float rate_mm_s, float distance, float unit_vec[], float accleration, float s_value, bool g123);
-    void recalculate();
+    bool append_block(ActuatorCoordinates& target, uint8_t n_motors, float rate_mm_s, float speed_limit, float distance, float unit_vec[], float accleration, float s_value, bool g123, bool g0, float arc_radius, float lookahead);
+    void recalculate(bool queued_only = false);
+    void apply_override(float feed_ratio, float rapid_ratio);
+    void replan_from_stop(Block *held);
 
     double fp_scale; // optimize to store this as it does not change
 
     PlannerQueue *queue{nullptr};
+    bool head_pending{false}; // set while append_block waits for room to queue the head block
     float previous_unit_vec[N_PRIMARY_AXIS];
+    float lookahead{0}; // length of path known to follow the newest block, the rest of an arc that is being queued
 
     float xy_junction_deviation{0.05F};    // Setting
     float z_junction_deviation{-1};  // Setting
@@ -48,6 +48,11 @@ public:
         return (next(m_wIndex) == m_rIndex);
     }
 
+    size_t size() const
+    {
+        return (m_wIndex + m_size - m_rIndex) % m_size;
+    }
+
     // returns a pointer to the block at the head of the queue (always a new block)
     // this always succeeds as there is always a free block available
     Block* get_head()
@@ -22,8 +22,10 @@
 #include "Consoles.h"
 #include "OutputStream.h"
 #include "ActuatorCoordinates.h"
+#include "Bezier.h"
 
 #include <math.h>
+#include <float.h>
 #include <string>
 #include <algorithm>
 #include <tuple>
@@ -39,6 +41,7 @@
 #define  mm_per_arc_segment_key         "mm_per_arc_segment"
 #define  mm_max_arc_error_key           "mm_max_arc_error"
 #define  arc_correction_key             "arc_correction"
+#define  path_tolerance_key             "path_tolerance"
 #define  x_axis_max_speed_key           "x_axis_max_speed"
 #define  y_axis_max_speed_key           "y_axis_max_speed"
 #define  z_axis_max_speed_key           "z_axis_max_speed"
@@ -67,6 +70,7 @@
 #define ms_key                          "microstepping"
 #define microsteps_key                  "microsteps"
 #define driver_type_key                 "driver"
+#define stall_threshold_key             "stall_threshold"
 
 // only one of these for all the drivers
 #define common_key                      "common"
@@ -74,6 +78,10 @@
 #define check_driver_errors_key         "check_driver_errors"
 #define halt_on_driver_alarm_key        "halt_on_driver_alarm"
 
+// how often StallGuard is read while moving, and how long after starting to move it is ignored
+#define STALL_CHECK_FREQUENCY 100
+#define STALL_BLANK_MS 200
+
 // arm solutions
 #define  arm_solution_key               "arm_solution"
 #define  cartesian_key                  "cartesian"
@@ -90,6 +98,8 @@
 #define is_grbl_mode() Dispatcher::getInstance()->is_grbl_mode()
 
 #define ARC_ANGULAR_TRAVEL_EPSILON 5E-7F // Float (radians)
+
+#define max_compensation_splits 64 // maximum number of times a line will be split to follow the compensation
 #define PI 3.14159265358979323846F // force to be float, do not use M_PI
 
 #define DEFAULT_STEP_PIN(a)  default_stepper_pins[a][0]
@@ -132,7 +142,9 @@ Robot::Robot() : Module("robot")
     seconds_per_minute = 60.0F;
     this->clearToolOffset();
     this->compensationTransform = nullptr;
+    this->compensationSegmenter = nullptr;
     this->get_e_scale_fnc = nullptr;
+    this->get_e_rate_fnc = nullptr;
     this->wcs_offsets.fill(wcs_t(0.0F, 0.0F, 0.0F));
     this->g92_offset = wcs_t(0.0F, 0.0F, 0.0F);
     this->next_command_is_MCS = false;
@@ -187,6 +199,7 @@ bool Robot::configure(ConfigReader& cr)
 
     is_delta = false;
     is_rdelta = false;
+    is_cartesian = false;
 
     std::string solution = cr.get_string(m, arm_solution_key, "cartesian");
 
@@ -210,9 +223,11 @@ bool Robot::configure(ConfigReader& cr)
 
     } else if(solution == cartesian_key) {
         this->arm_solution = new CartesianSolution(cr);
+        is_cartesian = true;
 
     } else {
         this->arm_solution = new CartesianSolution(cr);
+        is_cartesian = true;
     }
 
     this->feed_rate = cr.get_float(m, default_feed_rate_key, 4000.0F); // mm/min
@@ -223,6 +238,7 @@ bool Robot::configure(ConfigReader& cr)
     this->mm_per_arc_segment = cr.get_float(m, mm_per_arc_segment_key, 0.0f);
     this->mm_max_arc_error = cr.get_float(m, mm_max_arc_error_key, 0.01f);
     this->arc_correction = cr.get_float(m, arc_correction_key, 5);
+    this->path_tolerance = cr.get_float(m, path_tolerance_key, 0.01f);
 
     // in mm/sec but specified in config as mm/min
     this->max_speeds[X_AXIS]  = cr.get_float(m, x_axis_max_speed_key, 60000.0F) / 60.0F;
@@ -312,6 +328,13 @@ bool Robot::configure(ConfigReader& cr)
             sm->set_microsteps(microstep);
             printf("DEBUG: configure-robot: microsteps for %s set to %d\n", s->first.c_str(), microstep);
 
+            // halt if the StallGuard reading drops below this while moving, 0 disables
+            sm->set_stall_threshold(cr.get_int(mm, stall_threshold_key, 0));
+            if(sm->get_stall_threshold() > 0) {
+                stall_monitor = true;
+                printf("DEBUG: configure-robot: stall monitor for %s set to %d\n", s->first.c_str(), sm->get_stall_threshold());
+            }
+
             // NOTE at the moment slaved actuators are only implemented for two TMC driver based boardsc
             // if this is a slaved actuator then do not register it as its master will do the setup for it
             // Only A,B,C can be slaved to X,Y,Z, and they must also be the last in the series if there is
@@ -423,6 +446,9 @@ bool Robot::configure(ConfigReader& cr)
     // also will check driver errors and standstill current reduction if enabled
     periodic_checks();
     SlowTicker::getInstance()->attach(1, std::bind(&Robot::periodic_checks, this));
+    if(stall_monitor) {
+        SlowTicker::getInstance()->attach(STALL_CHECK_FREQUENCY, std::bind(&Robot::check_stalls, this));
+    }
 #endif
 
     // register gcodes and mcodes
@@ -434,6 +460,7 @@ bool Robot::configure(ConfigReader& cr)
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 1, std::bind(&Robot::handle_motion_command, this, _1, _2));
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 2, std::bind(&Robot::handle_motion_command, this, _1, _2));
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 3, std::bind(&Robot::handle_motion_command, this, _1, _2));
+    THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 5, std::bind(&Robot::handle_motion_command, this, _1, _2));
 
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 4, std::bind(&Robot::handle_dwell, this, _1, _2));
 
@@ -456,6 +483,8 @@ bool Robot::configure(ConfigReader& cr)
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 57, std::bind(&Robot::handle_gcodes, this, _1, _2));
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 58, std::bind(&Robot::handle_gcodes, this, _1, _2));
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 59, std::bind(&Robot::handle_gcodes, this, _1, _2));
+    THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 61, std::bind(&Robot::handle_gcodes, this, _1, _2));
+    THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 64, std::bind(&Robot::handle_gcodes, this, _1, _2));
 
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 90, std::bind(&Robot::handle_gcodes, this, _1, _2));
     THEDISPATCHER->add_handler(Dispatcher::GCODE_HANDLER, 91, std::bind(&Robot::handle_gcodes, this, _1, _2));
@@ -534,6 +563,7 @@ void Robot::periodic_checks()
     }
 
     // don't check if we do not have vmot
+    // each check uses the status read in the background since the last check, and queues the next read
     if(vmot && check_driver_errors) {
         for(auto a : actuators) {
             if(a->check_driver_error() && halt_on_driver_alarm && !is_halted()) {
@@ -543,6 +573,51 @@ void Robot::periodic_checks()
         }
     }
 }
+
+// called at STALL_CHECK_FREQUENCY from the timer task while any actuator has a stall threshold
+// a StallGuard reading below the threshold means the motor has lost steps, so it halts within a few checks instead of carrying on
+void Robot::check_stalls()
+{
+    if(halted || !StepperMotor::get_vmot()) return;
+
+    // homing runs into the end on purpose
+    if(endstops_module == nullptr) endstops_module = Module::lookup("endstops");
+    bool homing = false;
+    if(endstops_module != nullptr) endstops_module->request("get_homing_status", &homing);
+
+    for (int i = 0; i < n_motors; ++i) {
+        StepperMotor *a = actuators[i];
+        if(a->get_stall_threshold() == 0) continue;
+
+        if(homing || !a->is_moving()) {
+            stall_moving_ms[i] = 0;
+            stall_count[i] = 0;
+            continue;
+        }
+
+        int sg = a->get_stallguard();
+        a->request_stallguard(); // for next time
+
+        // StallGuard is not valid until the motor is up to speed
+        if(stall_moving_ms[i] < STALL_BLANK_MS) {
+            stall_moving_ms[i] += 1000 / STALL_CHECK_FREQUENCY;
+            continue;
+        }
+
+        if(sg >= 0 && sg < a->get_stall_threshold()) {
+            // must be seen twice in a row
+            if(++stall_count[i] >= 2) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "ERROR: Stall detected on motor %c, StallGuard %d\n", i < 3 ? 'X' + i : 'A' + i - 3, sg);
+                print_to_all_consoles(buf);
+                broadcast_halt(true);
+                return;
+            }
+        } else {
+            stall_count[i] = 0;
+        }
+    }
+}
 #endif
 
 extern Pin *fets_enable_pin; // in main.cpp
@@ -554,6 +629,11 @@ void Robot::on_halt(bool flg)
 {
     halted = flg;
 
+    if(flg) {
+        // anything held back for blending is discarded
+        blend_pending = false;
+    }
+
     if(motors_enable_pin != nullptr) {
         // global enable pin for motors, disable on HALT
         motors_enable_pin->set(!flg);
@@ -901,6 +981,7 @@ bool Robot::handle_motion_command(GCode& gcode, OutputStream& os)
             case 1: motion_mode = LINEAR;  break;
             case 2: motion_mode = CW_ARC;  break;
             case 3: motion_mode = CCW_ARC; break;
+            case 5: if(gcode.get_subcode() == 0) motion_mode = BEZIER; else handled = false; break;
             default: handled = false; break;
         }
     }
@@ -914,13 +995,21 @@ bool Robot::handle_motion_command(GCode& gcode, OutputStream& os)
             // we do not support radius mode for arcs
             gcode.set_error("Radius mode not supported by G2 or G3");
 
+        } else if(motion_mode == BEZIER && (plane_axis_0 != X_AXIS || plane_axis_1 != Y_AXIS)) {
+            gcode.set_error("G5 is only supported in the XY plane (G17)");
+
+        } else if(motion_mode == BEZIER && !(gcode.has_arg('P') && gcode.has_arg('Q'))) {
+            gcode.set_error("G5 requires P and Q");
+
         } else {
             is_g123 = motion_mode != SEEK;
+            is_g0 = motion_mode == SEEK;
             process_move(gcode, motion_mode);
         }
 
     } else {
         is_g123 = false;
+        is_g0 = false;
         return false;
     }
 
@@ -1095,6 +1184,17 @@ bool Robot::handle_gcodes(GCode& gcode, OutputStream& os)
             }
             break;
 
+        case 61: // G61 exact path
+            flush_blend();
+            blend_tolerance = 0;
+            break;
+
+        case 64: // G64 Pnnn path blending, corners are rounded and near collinear moves merged within the tolerance
+            flush_blend();
+            blend_tolerance = gcode.has_arg('P') ? to_millimeters(gcode.get_arg('P')) : path_tolerance;
+            if(blend_tolerance < 0) blend_tolerance = 0;
+            break;
+
         case 90: if(gcode.get_subcode() == 0) {
                 this->absolute_mode = true;
                 this->e_absolute_mode = true;
@@ -1116,9 +1216,10 @@ bool Robot::handle_mcodes(GCode& gcode, OutputStream& os)
     if(!gcode.has_m()) return false;
 
     switch( gcode.get_code() ) {
-        // case 0: // M0 feed hold, (M0.1 is release feed hold, except we are in feed hold)
-        //     if(is_grbl_mode()) THEKERNEL->set_feed_hold(gcode.get_subcode() == 0);
-        //     break;
+        case 0: // M0 feed hold, (M0.1 is release feed hold, except we are in feed hold)
+            if(!is_grbl_mode()) break;
+            Conveyor::getInstance()->feed_hold(gcode.get_subcode() == 0);
+            break;
 
         case 30: // M30 end of program in grbl mode (otherwise it is delete sdcard file)
             if(!is_grbl_mode()) break;
@@ -1128,6 +1229,7 @@ bool Robot::handle_mcodes(GCode& gcode, OutputStream& os)
             current_wcs = 0;
             absolute_mode = true;
             seconds_per_minute = 60;
+            rapid_factor = 1.0F;
             break;
 
         case 3: // M3 is spindle on and maybe handled elsewhere, but we want to make the S parameter sticky
@@ -1323,6 +1425,16 @@ bool Robot::handle_mcodes(GCode& gcode, OutputStream& os)
 #ifdef DRIVER_TMC
 bool Robot::handle_M909(GCode& gcode, OutputStream& os)
 {
+    if(gcode.has_no_args()) {
+        // report what is set, this does not need to talk to the drivers
+        for (int i = 0; i < get_number_registered_motors(); i++) {
+            char axis = i < 3 ? 'X' + i : 'A' + i - 3;
+            os.printf("%c:1/%d ", axis, actuators[i]->get_microsteps());
+        }
+        os.printf("\n");
+        return true;
+    }
+
     for (int i = 0; i < get_number_registered_motors(); i++) {
         char axis = i < 3 ? 'X' + i : 'A' + i - 3;
         if (gcode.has_arg(axis)) {
@@ -1606,10 +1718,10 @@ int Robot::get_active_extruder() const
     return 0;
 }
 
-// process a G0/G1/G2/G3
+// process a G0/G1/G2/G3/G5
 void Robot::process_move(GCode& gcode, enum MOTION_MODE_T motion_mode)
 {
-    // we have a G0/G1/G2/G3 so extract parameters and apply offsets to get machine coordinate target
+    // we have a G0/G1/G2/G3/G5 so extract parameters and apply offsets to get machine coordinate target
     // get XYZ and one E (which goes to the selected extruder)
     float param[4] {0, 0, 0, 0};
     bool is_param[4] {false, false, false, false};
@@ -1718,16 +1830,29 @@ void Robot::process_move(GCode& gcode, enum MOTION_MODE_T motion_mode)
 
     bool moved = false;
 
+    // anything held back for blending has to go first unless this can be blended with it
+    bool blend = motion_mode == LINEAR && can_blend(target);
+    if(!blend) flush_blend();
+
     // Perform any physical actions
     switch(motion_mode) {
         case NONE: break;
 
         case SEEK:
-            moved = this->append_line(gcode, target, this->seek_rate / (compliant_seek_rate ? 60 : seconds_per_minute), delta_e );
+            moved = this->append_line(gcode, target, this->seek_rate * rapid_factor / (compliant_seek_rate ? 60 : seconds_per_minute), delta_e );
             break;
 
         case LINEAR:
-            moved = this->append_line(gcode, target, this->feed_rate / seconds_per_minute, delta_e );
+            if(blend) {
+                float rate_mm_s = this->feed_rate / seconds_per_minute;
+                if(rate_mm_s <= 0.0F) {
+                    gcode.set_error(rate_mm_s == 0 ? "Undefined feed rate" : "feed rate < 0");
+                } else {
+                    moved = this->blend_line(target, rate_mm_s);
+                }
+            } else {
+                moved = this->append_line(gcode, target, this->feed_rate / seconds_per_minute, delta_e );
+            }
             break;
 
         case CW_ARC:
@@ -1735,6 +1860,10 @@ void Robot::process_move(GCode& gcode, enum MOTION_MODE_T motion_mode)
             // Note arcs are not currently supported by extruder based machines, as 3D slicers do not use arcs (G2/G3)
             moved = this->compute_arc(gcode, offset, target, motion_mode);
             break;
+
+        case BEZIER:
+            moved = this->append_bezier(gcode, target, offset);
+            break;
     }
 
     if(moved) {
@@ -1751,6 +1880,8 @@ void Robot::process_move(GCode& gcode, enum MOTION_MODE_T motion_mode)
 // This works for cases where the Z endstop is fixed on the Z actuator and is the same regardless of where XY are.
 void Robot::reset_axis_position(float x, float y, float z)
 {
+    flush_blend();
+
     // set both the same initially
     compensated_machine_position[X_AXIS] = machine_position[X_AXIS] = x;
     compensated_machine_position[Y_AXIS] = machine_position[Y_AXIS] = y;
@@ -1842,6 +1973,7 @@ void Robot::reset_compensated_machine_position()
         // we want to leave it where we have set Z, not where it ended up AFTER compensation so
         // this should correct the Z position to the machine_position
         is_g123 = false; // we don't want the laser to fire
+        is_g0 = false;
         if(!append_milestone(machine_position, this->seek_rate / 60.0F)) {
             // if it wasn't enough to move then just reset to get everything normalized again
             reset_axis_position(machine_position[X_AXIS], machine_position[Y_AXIS], machine_position[Z_AXIS]);
@@ -1901,22 +2033,23 @@ bool Robot::append_milestone(const float target[], float rate_mm_s)
     if(!auxilliary_move && distance < 0.00001F) return false;
 
 
+    // the slowest of the speed limits for this move, the planner limits the rate to this
+    // it is kept separate so realtime overrides can rescale planned blocks without exceeding the limits
+    float speed_limit = FLT_MAX;
+
     if(!auxilliary_move) {
         for (size_t i = X_AXIS; i < N_PRIMARY_AXIS; i++) {
             // find distance unit vector for primary axis only
             unit_vec[i] = deltas[i] / distance;
 
             // Do not move faster than the configured cartesian limits for XYZ
-            if ( i <= Z_AXIS && max_speeds[i] > 0 ) {
-                float axis_speed = fabsf(unit_vec[i] * rate_mm_s);
-
-                if (axis_speed > max_speeds[i])
-                    rate_mm_s *= ( max_speeds[i] / axis_speed );
+            if ( i <= Z_AXIS && max_speeds[i] > 0 && unit_vec[i] != 0 ) {
+                speed_limit = std::min(speed_limit, max_speeds[i] / fabsf(unit_vec[i]));
             }
         }
 
-        if(this->max_speed > 0.1F && rate_mm_s > this->max_speed) {
-            rate_mm_s = this->max_speed;
+        if(this->max_speed > 0.1F) {
+            speed_limit = std::min(speed_limit, this->max_speed);
         }
     }
 
@@ -1971,16 +2104,12 @@ bool Robot::append_milestone(const float target[], float rate_mm_s)
 
     // use default acceleration to start with
     float acceleration = default_acceleration;
-    float isecs = rate_mm_s / distance;
 
     // we need to check we are not exceeding any axis maximum feedrate and/or acceleration
     if(auxilliary_move && aux_sel > 0) {
         // if only one auxilliary axis is moving then we just use its feedrate and acceleration
         // still checking that we are not exceeding its maximum feed rate
-        float actuator_rate = (fabsf(actuator_pos[aux_sel] - actuators[aux_sel]->get_last_milestone())) * isecs;
-        if (actuator_rate > actuators[aux_sel]->get_max_rate()) {
-            rate_mm_s = actuators[aux_sel]->get_max_rate();
-        }
+        speed_limit = std::min(speed_limit, actuators[aux_sel]->get_max_rate());
 
         // check acceleration, if the axis sets an acceleration, then use it
         float ma =  actuators[aux_sel]->get_acceleration(); // in mm/sec²
@@ -1989,23 +2118,28 @@ bool Robot::append_milestone(const float target[], float rate_mm_s)
         }
 
     } else {
+        // on a cartesian machine the acceleration along the move is the highest that keeps every moving actuator within
+        // its own acceleration, so a light axis with a higher acceleration set is not held back by the default.
+        // Otherwise an actuator does not move as far as the effector, so its setting can only lower the acceleration
+        float acceleration_limit = FLT_MAX;
+
         // check per-actuator speed limits
         for (size_t actuator = 0; actuator < n_motors; actuator++) {
             float d = fabsf(actuator_pos[actuator] - actuators[actuator]->get_last_milestone());
             if(d == 0 || !actuators[actuator]->is_selected()) continue; // no movement for this actuator
 
-            float actuator_rate = d * isecs;
-            if (actuator_rate > actuators[actuator]->get_max_rate()) {
-                // derate the feedrate by the amount exceeded
-                rate_mm_s *= (actuators[actuator]->get_max_rate() / actuator_rate);
-                isecs = rate_mm_s / distance;
-            }
+            // the feedrate at which this actuator would be at its maximum rate
+            speed_limit = std::min(speed_limit, actuators[actuator]->get_max_rate() * distance / d);
 
             // adjust acceleration to lowest found, for now just primary axis unless it is an auxiliary move
             // TODO we may need to do all of them, check E won't limit XYZ.. it does on long E moves, but not checking it could exceed the E acceleration.
             if(auxilliary_move || actuator < N_PRIMARY_AXIS) {
                 float ma =  actuators[actuator]->get_acceleration(); // in mm/sec²
-                if(ma > 0.0001F) {  // if axis does not have acceleration set then it uses the default_acceleration
+                if(is_cartesian) {
+                    if(ma <= 0.0001F) ma = default_acceleration; // if axis does not have acceleration set then it uses the default_acceleration
+                    acceleration_limit = std::min(acceleration_limit, ma * distance / d);
+
+                } else if(ma > 0.0001F) {  // if axis does not have acceleration set then it uses the default_acceleration
                     float ca = fabsf((d / distance) * acceleration);
                     if (ca > ma) {
                         acceleration *= ( ma / ca );
@@ -2013,15 +2147,16 @@ bool Robot::append_milestone(const float target[], float rate_mm_s)
                 }
             }
         }
+
+        if(acceleration_limit < FLT_MAX) acceleration = acceleration_limit;
     }
 
-    // if we are in feed hold wait here until it is released, this means that even segmented lines will pause
-    // TODO implement feed hold
-    // while(THEKERNEL->get_feed_hold()) {
-    //     safe_sleep(100);
-    //     // if we also got a HALT then break out of this
-    //     if(halted) return false;
-    // }
+    if(arc_radius > 0 && !auxilliary_move) {
+        // the chords follow the arc, so keep the centripetal acceleration v²/r within the acceleration
+        speed_limit = std::min(speed_limit, sqrtf(acceleration * arc_radius));
+    }
+
+    // a feed hold is done by the stepticker, moves still get queued while it is held and will run when it is released
 
     // make sure the motors are enabled
     enable_all_motors(true);
@@ -2029,7 +2164,7 @@ bool Robot::append_milestone(const float target[], float rate_mm_s)
     // Append the block to the planner
     // NOTE that distance here should be either the distance travelled by the XYZ axis, or the E mm travel if a solo E move
     // NOTE this call will block until there is room in the block queue
-    if(Planner::getInstance()->append_block( actuator_pos, n_motors, rate_mm_s, distance, auxilliary_move ? nullptr : unit_vec, acceleration, s_value, is_g123)) {
+    if(Planner::getInstance()->append_block( actuator_pos, n_motors, rate_mm_s, speed_limit, distance, auxilliary_move ? nullptr : unit_vec, acceleration, s_value, is_g123, is_g0, arc_continues ? arc_radius : 0, arc_radius > 0 ? arc_remaining : 0)) {
         // this is the new compensated machine position
         memcpy(this->compensated_machine_position, transformed_target, n_motors * sizeof(float));
         return true;
@@ -2045,6 +2180,8 @@ bool Robot::delta_move(const float * delta, float rate_mm_s, uint8_t naxis)
 {
     if(halted) return false;
 
+    flush_blend();
+
     // catch negative or zero feed rates
     if(rate_mm_s <= 0.0F) {
         return false;
@@ -2061,6 +2198,7 @@ bool Robot::delta_move(const float * delta, float rate_mm_s, uint8_t naxis)
 
     // treat it as a G0 (no laser)
     is_g123 = false;
+    is_g0 = false; // but not affected by the rapid override
     // submit for planning and if moved update machine_position
     if(append_milestone(target, rate_mm_s)) {
         memcpy(machine_position, target, n_motors * sizeof(float));
@@ -2090,22 +2228,12 @@ bool Robot::append_line(GCode & gcode, const float target[], float rate_mm_s, fl
     /*
         For extruders, we need to do some extra work to limit the volumetric rate if specified...
         If using volumetric limits we need to be using volumetric extrusion for this to work as Ennn needs to be in mm³ not mm
-        We ask Extruder to do all the work but we need to pass in the relevant data.
+        We ask the selected Extruder to do all the work but we need to pass in the relevant data.
         NOTE we need to do this before we segment the line (for deltas)
     */
-    if(delta_e != 0 && gcode.has_g() && gcode.get_code() == 1) {
+    if(delta_e != 0 && get_e_rate_fnc && gcode.has_g() && gcode.get_code() == 1) {
         // TODO maybe move this to process_params
-        float data[2] = {delta_e, rate_mm_s / millimeters_of_travel};
-        // TODO we send this to each extruder which is a waste
-        auto mv = Module::lookup_group("extruder");
-        if(mv.size() > 0) {
-            for(auto m : mv) {
-                if(m->request("get_rate", data)) {
-                    rate_mm_s *= data[1]; // adjust the feedrate
-                    break; // only one can be active the rest will return false
-                }
-            }
-        }
+        rate_mm_s *= get_e_rate_fnc(delta_e, rate_mm_s / millimeters_of_travel); // adjust the feedrate
     }
 
     // We cut the line into smaller segments. This is only needed on a cartesian robot for zgrid, but always necessary for robots with rotational axes like Deltas.
@@ -2116,6 +2244,28 @@ bool Robot::append_line(GCode & gcode, const float target[], float rate_mm_s, fl
     if(this->disable_segmentation || (!segment_z_moves && !gcode.has_arg('X') && !gcode.has_arg('Y'))) {
         segments = 1;
 
+    } else if(compensationTransform && compensationSegmenter) {
+        // the leveling strategy decides where the line needs to be split to follow the compensation
+        // so lines over flat parts of the bed are not split at all
+        float splits[max_compensation_splits];
+        int n = compensationSegmenter(machine_position, target, splits, max_compensation_splits);
+        float segment_start[n_motors];
+        float segment_end[n_motors];
+        memcpy(segment_start, machine_position, n_motors * sizeof(float));
+
+        bool moved = false;
+        for (int i = 0; i < n; i++) {
+            if(halted) return false; // don't queue any more segments
+            for (int j = 0; j < n_motors; j++)
+                segment_end[j] = segment_start[j] + (target[j] - segment_start[j]) * splits[i];
+
+            bool b = this->append_milestone(segment_end, rate_mm_s);
+            moved = moved || b;
+        }
+
+        if(this->append_milestone(target, rate_mm_s)) moved = true;
+        return moved;
+
     } else if(this->delta_segments_per_second > 1.0F) {
         // enabled if set to something > 1, it is set to 0.0 by default
         // segment based on current speed and requested segments per second
@@ -2217,6 +2367,10 @@ bool Robot::append_arc(GCode &  gcode, const float target[], const float offset[
             arc_segment = min_err_segment;
         }
     }
+    if(arc_segment <= 0) {
+        // a tiny radius with no mm_per_arc_segment set, just do it in one segment
+        arc_segment = millimeters_of_travel;
+    }
     // Figure out how many segments for this gcode
     // TODO for deltas we need to make sure we are at least as many segments as requested, also if mm_per_line_segment is set we need to use the
     uint16_t segments = ceilf(millimeters_of_travel / arc_segment);
@@ -2271,9 +2425,14 @@ bool Robot::append_arc(GCode &  gcode, const float target[], const float offset[
     // Initialize the linear axis
     arc_target[this->plane_axis_2] = this->machine_position[this->plane_axis_2];
 
+    // the chords are planned as one curved path, the junctions between them are limited by the
+    // centripetal acceleration of the arc rather than by the junction deviation of each chord
+    arc_radius = radius;
+    arc_continues = false;
+
     bool moved = false;
     for (i = 1; i < segments; i++) { // Increment (segments-1)
-        if(halted) return false; // don't queue any more segments
+        if(halted) break; // don't queue any more segments
 
         if (count < this->arc_correction ) {
             // Apply vector rotation matrix
@@ -2300,17 +2459,272 @@ bool Robot::append_arc(GCode &  gcode, const float target[], const float offset[
             arc_target[a] += abc_per_segment[a - 3];
         }
 #endif
-        // Append this segment to the queue
+        // Append this segment to the queue, the planner can count on the rest of the arc following it
+        arc_remaining = millimeters_of_travel * (segments - i) / segments;
         bool b = this->append_milestone(arc_target, rate_mm_s);
         moved = moved || b;
+        arc_continues = moved;
     }
 
     // Ensure last segment arrives at target location.
-    if(this->append_milestone(target, rate_mm_s)) moved = true;
+    arc_remaining = 0;
+    if(!halted && this->append_milestone(target, rate_mm_s)) moved = true;
+
+    arc_radius = 0;
+    arc_continues = false;
+
+    return moved && !halted;
+}
+
+// the acceleration limit of a cartesian axis, 0 if the axis is not driven by a single actuator
+float Robot::get_axis_acceleration(int axis) const
+{
+    if(!is_cartesian || axis >= n_motors) return 0;
+    float a = actuators[axis]->get_acceleration();
+    return a > 0.0001F ? a : default_acceleration;
+}
+
+// G64 path blending is only done on plain XYZ moves that go straight to the planner without segmentation
+bool Robot::can_blend(const float target[]) const
+{
+    if(blend_tolerance <= 0 || halted || disable_arm_solution || compensationTransform) return false;
+    if(delta_segments_per_second > 1.0F || mm_per_line_segment >= 0.0001F) return false;
+
+    for (int i = Z_AXIS + 1; i < n_motors; i++) {
+        if(target[i] != machine_position[i]) return false;
+    }
+
+    return true;
+}
 
+// G64 path blending. The end of each G1 is held back until the next move is known, if the vertex between them is
+// within the tolerance of a straight line it is dropped, otherwise the corner is rounded with an arc that stays within
+// the tolerance of the vertex. The held back part is queued by flush_blend() when anything else needs the queue.
+bool Robot::blend_line(const float target[], float rate_mm_s)
+{
+    const float *v = machine_position; // the end of the held back move
+    float u1[3], u2[3];
+    float l1 = 0, l2 = 0;
+    for (int i = X_AXIS; i <= Z_AXIS; i++) {
+        u1[i] = v[i] - blend_start[i];
+        u2[i] = target[i] - v[i];
+        l1 += u1[i] * u1[i];
+        l2 += u2[i] * u2[i];
+    }
+    l1 = sqrtf(l1);
+    l2 = sqrtf(l2);
+
+    if(l2 < 0.00001F) return false;
+
+    if(blend_pending && (rate_mm_s != blend_rate || s_value != blend_s_value)) {
+        // a change of speed or power has to happen at the vertex
+        flush_blend();
+    }
+
+    if(!blend_pending || l1 < 0.00001F) {
+        // nothing held back yet so just hold this one
+        memcpy(blend_start, v, sizeof(blend_start));
+        blend_rate = rate_mm_s;
+        blend_s_value = s_value;
+        blend_deviation = 0;
+        blend_pending = true;
+        want_command_ctx = true; // flushed when the command thread goes idle
+        return true;
+    }
+
+    // see how far the vertex is from a straight line from the start of the held back move to the new target
+    float w[3];
+    for (int i = X_AXIS; i <= Z_AXIS; i++) w[i] = target[i] - blend_start[i];
+    float cx = u1[1] * w[2] - u1[2] * w[1], cy = u1[2] * w[0] - u1[0] * w[2], cz = u1[0] * w[1] - u1[1] * w[0];
+    float lw = sqrtf(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    float dev = lw > 0.00001F ? sqrtf(cx * cx + cy * cy + cz * cz) / lw : l1;
+
+    for (int i = X_AXIS; i <= Z_AXIS; i++) {
+        u1[i] /= l1;
+        u2[i] /= l2;
+    }
+    float cos_phi = std::max(-1.0F, std::min(1.0F, u1[0] * u2[0] + u1[1] * u2[1] + u1[2] * u2[2]));
+
+    if(cos_phi > 0 && blend_deviation + dev <= blend_tolerance) {
+        // drop the vertex, the held back move now ends at the new target
+        blend_deviation += dev;
+        return true;
+    }
+
+    // round the corner with an arc tangent to both moves that passes within the tolerance of the vertex
+    float phi = acosf(cos_phi);
+    float d = 0, r = 0;
+    if(phi > 0.001F && phi < PI - 0.01F) {
+        float c = cosf(phi / 2);
+        r = blend_tolerance * c / (1.0F - c);
+        d = r * tanf(phi / 2);
+        // leave half of the new move for the next corner
+        float dmax = std::min(l1, l2 / 2);
+        if(d > dmax) {
+            d = dmax;
+            r = d / tanf(phi / 2);
+        }
+    }
+
+    if(d < 0.001F) {
+        // too small to round so go to the vertex
+        queue_blend_point(v);
+        memcpy(blend_start, v, sizeof(blend_start));
+
+    } else {
+        float p1[3], n[3], centre[3], pt[3];
+        float sin_phi = sinf(phi);
+        for (int i = X_AXIS; i <= Z_AXIS; i++) {
+            p1[i] = v[i] - u1[i] * d;
+            n[i] = (u2[i] - cos_phi * u1[i]) / sin_phi; // unit vector towards the centre of the arc
+            centre[i] = p1[i] + n[i] * r;
+        }
+
+        if(l1 - d > 0.00001F) queue_blend_point(p1);
+
+        // the arc is limited by centripetal acceleration the same as G2/G3
+        float err = std::min(mm_max_arc_error > 0 ? mm_max_arc_error : 0.01F, r);
+        int segments = std::max(1, std::min(16, (int)ceilf(phi / (2 * acosf(1.0F - err / r)))));
+        arc_radius = r;
+        arc_continues = true;
+        for (int k = 1; k <= segments && !halted; k++) {
+            float a = phi * k / segments;
+            for (int i = X_AXIS; i <= Z_AXIS; i++) {
+                pt[i] = centre[i] - n[i] * r * cosf(a) + u1[i] * r * sinf(a);
+            }
+            queue_blend_point(pt);
+        }
+        arc_radius = 0;
+        arc_continues = false;
+
+        // the new move is held back from the end of the arc
+        for (int i = X_AXIS; i <= Z_AXIS; i++) blend_start[i] = v[i] + u2[i] * d;
+    }
+
+    blend_deviation = 0;
+    return true;
+}
+
+// queue the XYZ position with the state of the move that was held back
+bool Robot::queue_blend_point(const float xyz[3])
+{
+    float target[n_motors];
+    memcpy(target, machine_position, n_motors * sizeof(float));
+    memcpy(target, xyz, 3 * sizeof(float));
+
+    bool g123 = is_g123, g0 = is_g0;
+    float s = s_value;
+    is_g123 = true;
+    is_g0 = false;
+    s_value = blend_s_value;
+
+    bool moved = append_milestone(target, blend_rate);
+
+    is_g123 = g123;
+    is_g0 = g0;
+    s_value = s;
     return moved;
 }
 
+// queue whatever is held back by G64 blending, must be called before anything else is queued or waits for the queue
+void Robot::flush_blend()
+{
+    if(!blend_pending) return;
+    blend_pending = false;
+    want_command_ctx = false;
+    queue_blend_point(machine_position);
+}
+
+// called in the command thread, make sure the last move gets run if nothing else is coming
+void Robot::in_command_ctx(bool idle)
+{
+    if(idle) flush_blend();
+}
+
+// G5 cubic bezier in the XY plane, I J is the first control point relative to the start, P Q the second control point relative to the end.
+// It is tessellated into chords whose length adapts to the curvature so the chord error stays within mm_max_arc_error,
+// the chords are speed limited by the curvature the same way as arcs. Other axis are moved in proportion to the length
+// travelled along the curve, like the linear axis of an arc, so they keep a constant rate relative to XY.
+bool Robot::append_bezier(GCode& gcode, const float target[], const float offset[])
+{
+    float rate_mm_s = this->feed_rate / seconds_per_minute;
+    // catch negative or zero feed rates and return the same error as GRBL does
+    if(rate_mm_s <= 0.0F) {
+        gcode.set_error(rate_mm_s == 0 ? "Undefined feed rate" : "feed rate < 0");
+        return false;
+    }
+
+    const float cp[4][2] {
+        {machine_position[X_AXIS], machine_position[Y_AXIS]},
+        {machine_position[X_AXIS] + offset[X_AXIS], machine_position[Y_AXIS] + offset[Y_AXIS]},
+        {target[X_AXIS] + to_millimeters(gcode.get_arg('P')), target[Y_AXIS] + to_millimeters(gcode.get_arg('Q'))},
+        {target[X_AXIS], target[Y_AXIS]}
+    };
+
+    Bezier bezier(cp);
+    float max_error = this->mm_max_arc_error > 0 ? this->mm_max_arc_error : 0.01F;
+
+    // machine_position is updated by each chord so keep where we started from
+    float origin[n_motors];
+    memcpy(origin, machine_position, n_motors * sizeof(float));
+
+    // the length of the curve is only known by walking the chords, so do that once first
+    float total_length = 0;
+    {
+        float start[2] {cp[0][0], cp[0][1]};
+        float t = 0;
+        while(t < 1.0F) {
+            float end[2], radius;
+            t = bezier.next_chord(t, start, max_error, end, radius);
+            total_length += hypotf(end[0] - start[0], end[1] - start[1]);
+            start[0] = end[0];
+            start[1] = end[1];
+        }
+    }
+
+    float segment_target[n_motors];
+    float start[2] {cp[0][0], cp[0][1]};
+    float t = 0;
+    float length = 0;
+    bool moved = false;
+
+    arc_continues = false;
+    while(t < 1.0F && !halted) {
+        float end[2], radius;
+        float t1 = bezier.next_chord(t, start, max_error, end, radius);
+        length += hypotf(end[0] - start[0], end[1] - start[1]);
+        if(t1 == 1.0F) {
+            memcpy(segment_target, target, n_motors * sizeof(float));
+            arc_remaining = 0;
+        } else {
+            // a curve that ends where it started with no length in XY falls back to the curve parameter
+            float fraction = total_length > 0.00001F ? length / total_length : t1;
+            for (int i = 0; i < n_motors; i++) {
+                segment_target[i] = origin[i] + (target[i] - origin[i]) * fraction;
+            }
+            segment_target[X_AXIS] = end[0];
+            segment_target[Y_AXIS] = end[1];
+            // the planner can count on the rest of the curve following this chord
+            arc_remaining = total_length - length;
+        }
+
+        // the tightest curvature on this chord limits its speed
+        arc_radius = radius;
+        if(this->append_milestone(segment_target, rate_mm_s)) moved = true;
+        arc_continues = moved;
+
+        start[0] = segment_target[X_AXIS];
+        start[1] = segment_target[Y_AXIS];
+        t = t1;
+    }
+
+    arc_radius = 0;
+    arc_remaining = 0;
+    arc_continues = false;
+
+    return moved && !halted;
+}
+
 // Do the math for an arc and add it to the queue
 bool Robot::compute_arc(GCode &  gcode, const float offset[], const float target[], enum MOTION_MODE_T motion_mode)
 {
@@ -2360,7 +2774,7 @@ void Robot::get_query_string(std::string & str) const
 {
     bool homing = false;
     bool running = false;
-    bool feed_hold = false;
+    bool feed_hold = Conveyor::getInstance()->is_feed_hold();
 
     // see if we are homing
     Module *m = Module::lookup("endstops");
@@ -2505,6 +2919,102 @@ void Robot::get_query_string(std::string & str) const
     str.append(">\n");
 }
 
+// called from the comms thread when a realtime override character is received
+// the override is applied by the command thread as it needs to replan the queue
+void Robot::request_override(uint8_t c)
+{
+    if(!override_requested) {
+        // start from the current settings
+        feed_override_request = roundf(6000.0F / seconds_per_minute);
+        rapid_override_request = roundf(rapid_factor * 100.0F);
+    }
+
+    int feed = feed_override_request;
+    switch(c) {
+        case 0x90: feed = 100; break;
+        case 0x91: feed += 10; break;
+        case 0x92: feed -= 10; break;
+        case 0x93: feed += 1; break;
+        case 0x94: feed -= 1; break;
+        case 0x95: rapid_override_request = 100; break;
+        case 0x96: rapid_override_request = 50; break;
+        case 0x97: rapid_override_request = 25; break;
+        default: return;
+    }
+
+    // same range as M220
+    feed_override_request = std::max(10, std::min(1000, feed));
+    override_requested = true;
+}
+
+// called in the command thread, rescales the moves already planned as well as setting the rate for new moves
+void Robot::apply_override_request()
+{
+    if(!override_requested) return;
+    override_requested = false;
+
+    float feed = feed_override_request;
+    float rapid = rapid_override_request / 100.0F;
+    float feed_ratio = feed * seconds_per_minute / 6000.0F;
+    float rapid_ratio = rapid / rapid_factor;
+    // G0 also uses the feed override unless the seek rate is compliant
+    if(!compliant_seek_rate) rapid_ratio *= feed_ratio;
+
+    seconds_per_minute = 6000.0F / feed;
+    rapid_factor = rapid;
+
+    if(feed_ratio != 1.0F || rapid_ratio != 1.0F) {
+        Planner::getInstance()->apply_override(feed_ratio, rapid_ratio);
+    }
+}
+
+// compact status frame pushed to status report subscribers, called once per report period
+// and the same frame is sent to all subscribers so it avoids the lookups and string building of get_query_string
+size_t Robot::get_status_frame(char *buf, size_t size) const
+{
+    // modules do not change after boot so look them up once
+    static Module *endstops = Module::lookup("endstops");
+    static std::vector<Module*> controllers = Module::lookup_group("temperature control");
+
+    bool homing = false;
+    if(endstops != nullptr) {
+        bool state;
+        if(endstops->request("get_homing_status", &state) && state) homing = true;
+    }
+
+    const char *state;
+    if(halted) state = "Alarm";
+    else if(homing) state = "Home";
+    else if(Conveyor::getInstance()->is_feed_hold()) state = "Hold";
+    else if(Conveyor::getInstance()->is_idle()) state = "Idle";
+    else state = "Run";
+
+    float mpos[3];
+    get_current_machine_position(mpos);
+    if(compensationTransform) compensationTransform(mpos, true); // get inverse compensation transform
+    Robot::wcs_t pos = mcs2wcs(mpos);
+
+    float fr = from_millimeters(Conveyor::getInstance()->get_current_feedrate() * 60.0F);
+    float fro = 6000.0F / get_seconds_per_minute();
+
+    size_t n = snprintf(buf, size, "<%s|MPos:%1.4f,%1.4f,%1.4f|WPos:%1.4f,%1.4f,%1.4f|F:%1.1f,%1.1f|Q:%u",
+                        state, from_millimeters(mpos[0]), from_millimeters(mpos[1]), from_millimeters(mpos[2]),
+                        from_millimeters(std::get<X_AXIS>(pos)), from_millimeters(std::get<Y_AXIS>(pos)), from_millimeters(std::get<Z_AXIS>(pos)),
+                        fr, fro, Conveyor::getInstance()->get_queue_depth());
+
+    for(auto c : controllers) {
+        if(n >= size) break;
+        TemperatureControl::pad_temperature_t temp;
+        if(c->request("get_current_temperature", &temp)) {
+            n += snprintf(buf + n, size - n, "|%s:%1.1f,%1.1f", temp.designator.c_str(), temp.current_temperature, temp.target_temperature);
+        }
+    }
+
+    if(n < size) n += snprintf(buf + n, size - n, ">\n");
+    if(n >= size) n = size - 1;
+    return n;
+}
+
 bool Robot::is_homed() const
 {
     Module *m = Module::lookup("endstops");
@@ -36,14 +36,18 @@ public:
     bool configure(ConfigReader&);
 
     void on_halt(bool flg);
+    void in_command_ctx(bool idle);
 
     void reset_axis_position(float position, int axis);
     void reset_axis_position(float x, float y, float z);
     void reset_actuator_position(const ActuatorCoordinates &ac);
     void reset_position_from_current_actuator_position();
     float get_seconds_per_minute() const { return seconds_per_minute; }
+    void request_override(uint8_t c);
+    void apply_override_request();
     float get_z_maxfeedrate() const { return this->max_speeds[Z_AXIS]; }
     float get_default_acceleration() const { return default_acceleration; }
+    float get_axis_acceleration(int axis) const;
     void setToolOffset(const float offset[N_PRIMARY_AXIS]);
     float get_feed_rate(int code = -1) const;
     float get_s_value() const { return s_value; }
@@ -62,10 +66,12 @@ public:
     std::tuple<float, float, float, uint8_t> get_last_probe_position() const { return last_probe_position; }
     void set_last_probe_position(std::tuple<float, float, float, uint8_t> p) { last_probe_position = p; }
     bool delta_move(const float delta[], float rate_mm_s, uint8_t naxis);
+    void flush_blend();
     uint8_t register_actuator(StepperMotor*);
     uint8_t get_number_registered_motors() const {return n_motors; }
     void enable_all_motors(bool flg);
     void get_query_string(std::string&) const;
+    size_t get_status_frame(char *buf, size_t size) const;
     void do_park(GCode& gcode, OutputStream& os);
     void reset_compensated_machine_position();
     bool is_homed() const;
@@ -82,8 +88,13 @@ public:
 
     // set by a leveling strategy to transform the target of a move according to the current plan
     std::function<void(float*, bool)> compensationTransform;
+    // optionally set by a leveling strategy to find where a line must be split to follow the compensation,
+    // fills in the split points as a fraction of the line and returns how many there are, only used while compensationTransform is set
+    std::function<int(const float*, const float*, float*, int)> compensationSegmenter;
     // set by an active extruder, returns the amount to scale the E parameter by (to convert mm³ to mm)
     std::function<float(void)> get_e_scale_fnc;
+    // set by an active extruder, given the E delta and inverse seconds of a move returns the feedrate scale needed to stay within its limits
+    std::function<float(float, float)> get_e_rate_fnc;
 
     // Workspace coordinate systems
     wcs_t mcs2wcs(const wcs_t &pos) const;
@@ -100,6 +111,7 @@ public:
         bool save_g92: 1;                                 // save g92 on M500 if set
         bool save_wcs: 1;                                 // save wcs on M500 if set
         bool is_g123: 1;
+        bool is_g0: 1;
         uint8_t plane_axis_0: 2;                          // Current plane ( XY, XZ, YZ )
         uint8_t plane_axis_1: 2;
         uint8_t plane_axis_2: 2;
@@ -117,7 +129,8 @@ private:
         SEEK, // G0
         LINEAR, // G1
         CW_ARC, // G2
-        CCW_ARC // G3
+        CCW_ARC, // G3
+        BEZIER // G5
     };
 
     bool handle_gcodes(GCode& gcode, OutputStream& os);
@@ -139,12 +152,19 @@ private:
     bool append_line(GCode& gcode, const float target[], float rate_mm_s, float delta_e);
     bool append_arc(GCode& gcode, const float target[], const float offset[], float radius, bool is_clockwise );
     bool compute_arc(GCode& gcode, const float offset[], const float target[], enum MOTION_MODE_T motion_mode);
+    bool append_bezier(GCode& gcode, const float target[], const float offset[]);
+    bool can_blend(const float target[]) const;
+    bool blend_line(const float target[], float rate_mm_s);
+    bool queue_blend_point(const float xyz[3]);
     void process_move(GCode& gcode, enum MOTION_MODE_T);
     bool is_halted() const { return halted; }
 
     void select_plane(uint8_t axis_0, uint8_t axis_1, uint8_t axis_2);
     void clearToolOffset();
     void periodic_checks();
+    #ifdef DRIVER_TMC
+    void check_stalls();
+    #endif
     void check_max_actuator_speeds(OutputStream* os);
 
     std::array<wcs_t, MAX_WCS> wcs_offsets; // these are persistent once saved with M500
@@ -164,8 +184,22 @@ private:
     float mm_per_line_segment;                           // Setting : Used to split lines into segments
     float mm_per_arc_segment;                            // Setting : Used to split arcs into segments
     float mm_max_arc_error;                              // Setting : Used to limit total arc segments to max error
+    float arc_radius{0};                                 // radius of the arc being segmented, 0 when not in an arc
+    bool arc_continues{false};                           // set once the first chord of the arc has been queued
+    float arc_remaining{0};                              // length of the arc still to be queued after the current chord
+    float blend_tolerance{0};                            // G64 P path tolerance, 0 is exact path (G61)
+    float path_tolerance;                                // Setting : tolerance used by G64 with no P
+    float blend_start[3];                                // where the held back part of the last G1 starts
+    float blend_rate;                                    // the rate, S value and deviation of the held back G1
+    float blend_s_value;
+    float blend_deviation;                               // how far dropped vertices may be from the held back G1
+    bool blend_pending{false};
     float delta_segments_per_second;                     // Setting : Used to split lines into segments for delta based on speed
     float seconds_per_minute;                            // for realtime speed change
+    float rapid_factor{1.0F};                            // realtime rapid override
+    volatile uint16_t feed_override_request;             // percent requested by the realtime override characters
+    volatile uint8_t rapid_override_request;
+    volatile bool override_requested{false};
     float default_acceleration;                          // the defualt accleration if not set for each axis
     float s_value{0};                                    // modal S value
 
@@ -188,5 +222,14 @@ private:
 
     bool is_delta{false};
     bool is_rdelta{false};
+    bool is_cartesian{true};                             // each axis is driven by its own actuator
     bool must_be_homed{false};
+
+    #ifdef DRIVER_TMC
+    // stall monitor for actuators that have a stall_threshold
+    bool stall_monitor{false};
+    Module *endstops_module{nullptr};
+    uint16_t stall_moving_ms[k_max_actuators]{0};        // how long each motor has been moving, StallGuard is ignored until it is up to speed
+    uint8_t stall_count[k_max_actuators]{0};             // consecutive readings below the threshold
+    #endif
 };
@@ -143,6 +143,20 @@ _ramfunc_  void StepTicker::unstep_tick()
     this->unstep = 0;
 }
 
+// makes any correction steps requested while nothing is running
+_ramfunc_  void StepTicker::step_corrections()
+{
+    if(Module::is_halted()) return;
+
+    uint32_t bitmsk = 1;
+    for (int i = 0; i < num_motors; i++) {
+        if(this->motor[i]->step_correction()) {
+            this->unstep |= bitmsk;
+        }
+        bitmsk <<= 1;
+    }
+}
+
 // step clock
 _ramfunc_  void StepTicker::step_tick (void)
 {
@@ -157,10 +171,43 @@ _ramfunc_  void StepTicker::step_tick (void)
 
     if(callback_fnc) {
         // call an external function
-        int m = callback_fnc();
-        if(m >= 0) {
-            // we stepped so schedule an unstep
-            unstep |= (1 << m);
+        // if we stepped schedule the unstep
+        unstep |= callback_fnc();
+    }
+
+    if(hold_requested) {
+        hold_requested = false;
+        if(running) {
+            // start decelerating the current block
+            start_hold(-1);
+        } else {
+            // nothing is moving so just stop picking up new blocks
+            current_block = nullptr;
+            hold_state = HOLD_STOPPED;
+        }
+    }
+
+    if(hold_state == HOLD_STOPPED) {
+        if(Module::is_halted()) {
+            // the queue has been flushed so there is nothing to resume
+            hold_state = HOLD_NONE;
+            resume_requested = false;
+            running = false;
+            current_tick = 0;
+            current_block = nullptr;
+
+        } else if(resume_requested) {
+            // the planner has replanned what was left of the held block (if any) to start from a standstill
+            resume_requested = false;
+            hold_state = HOLD_NONE;
+            running = start_next_block();
+
+        } else {
+            // stay where we are until resumed
+            if(unstep != 0) {
+                start_unstep_ticker();
+            }
+            return;
         }
     }
 
@@ -176,6 +223,7 @@ _ramfunc_  void StepTicker::step_tick (void)
                 return;
             }
         } else {
+            step_corrections();
             if(unstep != 0) {
                 start_unstep_ticker();
             }
@@ -185,12 +233,14 @@ _ramfunc_  void StepTicker::step_tick (void)
 
     if(Module::is_halted()) {
         running = false;
+        hold_state = HOLD_NONE;
         current_tick = 0;
         current_block = nullptr;
         return;
     }
 
     bool still_moving = false;
+    bool hold_stopped = false;
     // foreach motor, if it is active see if time to issue a step to that motor
     for (uint8_t m = 0; m < num_motors; m++) {
         auto *cur_motor = motor[m];
@@ -220,6 +270,13 @@ _ramfunc_  void StepTicker::step_tick (void)
 
         // protect against rounding errors and such
         if(cur_tick_info.steps_per_tick <= 0) {
+            if(hold_state == HOLD_DECELERATING) {
+                // the feed hold has come to a stop, the rest of this block will be replanned on resume
+                cur_tick_info.steps_per_tick = 0;
+                hold_stopped = true;
+                still_moving = true;
+                continue;
+            }
             cur_tick_info.counter = STEPTICKER_FPSCALE; // we force completion this step by setting to 1.0
             cur_tick_info.steps_per_tick = 0;
         }
@@ -256,6 +313,12 @@ _ramfunc_  void StepTicker::step_tick (void)
     // again we may only have forced steps to do
     if(!running) return;
 
+    if(hold_stopped) {
+        // all the motors will be at or very close to zero speed by now
+        hold_state = HOLD_STOPPED;
+        return;
+    }
+
     // do this after so we start at tick 0
     ++current_tick; // count number of ticks
 
@@ -267,18 +330,30 @@ _ramfunc_  void StepTicker::step_tick (void)
         // all moves finished
         current_tick = 0;
 
+        // if we are decelerating for a feed hold carry on into the next block from the speed we got to
+        double hold_rate = hold_state == HOLD_DECELERATING ? get_hold_rate() : 0;
+
         // get next block
         // do it here so there is no delay in ticks
         conveyor->block_finished();
 
         if(conveyor->get_next_block(&current_block)) { // returns false if no new block is available
             running = start_next_block(); // returns true if there is at least one motor with steps to issue
+            if(running && hold_state == HOLD_DECELERATING) {
+                start_hold(hold_rate);
+            }
 
         } else {
             current_block = nullptr;
             running = false;
         }
 
+        if(!running && hold_state == HOLD_DECELERATING) {
+            // ran out of blocks, so we stopped anyway
+            current_block = nullptr;
+            hold_state = HOLD_STOPPED;
+        }
+
         // all moves finished
         // we delegate the slow stuff to the pendsv handler which will run as soon as this interrupt exits
         //NVIC_SetPendingIRQ(PendSV_IRQn); this doesn't work
@@ -302,6 +377,7 @@ _ramfunc_ bool StepTicker::start_next_block()
         // TODO does this need to be done sooner, if so how without delaying next tick
         motor[m]->set_direction(current_block->direction_bits[m]);
         motor[m]->start_moving(); // also let motor know it is moving now
+        motor[m]->cancel_correction(); // it was for where the motor stopped last
     }
 
     current_tick = 0;
@@ -319,6 +395,36 @@ _ramfunc_ bool StepTicker::start_next_block()
     return false;
 }
 
+// only called from the step tick ISR, switches the motors of the current block to decelerate to a stop at the
+// acceleration of the block. if rate is >= 0 it is the speed carried over from the previous block
+_ramfunc_ void StepTicker::start_hold(double rate)
+{
+    for (uint8_t m = 0; m < num_motors; m++) {
+        auto& ti = current_block->tick_info[m];
+        if(ti.steps_to_move == 0) continue;
+
+        if(rate >= 0) {
+            ti.steps_per_tick = (int64_t)(rate * current_block->steps[m] / current_block->millimeters);
+        }
+        ti.acceleration_change = ti.hold_change;
+        ti.next_accel_event = UINT32_MAX; // no more ramp changes
+    }
+
+    hold_state = HOLD_DECELERATING;
+}
+
+// speed the current block is moving at in 2.62 fixed point mm per tick
+_ramfunc_ double StepTicker::get_hold_rate() const
+{
+    double rate = 0;
+    for (uint8_t m = 0; m < num_motors; m++) {
+        if(current_block->steps[m] == 0) continue;
+        double r = (double)current_block->tick_info[m].steps_per_tick / current_block->steps[m];
+        if(r > rate) rate = r;
+    }
+
+    return rate * current_block->millimeters;
+}
 
 // returns index of the stepper motor in the array and bitset
 int StepTicker::register_actuator(StepperMotor* m)
@@ -33,12 +33,19 @@ public:
     int register_actuator(StepperMotor* motor);
     float get_frequency() const { return frequency; }
     const Block *get_current_block() const { return current_block; }
+    // feed hold, these can be called from any thread
+    void feed_hold() { if(hold_state == HOLD_NONE) hold_requested = true; }
+    void resume() { if(hold_state == HOLD_STOPPED) resume_requested = true; }
+    bool is_feed_hold() const { return hold_requested || hold_state != HOLD_NONE; }
+    bool is_held() const { return hold_state == HOLD_STOPPED; }
+    // the block that was interrupted by the feed hold, only valid once held
+    Block *get_held_block() const { return hold_state == HOLD_STOPPED ? current_block : nullptr; }
     bool start();
     bool stop();
 
     // can be set by a module to get called at stepticker frequency (currently only used by Lathe module)
-    // return the motor number that needs to be unstepped if a step was made, or -1
-    std::function<int()> callback_fnc{nullptr};
+    // return a bit for each motor that needs to be unstepped if a step was made, or 0
+    std::function<uint32_t()> callback_fnc{nullptr};
 
 private:
     static StepTicker *instance;
@@ -46,10 +53,13 @@ private:
     ~StepTicker();
 
     void unstep_tick();
+    void step_corrections();
     void step_tick (void);
     bool start_unstep_ticker();
     int initial_setup(const char *dev, void *timer_handler, uint32_t per);
     bool start_next_block();
+    void start_hold(double mm_per_tick);
+    double get_hold_rate() const;
 
     static void step_timer_handler(void);
     static void unstep_timer_handler(void);
@@ -70,5 +80,9 @@ private:
     uint8_t num_motors{0};
 
     volatile bool running{false};
+    volatile bool hold_requested{false};
+    volatile bool resume_requested{false};
+    enum HOLD_STATE { HOLD_NONE, HOLD_DECELERATING, HOLD_STOPPED };
+    volatile HOLD_STATE hold_state{HOLD_NONE};
     static bool started;
 };
@@ -88,6 +88,13 @@ void StepperMotor::manual_step(bool dir)
     this->unstep();
 }
 
+bool StepperMotor::request_correction(bool dir)
+{
+    if(correction != 0) return false;
+    correction = dir ? -1 : 1;
+    return true;
+}
+
 
 #ifdef DRIVER_TMC
 // prime has TMC2590 or TMC2660 drivers so this handles the setup of those drivers
@@ -248,6 +255,18 @@ bool StepperMotor::check_driver_error()
     return false;
 }
 
+void StepperMotor::request_stallguard()
+{
+    if(tmc == nullptr) return;
+    tmc->request_stallguard();
+}
+
+int StepperMotor::get_stallguard() const
+{
+    if(tmc == nullptr) return -1;
+    return tmc->get_stallguard();
+}
+
 bool StepperMotor::init_slave(StepperMotor *sm)
 {
     // do some sanity checks that the slave and master have the same settings
@@ -42,6 +42,20 @@ class StepperMotor
         inline void stop_moving() { moving= false; }
 
         void manual_step(bool dir);
+        // asks the step ticker to move the motor one step without changing the step count, to put it back where the
+        // step count says it is. The step is made when no block is running, returns false if the last one is still pending
+        bool request_correction(bool dir);
+        void cancel_correction() { correction = 0; }
+        // called from step ticker ISR when no block is running, returns true if the step pin was set
+        inline bool step_correction() {
+            if(correction == 0) return false;
+            bool dir = correction < 0;
+            // set the direction a tick before stepping
+            if(direction != dir) { set_direction(dir); return false; }
+            step_pin.set(1);
+            correction = 0;
+            return true;
+        }
 
         inline bool which_direction() const { return direction; }
 
@@ -84,6 +98,7 @@ class StepperMotor
         float acceleration;
 
         volatile int32_t step_count;
+        volatile int8_t correction{0}; // the step request_correction asked for, cleared once it is made
         int32_t step_count_homed;
         int32_t last_milestone_steps;
         float   last_milestone_mm;
@@ -109,9 +124,16 @@ class StepperMotor
         static bool set_vmot(bool state) { bool last= vmot; vmot= state; return last; }
         static bool get_vmot() { return vmot; }
         void set_vmot_lost() { vmot_lost= true; if(p_slave!=nullptr) p_slave->vmot_lost= true; }
+        // StallGuard is read in the background, get returns the last value read or -1 if there is none
+        void request_stallguard();
+        int get_stallguard() const;
+        // lower StallGuard readings than this while moving are a stall, 0 does not check
+        void set_stall_threshold(uint16_t t) { stall_threshold= t; }
+        uint16_t get_stall_threshold() const { return stall_threshold; }
 
     private:
         uint32_t current_ma{0};
+        uint16_t stall_threshold{0};
         uint32_t tmc_type{0};
         // TMCxxxx driver
         TMCBase *tmc{nullptr};
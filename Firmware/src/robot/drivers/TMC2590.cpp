@@ -905,6 +905,8 @@ bool TMC2590::isEnabled()
  */
 void TMC2590::readStatus(int8_t read_value)
 {
+    // the background status reads also change the read selection
+    lock(true);
     unsigned long old_driver_configuration_register_value = driver_configuration_register_value;
     //reset the readout configuration
     driver_configuration_register_value &= ~(READ_SELECTION_PATTERN);
@@ -917,13 +919,13 @@ void TMC2590::readStatus(int8_t read_value)
         driver_configuration_register_value |= READ_ALL_FLAGS;
     }
 
-    // FIXME this needs to be atomic as a readStatus inbetween the two could change the results read back
     if (driver_configuration_register_value != old_driver_configuration_register_value) {
         // we need to write the value twice - one time for configuring, second time to get the value
         send20bits(driver_configuration_register_value);
     }
     //write the configuration to get the last status
     send20bits(driver_configuration_register_value);
+    lock(false);
 }
 
 //reads the stall guard setting from last status
@@ -1096,6 +1098,7 @@ void TMC2590::dump_status(OutputStream& stream, bool readable)
         }
 
         stream.printf("Enabled: %d\n", isEnabled());
+        stream.printf("Last background status read: %05lX\n", polled_status);
 
         int value = getReadoutValue();
         stream.printf("Microstep position phase A: %d\n", value);
@@ -1194,9 +1197,16 @@ const std::array<TMC2590::e_t, 6> TMC2590::tests {{
 
 // check error bits and report, only report once, and debounce the test
 // can be called from timer task or command task
-bool TMC2590::check_error_status_bits(OutputStream& stream)
+bool TMC2590::check_error_status_bits(OutputStream& stream, bool polled)
 {
-    readStatus(TMC2590_READOUT_POSITION); // get the status bits
+    if(polled) {
+        // use the status read in the background since the last check
+        if(!polled_status_valid) return false;
+        polled_status_valid = false;
+        driver_status_result = polled_status;
+    } else {
+        readStatus(TMC2590_READOUT_POSITION); // get the status bits
+    }
     // test the flags are ok
     if((driver_status_result & 0x00300) != 0){
         stream.printf("WARNING: %c: Response read appears incorrect: %05lX\n", designator, driver_status_result);
@@ -1238,7 +1248,7 @@ bool TMC2590::check_errors()
 {
     std::ostringstream oss;
     OutputStream os(&oss);
-    bool b = check_error_status_bits(os);
+    bool b = check_error_status_bits(os, true);
     if(!oss.str().empty()) {
         print_to_all_consoles(oss.str().c_str());
     }
@@ -1246,9 +1256,74 @@ bool TMC2590::check_errors()
     // see if we need to set the standstill current
     check_standstill();
 
+    // read the status for next time without holding up the caller
+    request_status();
+
     return b;
 }
 
+// queue a read of the status bits to be done by DMA, all the drivers are read in one batch and
+// check_errors() uses the result the next time it is called
+void TMC2590::request_status()
+{
+    if(!queue_status_read(0, &TMC2590::status_read)) polled_status_valid = false;
+}
+
+// StallGuard is read at a high rate while homing or monitoring for stalls so it is also done in the background
+void TMC2590::request_stallguard()
+{
+    // get_stallguard() returns -1 until a new reading arrives if this one could not be queued
+    if(!queue_status_read(READ_STALL_GUARD_READING, &TMC2590::stallguard_read)) polled_stallguard = -1;
+}
+
+// returns false if the read could not be queued, fnc is not called in that case
+bool TMC2590::queue_status_read(uint32_t selection, void (*fnc)(void *, const uint8_t *))
+{
+    // the register is also changed by the command thread, the read is just skipped this time rather than
+    // holding up the timer task if it is busy
+    if(plock != nullptr && xSemaphoreTake(plock, 0) != pdTRUE) return false;
+
+    uint32_t datagram = (driver_configuration_register_value & ~(READ_SELECTION_PATTERN)) | selection;
+    uint8_t txbuf[] {(uint8_t)(datagram >> 16), (uint8_t)(datagram >>  8), (uint8_t)(datagram & 0xff)};
+
+    bool ok = true;
+    // the status returned is selected by the previous write, so it needs an extra write if the selection changed
+    if(datagram != driver_configuration_register_value) {
+        ok = spi->queue_transfer(spi_cs, txbuf, 3, nullptr, nullptr);
+        if(ok) driver_configuration_register_value = datagram;
+    }
+    if(ok) ok = spi->queue_transfer(spi_cs, txbuf, 3, fnc, this);
+
+    lock(false);
+    return ok;
+}
+
+// called from the SPI DMA ISR
+void TMC2590::status_read(void *arg, const uint8_t *rx)
+{
+    TMC2590 *t = static_cast<TMC2590*>(arg);
+    if(rx == nullptr) {
+        // the transfer failed
+        t->polled_status_valid = false;
+        return;
+    }
+    t->polled_status = ((rx[0] << 16) | (rx[1] << 8) | (rx[2])) >> 4;
+    t->polled_status_valid = true;
+}
+
+// called from the SPI DMA ISR
+void TMC2590::stallguard_read(void *arg, const uint8_t *rx)
+{
+    TMC2590 *t = static_cast<TMC2590*>(arg);
+    if(rx == nullptr) {
+        // the transfer failed
+        t->polled_stallguard = -1;
+        return;
+    }
+    uint32_t status = ((rx[0] << 16) | (rx[1] << 8) | (rx[2])) >> 4;
+    t->polled_stallguard = status >> 10;
+}
+
 bool TMC2590::check_standstill()
 {
     // gets called once a second from robot periodic_checks()
@@ -123,6 +123,8 @@ public:
     virtual bool check_errors();
     virtual uint32_t get_status() const;
     virtual void lock(bool flg);
+    virtual void request_stallguard();
+    virtual int get_stallguard() const { return polled_stallguard; }
 
     virtual bool config(ConfigReader& cr, const char *actuator_name);
     virtual void dump_status(OutputStream& stream, bool readable= true);
@@ -421,7 +423,11 @@ private:
 private:
     //helper routione to get the top 10 bit of the readout
     inline int getReadoutValue();
-    bool check_error_status_bits(OutputStream& stream);
+    bool check_error_status_bits(OutputStream& stream, bool polled= false);
+    void request_status();
+    bool queue_status_read(uint32_t selection, void (*fnc)(void *, const uint8_t *));
+    static void status_read(void *arg, const uint8_t *rx);
+    static void stallguard_read(void *arg, const uint8_t *rx);
     bool check_standstill();
 
     // SPI sender
@@ -452,6 +458,10 @@ private:
     unsigned long driver_configuration_register_value;
     //the driver status result
     unsigned long driver_status_result;
+    // the status read in the background by request_status()
+    volatile uint32_t polled_status{0};
+    volatile bool polled_status_valid{false};
+    volatile int polled_stallguard{-1};
 
     //status values
     int microsteps; //the current number of micro steps
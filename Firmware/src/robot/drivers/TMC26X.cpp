@@ -901,6 +901,8 @@ bool TMC26X::isEnabled()
  */
 void TMC26X::readStatus(enum READOUT read_value)
 {
+    // the background status reads also change the read selection
+    lock(true);
     unsigned long old_driver_configuration_register_value = driver_configuration_register_value;
     //reset the readout configuration
     driver_configuration_register_value &= ~(READ_SELECTION_PATTERN);
@@ -921,7 +923,6 @@ void TMC26X::readStatus(enum READOUT read_value)
             break;
     }
 
-    // FIXME this needs to be atomic as a readStatus in between the two could change the results read back
     //check if the readout is configured for the value we are interested in
     if (driver_configuration_register_value != old_driver_configuration_register_value) {
         //because then we need to write the value twice - one time for configuring, second time to get the value, see below
@@ -929,6 +930,7 @@ void TMC26X::readStatus(enum READOUT read_value)
     }
     //write the configuration to get the last status
     send262(driver_configuration_register_value);
+    lock(false);
 }
 
 //reads the stall guard setting from last status
@@ -1098,6 +1100,8 @@ void TMC26X::dump_status(OutputStream& stream, bool readable)
             stream.printf("Motor is standing still.\n");
         }
 
+        stream.printf("Last background status read: %05lX\n", polled_status);
+
         int value = getReadoutValue();
         stream.printf("Microstep position phase A: %d\n", value);
 
@@ -1254,10 +1258,17 @@ const std::array<TMC26X::e_t, 6> TMC26X::tests {{
 }};
 
 // check error bits and report, only report once, and debounce the test
-bool TMC26X::check_error_status_bits(OutputStream& stream)
+bool TMC26X::check_error_status_bits(OutputStream& stream, bool polled)
 {
     bool error = false;
-    readStatus(TMC26X_READOUT_POSITION); // get the status bits
+    if(polled) {
+        // use the status read in the background since the last check
+        if(!polled_status_valid) return false;
+        polled_status_valid = false;
+        driver_status_result = polled_status;
+    } else {
+        readStatus(TMC26X_READOUT_POSITION); // get the status bits
+    }
 
     // test the flags are ok
     if((driver_status_result & 0x00300) != 0){
@@ -1343,16 +1354,81 @@ bool TMC26X::check_errors()
 {
     std::ostringstream oss;
     OutputStream os(&oss);
-    bool b= check_error_status_bits(os);
+    bool b= check_error_status_bits(os, true);
     if(!oss.str().empty()) {
         print_to_all_consoles(oss.str().c_str());
     }
 
     // see if we need to set the standstill current
     check_standstill();
+
+    // read the status for next time without holding up the caller
+    request_status();
     return b;
 }
 
+// queue a read of the status bits to be done by DMA, all the drivers are read in one batch and
+// check_errors() uses the result the next time it is called
+void TMC26X::request_status()
+{
+    if(!queue_status_read(0, &TMC26X::status_read)) polled_status_valid = false;
+}
+
+// StallGuard is read at a high rate while homing or monitoring for stalls so it is also done in the background
+void TMC26X::request_stallguard()
+{
+    // get_stallguard() returns -1 until a new reading arrives if this one could not be queued
+    if(!queue_status_read(READ_STALL_GUARD_READING, &TMC26X::stallguard_read)) polled_stallguard = -1;
+}
+
+// returns false if the read could not be queued, fnc is not called in that case
+bool TMC26X::queue_status_read(uint32_t selection, void (*fnc)(void *, const uint8_t *))
+{
+    // the register is also changed by the command thread, the read is just skipped this time rather than
+    // holding up the timer task if it is busy
+    if(plock != nullptr && xSemaphoreTake(plock, 0) != pdTRUE) return false;
+
+    uint32_t datagram = (driver_configuration_register_value & ~(READ_SELECTION_PATTERN)) | selection;
+    uint8_t txbuf[] {(uint8_t)(datagram >> 16), (uint8_t)(datagram >>  8), (uint8_t)(datagram & 0xff)};
+
+    bool ok = true;
+    // the status returned is selected by the previous write, so it needs an extra write if the selection changed
+    if(datagram != driver_configuration_register_value) {
+        ok = spi->queue_transfer(spi_cs, txbuf, 3, nullptr, nullptr);
+        if(ok) driver_configuration_register_value = datagram;
+    }
+    if(ok) ok = spi->queue_transfer(spi_cs, txbuf, 3, fnc, this);
+
+    lock(false);
+    return ok;
+}
+
+// called from the SPI DMA ISR
+void TMC26X::status_read(void *arg, const uint8_t *rx)
+{
+    TMC26X *t = static_cast<TMC26X*>(arg);
+    if(rx == nullptr) {
+        // the transfer failed
+        t->polled_status_valid = false;
+        return;
+    }
+    t->polled_status = ((rx[0] << 16) | (rx[1] << 8) | (rx[2])) >> 4;
+    t->polled_status_valid = true;
+}
+
+// called from the SPI DMA ISR
+void TMC26X::stallguard_read(void *arg, const uint8_t *rx)
+{
+    TMC26X *t = static_cast<TMC26X*>(arg);
+    if(rx == nullptr) {
+        // the transfer failed
+        t->polled_stallguard = -1;
+        return;
+    }
+    uint32_t status = ((rx[0] << 16) | (rx[1] << 8) | (rx[2])) >> 4;
+    t->polled_stallguard = status >> 10;
+}
+
 // sets a raw register to the value specified, for advanced settings
 // register 255 writes them, 0 displays what registers are mapped to what
 // FIXME status registers not reading back correctly, check docs
@@ -131,6 +131,8 @@ public:
     virtual bool set_options(const GCode& gcode);
     virtual uint32_t get_status() const;
     virtual void lock(bool flg);
+    virtual void request_stallguard();
+    virtual int get_stallguard() const { return polled_stallguard; }
 
 private:
 
@@ -446,7 +448,11 @@ private:
 
     //helper routione to get the top 10 bit of the readout
     inline int getReadoutValue();
-    bool check_error_status_bits(OutputStream& stream);
+    bool check_error_status_bits(OutputStream& stream, bool polled= false);
+    void request_status();
+    bool queue_status_read(uint32_t selection, void (*fnc)(void *, const uint8_t *));
+    static void status_read(void *arg, const uint8_t *rx);
+    static void stallguard_read(void *arg, const uint8_t *rx);
     bool check_standstill();
 
     // SPI sender
@@ -475,6 +481,10 @@ private:
     unsigned long driver_configuration_register_value;
     //the driver status result
     unsigned long driver_status_result;
+    // the status read in the background by request_status()
+    volatile uint32_t polled_status{0};
+    volatile bool polled_status_valid{false};
+    volatile int polled_stallguard{-1};
 
     //status values
     int microsteps; //the current number of micro steps
@@ -24,6 +24,9 @@ public:
 	virtual bool set_options(const GCode& gcode)=0;
 	virtual uint32_t get_status() const { return 0; }
     virtual void lock(bool) {}
+    // queue a background read of the StallGuard value, get_stallguard() returns the last one read, or -1 if the last read failed
+    virtual void request_stallguard() {}
+    virtual int get_stallguard() const { return -1; }
 
     // bit masks for status bits returned in get_status
     static const uint32_t IS_STANDSTILL_CURRENT = 1;
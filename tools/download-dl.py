@@ -8,6 +8,8 @@ import os
 import argparse
 import serial
 import time
+import hashlib
+import io
 
 
 def signal_term_handler(signal, frame):
@@ -25,6 +27,7 @@ parser.add_argument('device', help='Smoothie Serial Device')
 parser.add_argument('-v', '--verbose', action='store_true', default=False, help='verbose output')
 parser.add_argument('-f', '--flash', action='store_true', default=False, help='flash')
 parser.add_argument('-o', '--outfn', nargs='?', default="", help='output file name')
+parser.add_argument('-z', '--compress', action='store_true', default=False, help='compress with heatshrink, smoothie decompresses .hs files when played')
 args = parser.parse_args()
 
 filename = args.file
@@ -39,9 +42,18 @@ else:
 if args.verbose:
     pass
 
-f = open(filename, "rb")
+with open(filename, "rb") as inf:
+    data = inf.read()
 
-filesize = os.path.getsize(filename)
+if args.compress and not args.flash:
+    # needs pip install heatshrink2, the window and lookahead must match HeatshrinkReader in the firmware
+    import heatshrink2
+    data = heatshrink2.compress(data, window_sz2=11, lookahead_sz2=4)
+    outfile += ".hs"
+
+f = io.BytesIO(data)
+filesize = len(data)
+md5 = hashlib.md5(data).hexdigest()
 
 print("Downloading file: {}, size: {} to {}".format(filename, filesize, dev))
 
@@ -64,7 +76,8 @@ while not gotok:
 
 ser.flushInput()  # Flush startup text in serial input
 
-ser.write(bytes('dl {} {}\n'.format(outfile, filesize).encode('latin1')))
+# the md5 is checked by smoothie once the file is written
+ser.write(bytes('dl {} {} {}\n'.format(outfile, filesize, md5).encode('latin1')))
 
 # wait for READY or FAIL
 ll = ser.read_until().decode('latin1')